@@ -180,6 +180,16 @@ SL_API int32_t* sl_text_analyze(sl_analyzer_handle_t analyzer_handle, const char
 /// Note: the return value must be freed by calling sl_free_buffer after use
 SL_API int32_t* sl_text_analyze_line(sl_analyzer_handle_t analyzer_handle, const char* text, int32_t* line_info);
 
+/// Perform single line highlight analysis on a caller-owned buffer, without copying the line
+/// @param analyzer_handle Plain text highlight analyzer handle
+/// @param text Start of the single line text content, need not be null-terminated
+/// @param text_length Byte length of the line text, must not be negative
+/// @param line_info Metadata for the current line, same as sl_text_analyze_line
+/// @return Analysis result, format same as sl_text_analyze_line; nullptr when the arguments are invalid
+/// Note: the return value must be freed by calling sl_free_buffer after use
+SL_API int32_t* sl_text_analyze_line_with_length(sl_analyzer_handle_t analyzer_handle, const char* text,
+  int32_t text_length, int32_t* line_info);
+
 /// Perform indent guide analysis on plain text
 /// @param analyzer_handle Plain text analyzer handle
 /// @param text Text content
@@ -297,6 +307,31 @@ SL_API int32_t* sl_document_analyze_incremental(sl_analyzer_handle_t analyzer_ha
 SL_API int32_t* sl_document_analyze_incremental_in_line_range(
   sl_analyzer_handle_t analyzer_handle, int32_t* changes_range, const char* new_text, int32_t* visible_range);
 
+/// Apply several non-overlapping edits to a managed document at once and re-analyze it in a single pass.
+/// Every range refers to the text before the batch, edits may come in any order
+/// @param analyzer_handle Document highlight analyzer handle
+/// @param changes_ranges change_count change ranges, array structure: [startLine],[startColumn],[endLine],[endColumn]...
+/// @param new_texts change_count replacement texts, in the order of changes_ranges
+/// @param change_count Number of edits
+/// @return Full analysis result for the entire document, same format as sl_document_analyze_incremental.
+/// Returns nullptr and leaves the document unchanged when two ranges overlap
+/// Note: the return value must be freed by calling sl_free_buffer after use
+SL_API int32_t* sl_document_analyze_incremental_batch(sl_analyzer_handle_t analyzer_handle, int32_t* changes_ranges,
+  const char** new_texts, int32_t change_count);
+
+/// Apply several non-overlapping edits to a managed document at once, returning only a highlight slice for the
+/// specified line range
+/// @param analyzer_handle Document highlight analyzer handle
+/// @param changes_ranges change_count change ranges, array structure: [startLine],[startColumn],[endLine],[endColumn]...
+/// @param new_texts change_count replacement texts, in the order of changes_ranges
+/// @param change_count Number of edits
+/// @param visible_range Visible line range, array structure: [startLine],[lineCount]
+/// @return Highlight slice for the specified line range, same format as sl_document_analyze_incremental_in_line_range.
+/// Returns nullptr and leaves the document unchanged when two ranges overlap
+/// Note: the return value must be freed by calling sl_free_buffer after use
+SL_API int32_t* sl_document_analyze_incremental_batch_in_line_range(sl_analyzer_handle_t analyzer_handle,
+  int32_t* changes_ranges, const char** new_texts, int32_t change_count, int32_t* visible_range);
+
 /// Get highlight slice from the current cached document highlight result without triggering new analysis
 /// @param analyzer_handle Document highlight analyzer handle
 /// @param visible_range Visible line range, array structure: [startLine],[lineCount]
@@ -372,7 +407,8 @@ SL_API sl_error_t sl_free_document_analyzer(sl_analyzer_handle_t analyzer_handle
 
 /// Free the memory of analysis results. All analysis functions returning int32_t*
 /// (such as sl_text_analyze, sl_document_analyze, sl_document_analyze_incremental,
-/// sl_document_analyze_incremental_in_line_range, sl_document_get_highlight_slice) must be freed via this function
+/// sl_document_analyze_incremental_in_line_range, sl_document_analyze_incremental_batch,
+/// sl_document_get_highlight_slice) must be freed via this function
 /// @param result Highlight analysis result
 SL_API void sl_free_buffer(int32_t* result);
 
@@ -81,6 +81,9 @@ inline int32_t packHighlightConfig(const HighlightConfig& config) {
   if (config.inline_style) {
     bits |= 1 << 1;
   }
+  if (config.keep_matched_text) {
+    bits |= 1 << 2;
+  }
   // Encode tab_size into bit8~bit15 (8 bits, supports 0~255)
   bits |= (config.tab_size & 0xFF) << 8;
   return bits;
@@ -94,6 +97,8 @@ inline HighlightConfig unpackHighlightConfig(int32_t bits) {
   if ((bits & (1 << 1)) != 0) {
     config.inline_style = true;
   }
+  // Bindings only transfer ranges and style ids, so matched text is opt-in here
+  config.keep_matched_text = (bits & (1 << 2)) != 0;
   int32_t tab_size = (bits >> 8) & 0xFF;
   if (tab_size > 0) {
     config.tab_size = tab_size;
@@ -62,6 +62,116 @@ namespace NS_SWEETLINE {
     int32_t char_delta {0};
   };
 
+  /// One edit of a batch: replace a line/column range with new text
+  struct TextEdit {
+    /// Range to replace, in the text before any edit of the batch is applied
+    TextRange range;
+    /// Replacement text
+    U8String new_text;
+  };
+
+  /// Lines of a Document kept in blocks of bounded size, so inserting or erasing lines only moves the lines of
+  /// the blocks involved instead of every line after them. Each block keeps the character counts of its lines,
+  /// and Fenwick trees over the line and character counts of the blocks find a line's block and turn
+  /// line/character index conversions into O(log n) lookups. An edit inside a block updates both trees in
+  /// O(log n); only splitting, merging or dropping blocks rebuilds them, in O(number of blocks).
+  class DocumentLineStore {
+  public:
+    /// Lines a block grows to before it is split
+    static constexpr size_t kMaxBlockLines = 1024;
+
+    size_t size() const;
+
+    bool empty() const;
+
+    const DocumentLine& operator[](size_t line) const;
+
+    /// Mutable access to a line, call recountLine after changing it
+    DocumentLine& operator[](size_t line);
+
+    void clear();
+
+    /// Replace all lines
+    void assign(List<DocumentLine>&& lines);
+
+    /// Insert lines before the specified line, line may be size() to append
+    void insert(size_t line, List<DocumentLine>::const_iterator first, List<DocumentLine>::const_iterator last);
+
+    /// Erase the lines in [first, last)
+    void erase(size_t first, size_t last);
+
+    /// Recount the characters of a line that was changed in place
+    void recountLine(size_t line);
+
+    /// Character count of a line, including its line ending
+    size_t lineCharCount(size_t line) const;
+
+    /// Index of the first character of a line in the full text
+    size_t charIndexOfLine(size_t line) const;
+
+    /// Line containing a character index, which must be less than totalChars()
+    size_t lineAtCharIndex(size_t char_index) const;
+
+    /// Character count of all lines
+    size_t totalChars() const;
+
+    /// Call func with each line from the specified one to the end, in order
+    template<typename Func>
+    void forEachLine(size_t line, Func&& func) const {
+      if (line >= m_line_count_) {
+        return;
+      }
+      size_t offset = 0;
+      size_t block_index = findBlock(line, offset);
+      for (; block_index < m_blocks_.size(); ++block_index, offset = 0) {
+        const List<DocumentLine>& lines = m_blocks_[block_index].lines;
+        for (; offset < lines.size(); ++offset) {
+          func(lines[offset]);
+        }
+      }
+    }
+  private:
+    struct LineBlock {
+      List<DocumentLine> lines;
+      /// Character count of each line, including its line ending
+      List<size_t> char_counts;
+      /// Characters before each line, counted from the block start
+      List<size_t> char_starts;
+      size_t char_count {0};
+    };
+
+    List<LineBlock> m_blocks_;
+    /// Fenwick tree over the line counts of the blocks, 1-based
+    List<size_t> m_block_line_tree_;
+    /// Fenwick tree over the character counts of the blocks, 1-based
+    List<size_t> m_block_char_tree_;
+    size_t m_line_count_ {0};
+    size_t m_char_count_ {0};
+
+    /// Block containing a line
+    /// @param offset Receives the index of the line within the block
+    size_t findBlock(size_t line, size_t& offset) const;
+    /// Split the block into half-full blocks if it outgrew kMaxBlockLines
+    /// @return Whether the block was split
+    bool splitBlock(size_t block_index);
+    /// Merge a block that shrank below a quarter of kMaxBlockLines into its next block, if they fit in one
+    /// @return Whether the blocks were merged
+    bool mergeBlock(size_t block_index);
+    /// Rebuild both Fenwick trees after blocks were added or removed
+    void rebuildBlockIndex();
+    /// Add line and character deltas of a block that changed in place to both Fenwick trees
+    void updateBlockIndex(size_t block_index, size_t line_delta, size_t char_delta);
+    /// Lines in the blocks before the specified one
+    size_t blockLinePrefix(size_t block_index) const;
+    /// Characters in the blocks before the specified one
+    size_t blockCharPrefix(size_t block_index) const;
+    /// Index of the last block whose preceding blocks sum up to at most value, value receives the rest
+    static size_t descendTree(const List<size_t>& tree, size_t& value);
+    static size_t treePrefix(const List<size_t>& tree, size_t block_index);
+    static void rebuildCharStarts(LineBlock& block);
+    static size_t countLineChars(const DocumentLine& line);
+  };
+
   /// Text document with incremental update support
   class Document {
   public:
@@ -102,6 +212,19 @@ namespace NS_SWEETLINE {
     /// @return Total line and character deltas after the patch
     PatchResult patch(const TextRange& range, const U8String& new_text);
 
+    /// Apply several non-overlapping edits at once. Every range refers to the text before the batch, edits may
+    /// come in any order, edits inserting at the same position keep their order in the list
+    /// @param edits The edits to apply
+    /// @return Total line and character deltas of the whole batch
+    /// @throws std::invalid_argument when a range ends before it starts or two ranges overlap
+    PatchResult applyPatches(const List<TextEdit>& edits);
+
+    /// Edits in the order applyPatches sees them: positions past the last line moved to the end of the text,
+    /// sorted by position and checked not to overlap
+    /// @param edits The edits to normalize
+    /// @throws std::invalid_argument when a range ends before it starts or two ranges overlap
+    List<TextEdit> normalizeEdits(const List<TextEdit>& edits) const;
+
     /// Append text
     /// @param text Text to append
     PatchResult appendText(const U8String& text);
@@ -131,14 +254,9 @@ namespace NS_SWEETLINE {
   private:
     friend class TextAnalyzer;
     U8String m_uri_;
-    List<DocumentLine> m_lines_;
-    List<size_t> m_line_total_widths_;
-    List<size_t> m_line_start_indices_;
+    DocumentLineStore m_lines_;
     bool isValidPosition(const TextPosition& pos) const;
     size_t positionToCharIndex(const TextPosition& pos) const;
-    void rebuildLineMetrics();
-    void rebuildLineMetricsFrom(size_t start_line);
-    static size_t getLineTotalWidth(const DocumentLine& line);
 
     static void splitTextIntoLines(const U8String& text, List<DocumentLine>& result);
     PatchResult patchSingleLine(const TextRange& range, const List<DocumentLine>& new_lines);
@@ -10,7 +10,7 @@ namespace NS_SWEETLINE {
   struct TokenSpan {
     /// Range of the token span
     TextRange range;
-    /// Matched text content
+    /// Matched text content (empty when HighlightConfig::keep_matched_text is off)
     U8String matched_text;
     /// Style ID matched by this token span (0 means unstyled)
     int32_t style_id;
@@ -65,6 +65,14 @@ namespace NS_SWEETLINE {
     size_t line_count {0};
   };
 
+  /// Column range of the visible area, in characters
+  struct ColumnRange {
+    /// Start column
+    size_t start_column {0};
+    /// Column count
+    size_t column_count {0};
+  };
+
   /// Highlight result slice for a specified line range
   struct DocumentHighlightSlice {
     /// Actual start line (may be clipped by boundary)
@@ -73,6 +81,8 @@ namespace NS_SWEETLINE {
     size_t total_line_count {0};
     /// Consecutive line highlight results
     List<LineHighlight> lines;
+    /// Whether the lines were analyzed from a sync point instead of from the document start (see HighlightConfig::sync_distance), so they may still change once the lines above are analyzed
+    bool provisional {false};
   };
 
   /// Scope state
@@ -206,6 +216,9 @@ namespace NS_SWEETLINE {
     int32_t end_state {SyntaxRule::kDefaultStateId};
     /// Total character count analyzed in the current line (not bytes), excluding line ending
     size_t char_count {0};
+    /// Whether analysis stopped early because HighlightConfig::line_time_budget_ms or a regex limit was exceeded;
+    /// the rest of the line has no spans, and the line ends in the state reached so far (after its lineEnd transition)
+    bool truncated {false};
   };
 
   /// Highlight configuration
@@ -216,11 +229,53 @@ namespace NS_SWEETLINE {
     bool inline_style {false};
     /// Tab width, used for calculating indentation level in indent guide analysis (1 tab = tab_size spaces)
     int32_t tab_size {4};
+    /// Whether each TokenSpan carries a copy of its matched text; renderers that only read ranges and style IDs can turn it off to avoid per-span string allocations
+    bool keep_matched_text {true};
+    /// Capacity (in lines) of the engine-wide LRU cache of line analysis results, kept per syntax rule and shared by all analyzers the engine creates for it; 0 disables the cache
+    size_t line_cache_capacity {0};
+    /// Whether states whose token patterns are all regular find match starts with a lazily built DFA on single-line ASCII text, leaving only the final match (rule and capture groups) to Oniguruma; results are the same either way
+    bool use_builtin_dfa {true};
+    /// Backtracking retry limit of one regex search, guarding against patterns with catastrophic backtracking; 0 keeps Oniguruma's defaults. A search over the limit truncates the line (see LineAnalyzeResult::truncated)
+    size_t regex_retry_limit {0};
+    /// Match stack limit (in entries) of one regex search; 0 keeps Oniguruma's default (unlimited). A search over the limit truncates the line
+    uint32_t regex_stack_limit {0};
+    /// Wall-clock budget in milliseconds for analyzing one line, checked between tokens; 0 disables it. Once exceeded, the line is truncated
+    uint32_t line_time_budget_ms {0};
+    /// Length in bytes past which a document line is analyzed in column windows (see DocumentAnalyzer::analyzeLineRange with a ColumnRange); 0 disables it. Such lines keep no spans in the document highlight, only resume checkpoints
+    size_t long_line_threshold {0};
+    /// Distance in characters between the resume checkpoints of a long line
+    size_t long_line_window {4096};
+    /// When a visible line range starts more than this many lines past the analyzed lines, DocumentAnalyzer::analyzeLineRange starts from the nearest line at most this far above the range that matches a sync rule of the syntax, and returns a provisional slice; 0 disables sync points
+    size_t sync_distance {0};
+    /// Whether states search each token pattern on its own and keep every pattern's next match for the rest of the line, only searching again the patterns whose match the cursor has passed, instead of searching the merged pattern after every token; results are the same either way. Takes effect for syntaxes compiled by an engine with this option, on text the built-in DFA does not handle
+    bool use_rule_scanner {false};
 
     static HighlightConfig kDefault;
   };
 
+  /// Statistics of the engine-wide line analysis cache
+  struct LineCacheStats {
+    /// Lines served from the cache
+    size_t hits {0};
+    /// Lines that had to be analyzed
+    size_t misses {0};
+    /// Lines currently cached, over all syntax rules
+    size_t size {0};
+    /// Total capacity over all syntax rules
+    size_t capacity {0};
+  };
+
+  /// Statistics of lines whose analysis was truncated, see LineAnalyzeResult::truncated
+  struct AnalyzeBudgetStats {
+    /// Lines that ran over HighlightConfig::line_time_budget_ms
+    size_t time_budget_exceeded {0};
+    /// Lines cut short because a regex search hit HighlightConfig::regex_retry_limit or regex_stack_limit
+    size_t regex_limit_exceeded {0};
+  };
+
   class LineHighlightAnalyzer;
+  class LineAnalyzeCache;
+  struct AnalyzeBudgetCounters;
   /// Plain text highlight analyzer, no incremental update support, suitable for full analysis scenarios
   class TextAnalyzer {
   public:
@@ -237,6 +292,13 @@ namespace NS_SWEETLINE {
     /// @param result Receives the single line analysis result
     void analyzeLine(const U8String& text, const TextLineInfo& line_info, LineAnalyzeResult& result) const;
 
+    /// Analyze a single line of text held in a caller-owned buffer, without copying it
+    /// @param text Start of the single line text content, need not be null-terminated
+    /// @param length Byte length of the line text
+    /// @param line_info Metadata for the current line
+    /// @param result Receives the single line analysis result
+    void analyzeLine(const char* text, size_t length, const TextLineInfo& line_info, LineAnalyzeResult& result) const;
+
     /// Perform indent guide analysis on a text
     /// @param text Full text content
     /// @return Indent guide analysis result
@@ -250,6 +312,9 @@ namespace NS_SWEETLINE {
     /// Get the current highlight configuration
     const HighlightConfig& getHighlightConfig() const;
   private:
+    friend class HighlightEngine;
+    TextAnalyzer(const SharedPtr<SyntaxRule>& rule, const HighlightConfig& config,
+      const SharedPtr<LineAnalyzeCache>& line_cache, const SharedPtr<AnalyzeBudgetCounters>& budget_counters);
     SharedPtr<SyntaxRule> m_rule_;
     UniquePtr<LineHighlightAnalyzer> m_line_highlight_analyzer_;
     HighlightConfig m_config_;
@@ -259,15 +324,26 @@ namespace NS_SWEETLINE {
   /// Managed document highlight analyzer with automatic patch and incremental analysis support
   class DocumentAnalyzer {
   public:
-    /// Perform full highlight analysis on the managed document
+    /// Perform full highlight analysis on the managed document. Lines longer than
+    /// HighlightConfig::long_line_threshold come back without spans, read them with a ColumnRange
     /// @return Highlight result for the entire managed document
     SharedPtr<DocumentHighlight> analyze() const;
 
-    /// Analyze enough lines to cover the requested line range and return the corresponding slice
+    /// Analyze enough lines to cover the requested line range and return the corresponding slice. Lines longer than
+    /// HighlightConfig::long_line_threshold come back without spans, read them with a ColumnRange
     /// @param visible_range The visible line range to analyze and return
     /// @return Highlight slice for the specified line range
     SharedPtr<DocumentHighlightSlice> analyzeLineRange(const LineRange& visible_range) const;
 
+    /// Analyze enough to cover the requested lines and columns and return the spans on screen, i.e. those overlapping
+    /// the columns. Lines longer than HighlightConfig::long_line_threshold are only analyzed up to the last visible
+    /// column, resuming from the nearest checkpoint, and are completed only when a later line needs their end state.
+    /// @param visible_range The visible line range to analyze and return
+    /// @param visible_columns The visible column range
+    /// @return Highlight slice for the specified line range, with the spans of the visible columns only
+    SharedPtr<DocumentHighlightSlice> analyzeLineRange(const LineRange& visible_range,
+      const ColumnRange& visible_columns) const;
+
     /// Incrementally re-analyze the entire managed document based on patch content
     /// @param range The change range of the patch
     /// @param new_text The patched text
@@ -282,6 +358,22 @@ namespace NS_SWEETLINE {
     SharedPtr<DocumentHighlightSlice> analyzeIncrementalInLineRange(const TextRange& range, const U8String& new_text,
       const LineRange& visible_range) const;
 
+    /// Apply several non-overlapping edits at once (see Document::applyPatches) and re-analyze the entire managed
+    /// document in a single pass. Only the changed lines are invalidated, the lines between the edits are reused
+    /// once the analysis reaches them in the state they were analyzed with
+    /// @param edits The edits, every range refers to the text before the batch
+    /// @return Highlight result for the entire managed document
+    /// @throws std::invalid_argument when two edit ranges overlap, the document is left unchanged
+    SharedPtr<DocumentHighlight> analyzeIncrementalBatch(const List<TextEdit>& edits) const;
+
+    /// Apply several non-overlapping edits at once, ensuring the requested line range is available in the cache
+    /// @param edits The edits, every range refers to the text before the batch
+    /// @param visible_range The visible line range to return
+    /// @return Highlight slice for the specified line range
+    /// @throws std::invalid_argument when two edit ranges overlap, the document is left unchanged
+    SharedPtr<DocumentHighlightSlice> analyzeIncrementalBatchInLineRange(const List<TextEdit>& edits,
+      const LineRange& visible_range) const;
+
     /// Get highlight slice from the current cached result without triggering new analysis
     /// @param visible_range The visible line range to return
     /// @return Highlight slice for the specified line range
@@ -321,8 +413,10 @@ namespace NS_SWEETLINE {
     SharedPtr<BracketPairResult> analyzeBracketPairsInLineRange(const LineRange& visible_range) const;
   private:
     friend class HighlightEngine;
+    friend InternalDocumentAnalyzer& getInternalDocumentAnalyzer(const DocumentAnalyzer& analyzer);
     DocumentAnalyzer(const SharedPtr<Document>& document, const SharedPtr<SyntaxRule>& rule,
-      const HighlightConfig& config = HighlightConfig::kDefault);
+      const HighlightConfig& config = HighlightConfig::kDefault, const SharedPtr<LineAnalyzeCache>& line_cache = nullptr,
+      const SharedPtr<AnalyzeBudgetCounters>& budget_counters = nullptr);
     UniquePtr<InternalDocumentAnalyzer> analyzer_impl_;
   };
 
@@ -388,13 +482,30 @@ namespace NS_SWEETLINE {
     /// Remove a previously loaded managed document
     /// @param uri URI of the managed document
     void removeDocument(const U8String& uri);
+
+    /// Get hit/miss statistics of the line analysis cache (all zero when HighlightConfig::line_cache_capacity is 0)
+    LineCacheStats getLineCacheStats() const;
+
+    /// Drop every cached line and reset the statistics
+    void clearLineCache();
+
+    /// Get how often analyzers of this engine truncated a line over its time budget or a regex limit
+    AnalyzeBudgetStats getAnalyzeBudgetStats() const;
   private:
     HighlightConfig m_config_;
     HashSet<SharedPtr<SyntaxRule>> m_syntax_rules_;
+    /// Line analysis caches by syntax rule, only created when HighlightConfig::line_cache_capacity is not 0
+    HashMap<SharedPtr<SyntaxRule>, SharedPtr<LineAnalyzeCache>> m_line_caches_;
+    /// Truncation counters shared by every analyzer the engine creates
+    SharedPtr<AnalyzeBudgetCounters> m_budget_counters_;
     HashMap<U8String, SharedPtr<DocumentAnalyzer>> m_analyzer_map_;
     SharedPtr<StyleMapping> m_style_mapping_;
     /// Set of defined macros
     HashSet<U8String> m_macros_;
+
+    void registerSyntaxRule(const SharedPtr<SyntaxRule>& rule);
+    SharedPtr<LineAnalyzeCache> getLineCache(const SharedPtr<SyntaxRule>& rule) const;
+    SharedPtr<TextAnalyzer> createTextAnalyzer(const SharedPtr<SyntaxRule>& rule) const;
   };
 }
 
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -38,6 +39,7 @@ namespace NS_SWEETLINE {
 #endif
 
   using U8String = std::string;
+  using U8StringView = std::string_view;
 
   template<typename T>
   using List = std::vector<T>;
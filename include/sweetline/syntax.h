@@ -84,6 +84,7 @@ namespace NS_SWEETLINE {
   struct ScopeRule;
   struct ScopeSkipRule;
   struct BracketRule;
+  struct SyncRule;
   struct SyntaxRuleRuntimeData;
   class SyntaxRuleCompiler;
   /// Syntax rule definition
@@ -114,6 +115,8 @@ namespace NS_SWEETLINE {
     List<BracketRule> bracket_rules;
     /// Lexical skip rules used by bracket pair analysis
     List<ScopeSkipRule> bracket_skip_rules;
+    /// Sync rules: lines whose start state is known from their text alone
+    List<SyncRule> sync_rules;
 
     bool containsInlineStyle(int32_t style_id);
     InlineStyle& getInlineStyle(int32_t style_id);
@@ -121,7 +124,13 @@ namespace NS_SWEETLINE {
     int32_t getOrCreateStateId(const U8String& state_name);
     bool containsRule(int32_t state_id) const;
     StateRule& getStateRule(int32_t state_id);
+    /// Compiled state rule by ID from a table built after compilation, nullptr if the state does not exist
+    const StateRule* findStateRule(int32_t state_id) const;
+    /// Inline style by ID from a table built after compilation, nullptr if the style has none
+    const InlineStyle* findInlineStyle(int32_t style_id) const;
     bool matchesFileNamePattern(const U8String& file_name, size_t index) const;
+    /// State a line starts in according to the first sync rule that matches it, -1 if none does
+    int32_t matchSyncState(const U8String& line_text) const;
 
     SyntaxRule();
     ~SyntaxRule();
@@ -17,6 +17,18 @@ namespace NS_SWEETLINE {
     /// @param str UTF-8 text
     static size_t countChars(const U8String& str);
 
+    /// Count the number of characters in a UTF-8 byte range
+    /// @param begin Start of the byte range
+    /// @param end End of the byte range (exclusive)
+    static size_t countChars(const char* begin, const char* end);
+
+    /// Advance a byte pointer over the specified number of characters
+    /// @param it Start of the byte range, must be on a character boundary
+    /// @param end End of the byte range (exclusive)
+    /// @param char_count Number of characters to skip
+    /// @return Pointer after the skipped characters, never beyond end
+    static const char* advanceChars(const char* it, const char* end, size_t char_count);
+
     /// Convert character position to byte position
     /// @param str UTF-8 text
     /// @param char_pos Character position
@@ -37,6 +49,15 @@ namespace NS_SWEETLINE {
     /// Check if a UTF-8 string is valid
     /// @param str UTF-8 text
     static bool isValidUTF8(const U8String& str);
+
+    /// Check if a string only contains ASCII bytes, in which case byte and character positions are identical
+    /// @param str UTF-8 text
+    static bool isAscii(const U8String& str);
+
+    /// Check if a byte range only contains ASCII bytes
+    /// @param str Start of the byte range
+    /// @param length Byte length
+    static bool isAscii(const char* str, size_t length);
   };
 
   /// String utility
@@ -261,7 +261,13 @@ EMSCRIPTEN_BINDINGS(highlight) {
     .function("analyzeBracketPairsInLineRange", &DocumentAnalyzer::analyzeBracketPairsInLineRange);
 
   emscripten::class_<HighlightConfig>("HighlightConfig")
-    .constructor<>()
+    .constructor(emscripten::optional_override([]() {
+        // TokenSpan does not expose the matched text to JavaScript
+        HighlightConfig config;
+        config.keep_matched_text = false;
+        return config;
+      })
+    )
     .property("showIndex", &HighlightConfig::show_index)
     .property("inlineStyle", &HighlightConfig::inline_style)
     .property("tabSize", &HighlightConfig::tab_size);
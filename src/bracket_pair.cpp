@@ -29,7 +29,10 @@ namespace NS_SWEETLINE {
       return U8String::npos;
     }
 
-    int32_t toColumn(const U8String& text, size_t byte_pos) {
+    int32_t toColumn(const U8String& text, size_t byte_pos, bool ascii_line) {
+      if (ascii_line) {
+        return static_cast<int32_t>(byte_pos);
+      }
       return static_cast<int32_t>(Utf8Util::bytePosToCharPos(text, byte_pos));
     }
 
@@ -238,6 +241,7 @@ namespace NS_SWEETLINE {
     }
     const U8String& text = m_document_->getLine(line).text;
     const size_t line_start_index = m_document_->charIndexOfLine(line);
+    const bool ascii_line = Utf8Util::isAscii(text);
     size_t byte_pos = 0;
     while (byte_pos < text.size()) {
       if (state.skip.active && state.skip.rule != nullptr) {
@@ -290,7 +294,7 @@ namespace NS_SWEETLINE {
             break;
           }
         }
-        const int32_t column = toColumn(text, byte_pos);
+        const int32_t column = toColumn(text, byte_pos, ascii_line);
         const int32_t length = tokenLength(bracket_rule->end);
         BracketToken close_token;
         close_token.range = makeRange(line, column, length, line_start_index);
@@ -338,7 +342,7 @@ namespace NS_SWEETLINE {
         if (!matchesAt(text, byte_pos, bracket_rule->start)) {
           continue;
         }
-        const int32_t column = toColumn(text, byte_pos);
+        const int32_t column = toColumn(text, byte_pos, ascii_line);
         const int32_t length = tokenLength(bracket_rule->start);
         BracketToken token;
         token.range = makeRange(line, column, length, line_start_index);
@@ -1,7 +1,129 @@
+#include <cstring>
 #include "sweetline/c_wrapper.hpp"
+#include "internal_highlight.h"
 
 using namespace NS_SWEETLINE;
 
+namespace {
+  /// Size of the per-line part of a highlight buffer for the packed lines [start_line, start_line + line_count)
+  size_t computePackedLinesBufferSize(const PackedHighlightStore& store, size_t start_line, size_t line_count,
+    const HighlightConfig& config) {
+    size_t stride = static_cast<size_t>(computeSpanBufferStride(config));
+    size_t total_size = 0;
+    for (size_t line = start_line; line < start_line + line_count; ++line) {
+      total_size += 1 + store.spanCount(line) * stride; // line span_count + span payload
+    }
+    return total_size;
+  }
+
+  /// Write packed lines in the layout of writeTokenSpanCompact, without expanding them to TokenSpan first
+  void writePackedLines(const InternalDocumentAnalyzer& analyzer, size_t start_line, size_t line_count,
+    int32_t* buffer, size_t& index) {
+    const PackedHighlightStore& store = analyzer.getPackedHighlight();
+    const HighlightConfig& config = analyzer.getHighlightConfig();
+    SharedPtr<Document> document = analyzer.getDocument();
+    for (size_t line = start_line; line < start_line + line_count; ++line) {
+      size_t span_count = store.spanCount(line);
+      const PackedHighlightStore::Span* spans = store.lineSpans(line);
+      size_t line_start_index = config.show_index ? document->charIndexOfLine(line) : 0;
+      buffer[index++] = static_cast<int32_t>(span_count);
+      for (size_t i = 0; i < span_count; ++i) {
+        const PackedHighlightStore::Span& span = spans[i];
+        buffer[index++] = static_cast<int32_t>(span.column);
+        buffer[index++] = static_cast<int32_t>(span.length);
+        if (config.show_index) {
+          buffer[index++] = static_cast<int32_t>(line_start_index + span.column);
+        }
+        if (config.inline_style) {
+          const InlineStyle* inline_style = analyzer.getInlineStyle(span.style_id);
+          const InlineStyle& style = inline_style == nullptr ? InlineStyle {} : *inline_style;
+          buffer[index++] = static_cast<int32_t>(style.foreground);
+          buffer[index++] = static_cast<int32_t>(style.background);
+          buffer[index++] = packInlineStyleTags(style);
+        } else {
+          buffer[index++] = static_cast<int32_t>(span.style_id);
+        }
+      }
+    }
+  }
+
+  /// Same layout as writeDocumentHighlight, read from the packed store
+  int32_t* newPackedDocumentHighlightBuffer(const InternalDocumentAnalyzer& analyzer) {
+    const HighlightConfig& config = analyzer.getHighlightConfig();
+    size_t line_count = analyzer.getPackedHighlight().lineCount();
+    size_t total_size = 3 + computePackedLinesBufferSize(analyzer.getPackedHighlight(), 0, line_count, config);
+    int32_t* buffer = new int32_t[total_size];
+    size_t index = 0;
+    buffer[index++] = packSpanPayloadFlags(config);
+    buffer[index++] = computeSpanBufferStride(config);
+    buffer[index++] = static_cast<int32_t>(line_count);
+    writePackedLines(analyzer, 0, line_count, buffer, index);
+    return buffer;
+  }
+
+  /// Same layout as writeDocumentHighlightSlice, read from the packed store
+  int32_t* newPackedDocumentHighlightSliceBuffer(const InternalDocumentAnalyzer& analyzer, const LineRange& visible_range) {
+    const HighlightConfig& config = analyzer.getHighlightConfig();
+    SharedPtr<Document> document = analyzer.getDocument();
+    size_t start_line = 0;
+    size_t line_count = analyzer.clipValidRange(visible_range, start_line);
+    size_t total_size = 5 + computePackedLinesBufferSize(analyzer.getPackedHighlight(), start_line, line_count, config);
+    int32_t* buffer = new int32_t[total_size];
+    size_t index = 0;
+    buffer[index++] = packSpanPayloadFlags(config);
+    buffer[index++] = computeSpanBufferStride(config);
+    buffer[index++] = static_cast<int32_t>(start_line);
+    buffer[index++] = static_cast<int32_t>(document == nullptr ? 0 : document->getLineCount());
+    buffer[index++] = static_cast<int32_t>(line_count);
+    writePackedLines(analyzer, start_line, line_count, buffer, index);
+    return buffer;
+  }
+
+  /// Shared body of sl_text_analyze_line and sl_text_analyze_line_with_length
+  int32_t* analyzeLineToBuffer(sl_analyzer_handle_t analyzer_handle, const char* text, size_t text_length,
+    const int32_t* line_info) {
+    SharedPtr<TextAnalyzer> analyzer = getCPtrHolderValue<sl_analyzer_handle_t, TextAnalyzer>(analyzer_handle);
+    if (analyzer == nullptr || line_info == nullptr) {
+      return nullptr;
+    }
+    const HighlightConfig& config = analyzer->getHighlightConfig();
+    TextLineInfo info_struct = {static_cast<size_t>(line_info[0]), line_info[1], static_cast<size_t>(line_info[2])};
+    LineAnalyzeResult result;
+    analyzer->analyzeLine(text, text_length, info_struct, result);
+    int32_t span_count = static_cast<int32_t>(result.highlight.spans.size());
+    int32_t stride = computeSpanBufferStride(config);
+    int32_t* buffer = new int32_t[5 + span_count * stride];
+    buffer[0] = packSpanPayloadFlags(config);
+    buffer[1] = stride;
+    buffer[2] = span_count;
+    buffer[3] = result.end_state;
+    buffer[4] = static_cast<int32_t>(result.char_count);
+    writeLineHighlight(result.highlight, buffer + 5, config);
+    return buffer;
+  }
+
+  /// Edits of a batch call, false when the arrays are missing or the ranges overlap
+  bool applyBatchEdits(InternalDocumentAnalyzer& analyzer_impl, const int32_t* changes_ranges,
+    const char* const* new_texts, int32_t change_count) {
+    if (change_count < 0 || (change_count > 0 && (changes_ranges == nullptr || new_texts == nullptr))) {
+      return false;
+    }
+    List<TextEdit> edits(static_cast<size_t>(change_count));
+    for (size_t i = 0; i < edits.size(); ++i) {
+      const int32_t* change_range = changes_ranges + i * 4;
+      edits[i].range.start = {static_cast<size_t>(change_range[0]), static_cast<size_t>(change_range[1])};
+      edits[i].range.end = {static_cast<size_t>(change_range[2]), static_cast<size_t>(change_range[3])};
+      edits[i].new_text = new_texts[i] == nullptr ? "" : new_texts[i];
+    }
+    try {
+      analyzer_impl.applyPatches(edits);
+    } catch (const std::invalid_argument&) {
+      return false;
+    }
+    return true;
+  }
+}
+
 StringKeepAlive& StringKeepAlive::getInstance() {
   static thread_local StringKeepAlive string_pool;
   return string_pool;
@@ -24,6 +146,8 @@ sl_error_t sl_free_document(sl_document_handle_t document_handle) {
 
 sl_engine_handle_t sl_create_engine(bool show_index, bool inline_style, int32_t tab_size) {
   HighlightConfig config = {show_index, inline_style, tab_size};
+  // Result buffers never contain the matched text
+  config.keep_matched_text = false;
   return makeCPtrHolderToHandle<sl_engine_handle_t, HighlightEngine>(config);
 }
 
@@ -126,24 +250,18 @@ int32_t* sl_text_analyze(sl_analyzer_handle_t analyzer_handle, const char* text)
 }
 
 int32_t* sl_text_analyze_line(sl_analyzer_handle_t analyzer_handle, const char* text, int32_t* line_info) {
-  SharedPtr<TextAnalyzer> analyzer = getCPtrHolderValue<sl_analyzer_handle_t, TextAnalyzer>(analyzer_handle);
-  if (analyzer == nullptr || line_info == nullptr) {
+  if (text == nullptr) {
     return nullptr;
   }
-  const HighlightConfig& config = analyzer->getHighlightConfig();
-  TextLineInfo info_struct = {static_cast<size_t>(line_info[0]), line_info[1], static_cast<size_t>(line_info[2])};
-  LineAnalyzeResult result;
-  analyzer->analyzeLine(text, info_struct, result);
-  int32_t span_count = static_cast<int32_t>(result.highlight.spans.size());
-  int32_t stride = computeSpanBufferStride(config);
-  int32_t* buffer = new int32_t[5 + span_count * stride];
-  buffer[0] = packSpanPayloadFlags(config);
-  buffer[1] = stride;
-  buffer[2] = span_count;
-  buffer[3] = result.end_state;
-  buffer[4] = static_cast<int32_t>(result.char_count);
-  writeLineHighlight(result.highlight, buffer + 5, config);
-  return buffer;
+  return analyzeLineToBuffer(analyzer_handle, text, strlen(text), line_info);
+}
+
+int32_t* sl_text_analyze_line_with_length(sl_analyzer_handle_t analyzer_handle, const char* text,
+  int32_t text_length, int32_t* line_info) {
+  if (text_length < 0 || (text == nullptr && text_length > 0)) {
+    return nullptr;
+  }
+  return analyzeLineToBuffer(analyzer_handle, text, static_cast<size_t>(text_length), line_info);
 }
 
 int32_t* sl_text_analyze_indent_guides(sl_analyzer_handle_t analyzer_handle, const char* text) {
@@ -203,12 +321,9 @@ int32_t* sl_document_analyze(sl_analyzer_handle_t analyzer_handle) {
   if (analyzer == nullptr) {
     return nullptr;
   }
-  const HighlightConfig& config = analyzer->getHighlightConfig();
-  SharedPtr<DocumentHighlight> highlight = analyzer->analyze();
-  size_t total_size = computeDocumentHighlightBufferSize(highlight, config);
-  int32_t* buffer = new int32_t[total_size];
-  writeDocumentHighlight(highlight, buffer, config);
-  return buffer;
+  InternalDocumentAnalyzer& analyzer_impl = getInternalDocumentAnalyzer(*analyzer);
+  analyzer_impl.analyzeAllLines();
+  return newPackedDocumentHighlightBuffer(analyzer_impl);
 }
 
 int32_t* sl_document_analyze_line_range(sl_analyzer_handle_t analyzer_handle, int32_t* visible_range) {
@@ -217,12 +332,9 @@ int32_t* sl_document_analyze_line_range(sl_analyzer_handle_t analyzer_handle, in
     return nullptr;
   }
   LineRange range = {static_cast<size_t>(visible_range[0]), static_cast<size_t>(visible_range[1])};
-  SharedPtr<DocumentHighlightSlice> slice = analyzer->analyzeLineRange(range);
-  const HighlightConfig& config = analyzer->getHighlightConfig();
-  size_t total_size = computeDocumentHighlightSliceBufferSize(slice, config);
-  int32_t* buffer = new int32_t[total_size];
-  writeDocumentHighlightSlice(slice, buffer, config);
-  return buffer;
+  InternalDocumentAnalyzer& analyzer_impl = getInternalDocumentAnalyzer(*analyzer);
+  analyzer_impl.ensureAnalyzedInLineRange(range);
+  return newPackedDocumentHighlightSliceBuffer(analyzer_impl, range);
 }
 
 int32_t* sl_document_analyze_incremental(sl_analyzer_handle_t analyzer_handle, int32_t* changes_range, const char* new_text) {
@@ -230,14 +342,15 @@ int32_t* sl_document_analyze_incremental(sl_analyzer_handle_t analyzer_handle, i
   if (analyzer == nullptr || changes_range == nullptr) {
     return nullptr;
   }
-  const HighlightConfig& config = analyzer->getHighlightConfig();
   TextPosition start = {static_cast<size_t>(changes_range[0]), static_cast<size_t>(changes_range[1])};
   TextPosition end = {static_cast<size_t>(changes_range[2]), static_cast<size_t>(changes_range[3])};
-  SharedPtr<DocumentHighlight> highlight = analyzer->analyzeIncremental({start, end}, new_text);
-  size_t total_size = computeDocumentHighlightBufferSize(highlight, config);
-  int32_t* buffer = new int32_t[total_size];
-  writeDocumentHighlight(highlight, buffer, config);
-  return buffer;
+  InternalDocumentAnalyzer& analyzer_impl = getInternalDocumentAnalyzer(*analyzer);
+  analyzer_impl.applyPatch({start, end}, new_text);
+  SharedPtr<Document> document = analyzer_impl.getDocument();
+  if (document != nullptr && document->getLineCount() > 0) {
+    analyzer_impl.ensureAnalyzedThrough(document->getLineCount() - 1);
+  }
+  return newPackedDocumentHighlightBuffer(analyzer_impl);
 }
 
 int32_t* sl_document_analyze_incremental_in_line_range(
@@ -249,12 +362,42 @@ int32_t* sl_document_analyze_incremental_in_line_range(
   TextPosition start = {static_cast<size_t>(changes_range[0]), static_cast<size_t>(changes_range[1])};
   TextPosition end = {static_cast<size_t>(changes_range[2]), static_cast<size_t>(changes_range[3])};
   LineRange range = {static_cast<size_t>(visible_range[0]), static_cast<size_t>(visible_range[1])};
-  SharedPtr<DocumentHighlightSlice> slice = analyzer->analyzeIncrementalInLineRange({start, end}, new_text, range);
-  const HighlightConfig& config = analyzer->getHighlightConfig();
-  size_t total_size = computeDocumentHighlightSliceBufferSize(slice, config);
-  int32_t* buffer = new int32_t[total_size];
-  writeDocumentHighlightSlice(slice, buffer, config);
-  return buffer;
+  InternalDocumentAnalyzer& analyzer_impl = getInternalDocumentAnalyzer(*analyzer);
+  analyzer_impl.applyPatch({start, end}, new_text);
+  analyzer_impl.ensureAnalyzedInLineRange(range);
+  return newPackedDocumentHighlightSliceBuffer(analyzer_impl, range);
+}
+
+int32_t* sl_document_analyze_incremental_batch(sl_analyzer_handle_t analyzer_handle, int32_t* changes_ranges,
+  const char** new_texts, int32_t change_count) {
+  SharedPtr<DocumentAnalyzer> analyzer = getCPtrHolderValue<sl_analyzer_handle_t, DocumentAnalyzer>(analyzer_handle);
+  if (analyzer == nullptr) {
+    return nullptr;
+  }
+  InternalDocumentAnalyzer& analyzer_impl = getInternalDocumentAnalyzer(*analyzer);
+  if (!applyBatchEdits(analyzer_impl, changes_ranges, new_texts, change_count)) {
+    return nullptr;
+  }
+  SharedPtr<Document> document = analyzer_impl.getDocument();
+  if (document != nullptr && document->getLineCount() > 0) {
+    analyzer_impl.ensureAnalyzedThrough(document->getLineCount() - 1);
+  }
+  return newPackedDocumentHighlightBuffer(analyzer_impl);
+}
+
+int32_t* sl_document_analyze_incremental_batch_in_line_range(sl_analyzer_handle_t analyzer_handle,
+  int32_t* changes_ranges, const char** new_texts, int32_t change_count, int32_t* visible_range) {
+  SharedPtr<DocumentAnalyzer> analyzer = getCPtrHolderValue<sl_analyzer_handle_t, DocumentAnalyzer>(analyzer_handle);
+  if (analyzer == nullptr || visible_range == nullptr) {
+    return nullptr;
+  }
+  LineRange range = {static_cast<size_t>(visible_range[0]), static_cast<size_t>(visible_range[1])};
+  InternalDocumentAnalyzer& analyzer_impl = getInternalDocumentAnalyzer(*analyzer);
+  if (!applyBatchEdits(analyzer_impl, changes_ranges, new_texts, change_count)) {
+    return nullptr;
+  }
+  analyzer_impl.ensureAnalyzedInLineRange(range);
+  return newPackedDocumentHighlightSliceBuffer(analyzer_impl, range);
 }
 
 int32_t* sl_document_get_highlight_slice(sl_analyzer_handle_t analyzer_handle, int32_t* visible_range) {
@@ -263,12 +406,9 @@ int32_t* sl_document_get_highlight_slice(sl_analyzer_handle_t analyzer_handle, i
     return nullptr;
   }
   LineRange range = {static_cast<size_t>(visible_range[0]), static_cast<size_t>(visible_range[1])};
-  SharedPtr<DocumentHighlightSlice> slice = analyzer->getHighlightSlice(range);
-  const HighlightConfig& config = analyzer->getHighlightConfig();
-  size_t total_size = computeDocumentHighlightSliceBufferSize(slice, config);
-  int32_t* buffer = new int32_t[total_size];
-  writeDocumentHighlightSlice(slice, buffer, config);
-  return buffer;
+  InternalDocumentAnalyzer& analyzer_impl = getInternalDocumentAnalyzer(*analyzer);
+  analyzer_impl.materializeLineRange(range);
+  return newPackedDocumentHighlightSliceBuffer(analyzer_impl, range);
 }
 
 int32_t* sl_document_analyze_indent_guides(sl_analyzer_handle_t analyzer_handle) {
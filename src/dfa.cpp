@@ -0,0 +1,487 @@
+#include <algorithm>
+#include "internal_dfa.h"
+
+namespace NS_SWEETLINE {
+  namespace {
+    /// Programs above this size (both directions together) are left to Oniguruma, mostly large bounded repeats
+    constexpr size_t kMaxInstructionCount = 1 << 15;
+    /// The transition cache is flushed once it holds this many states
+    constexpr size_t kMaxStateCount = 2048;
+    /// Flushes tolerated before a LazyDfa gives up for good
+    constexpr size_t kMaxFlushCount = 16;
+
+    bool isWordByte(uint8_t byte) {
+      return (byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') || (byte >= '0' && byte <= '9') || byte == '_';
+    }
+  }
+
+  /// Builds a RegularProgram backwards: every node is compiled with the pc of its continuation already known
+  class RegularProgramBuilder {
+  public:
+    explicit RegularProgramBuilder(RegularProgram& program): m_program_(program) {
+    }
+
+    bool build(const List<const PatternTree*>& alternatives) {
+      if (alternatives.empty()) {
+        return false;
+      }
+      for (const PatternTree* tree : alternatives) {
+        if (tree->hasOpaque()) {
+          return false;
+        }
+      }
+      RegularInstruction match;
+      match.opcode = RegularOpcode::MATCH;
+      int32_t match_pc = addInstruction(match);
+      m_reverse_ = false;
+      if (!compileAlternatives(alternatives, match_pc, m_program_.m_start_pc_)) {
+        return false;
+      }
+      m_reverse_ = true;
+      if (!compileAlternatives(alternatives, match_pc, m_program_.m_reverse_start_pc_)) {
+        return false;
+      }
+      buildByteClasses();
+      return m_program_.m_instructions_.size() <= kMaxInstructionCount;
+    }
+  private:
+    RegularProgram& m_program_;
+    /// Whether nodes are compiled to read the text from right to left
+    bool m_reverse_ {false};
+
+    bool compileAlternatives(const List<const PatternTree*>& alternatives, int32_t match_pc, int32_t& entry) {
+      List<int32_t> entries;
+      for (const PatternTree* tree : alternatives) {
+        int32_t tree_entry = -1;
+        if (!compileNode(*tree, tree->root(), match_pc, tree_entry)) {
+          return false;
+        }
+        entries.push_back(tree_entry);
+      }
+      entry = addSplitChain(entries);
+      return true;
+    }
+
+    int32_t addInstruction(const RegularInstruction& instruction) {
+      m_program_.m_instructions_.push_back(instruction);
+      return static_cast<int32_t>(m_program_.m_instructions_.size() - 1);
+    }
+
+    int32_t addSplit(int32_t next, int32_t alt) {
+      RegularInstruction split;
+      split.opcode = RegularOpcode::SPLIT;
+      split.next = next;
+      split.alt = alt;
+      return addInstruction(split);
+    }
+
+    int32_t addSplitChain(const List<int32_t>& entries) {
+      int32_t entry = entries.back();
+      for (size_t i = entries.size() - 1; i > 0; --i) {
+        entry = addSplit(entries[i - 1], entry);
+      }
+      return entry;
+    }
+
+    int32_t addAssertion(RegularAssertion assertion, int32_t next) {
+      RegularInstruction instruction;
+      instruction.opcode = RegularOpcode::ASSERT;
+      instruction.assertion = assertion;
+      instruction.next = next;
+      return addInstruction(instruction);
+    }
+
+    bool compileNode(const PatternTree& tree, int32_t index, int32_t next, int32_t& entry) {
+      if (m_program_.m_instructions_.size() > kMaxInstructionCount) {
+        return false;
+      }
+      const PatternNode& node = tree.node(index);
+      switch (node.kind) {
+      case PatternNodeKind::EMPTY:
+        entry = next;
+        return true;
+      case PatternNodeKind::CHAR_SET: {
+        RegularInstruction instruction;
+        instruction.opcode = RegularOpcode::BYTE_SET;
+        instruction.next = next;
+        instruction.byte_set = static_cast<int32_t>(m_program_.m_byte_sets_.size());
+        // Non-ASCII members never matter, the DFA only runs over ASCII text
+        m_program_.m_byte_sets_.push_back(node.ascii);
+        entry = addInstruction(instruction);
+        return true;
+      }
+      case PatternNodeKind::CONCAT:
+        entry = next;
+        for (size_t i = 0; i < node.children.size(); ++i) {
+          // Backwards the last child is read first
+          size_t child = m_reverse_ ? i : node.children.size() - 1 - i;
+          if (!compileNode(tree, node.children[child], entry, entry)) {
+            return false;
+          }
+        }
+        return true;
+      case PatternNodeKind::ALTERNATION: {
+        List<int32_t> entries;
+        for (int32_t child : node.children) {
+          int32_t child_entry = -1;
+          if (!compileNode(tree, child, next, child_entry)) {
+            return false;
+          }
+          entries.push_back(child_entry);
+        }
+        entry = addSplitChain(entries);
+        return true;
+      }
+      case PatternNodeKind::REPEAT:
+        return compileRepeat(tree, node, next, entry);
+      case PatternNodeKind::GROUP:
+        if (node.atomic) {
+          return false;
+        }
+        return compileNode(tree, node.children[0], next, entry);
+      case PatternNodeKind::ASSERTION:
+        switch (node.assertion) {
+        // Backwards the text end is where reading starts, the text start where it ends
+        case PatternAssertion::LINE_START:
+        case PatternAssertion::STRING_START:
+          entry = addAssertion(m_reverse_ ? RegularAssertion::TEXT_END : RegularAssertion::TEXT_START, next);
+          return true;
+        case PatternAssertion::LINE_END:
+        case PatternAssertion::STRING_END:
+        case PatternAssertion::STRING_END_OR_NEWLINE:
+          entry = addAssertion(m_reverse_ ? RegularAssertion::TEXT_START : RegularAssertion::TEXT_END, next);
+          return true;
+        case PatternAssertion::WORD_BOUNDARY:
+          entry = addAssertion(RegularAssertion::WORD_BOUNDARY, next);
+          return true;
+        case PatternAssertion::NOT_WORD_BOUNDARY:
+          entry = addAssertion(RegularAssertion::NOT_WORD_BOUNDARY, next);
+          return true;
+        default:
+          // \G depends on where the search started
+          return false;
+        }
+      default:
+        // Lookaround and anything the parser could not model
+        return false;
+      }
+    }
+
+    bool compileRepeat(const PatternTree& tree, const PatternNode& node, int32_t next, int32_t& entry) {
+      // Possessive repeats give up matches a regular language would keep
+      if (node.possessive || (node.max >= 0 && node.max < node.min)) {
+        return false;
+      }
+      int32_t body = node.children[0];
+      int32_t tail = next;
+      if (node.max < 0) {
+        int32_t loop = addSplit(-1, next);
+        int32_t body_entry = -1;
+        if (!compileNode(tree, body, loop, body_entry)) {
+          return false;
+        }
+        m_program_.m_instructions_[loop].next = body_entry;
+        tail = loop;
+      } else {
+        for (int32_t i = node.min; i < node.max; ++i) {
+          int32_t body_entry = -1;
+          if (!compileNode(tree, body, tail, body_entry)) {
+            return false;
+          }
+          tail = addSplit(body_entry, next);
+        }
+      }
+      for (int32_t i = 0; i < node.min; ++i) {
+        if (!compileNode(tree, body, tail, tail)) {
+          return false;
+        }
+      }
+      entry = tail;
+      return true;
+    }
+
+    /// Group bytes that every byte set (and the word character test of \b) treats alike
+    void buildByteClasses() {
+      HashMap<U8String, int32_t> class_ids;
+      for (uint32_t byte = 0; byte < 128; ++byte) {
+        U8String signature;
+        signature.reserve(m_program_.m_byte_sets_.size() + 1);
+        signature.push_back(isWordByte(static_cast<uint8_t>(byte)) ? '1' : '0');
+        for (const AsciiSet& set : m_program_.m_byte_sets_) {
+          signature.push_back(set.test(byte) ? '1' : '0');
+        }
+        auto it = class_ids.find(signature);
+        if (it == class_ids.end()) {
+          int32_t class_id = static_cast<int32_t>(m_program_.m_class_bytes_.size());
+          it = class_ids.emplace(std::move(signature), class_id).first;
+          m_program_.m_class_bytes_.push_back(static_cast<uint8_t>(byte));
+        }
+        m_program_.m_byte_classes_[byte] = static_cast<uint8_t>(it->second);
+      }
+    }
+  };
+
+  // ===================================== RegularProgram ============================================
+  UniquePtr<RegularProgram> RegularProgram::compile(const List<const PatternTree*>& alternatives) {
+    UniquePtr<RegularProgram> program = makeUniquePtr<RegularProgram>();
+    RegularProgramBuilder builder(*program);
+    if (!builder.build(alternatives)) {
+      return nullptr;
+    }
+    return program;
+  }
+
+  int32_t RegularProgram::startPc() const {
+    return m_start_pc_;
+  }
+
+  int32_t RegularProgram::reverseStartPc() const {
+    return m_reverse_start_pc_;
+  }
+
+  const RegularInstruction& RegularProgram::instruction(int32_t pc) const {
+    return m_instructions_[static_cast<size_t>(pc)];
+  }
+
+  size_t RegularProgram::instructionCount() const {
+    return m_instructions_.size();
+  }
+
+  bool RegularProgram::byteSetContains(int32_t byte_set, uint8_t byte) const {
+    return byte < 128 && m_byte_sets_[static_cast<size_t>(byte_set)].test(byte);
+  }
+
+  int32_t RegularProgram::byteClassCount() const {
+    return static_cast<int32_t>(m_class_bytes_.size());
+  }
+
+  int32_t RegularProgram::byteClass(uint8_t byte) const {
+    return m_byte_classes_[byte & 0x7F];
+  }
+
+  uint8_t RegularProgram::classByte(int32_t byte_class) const {
+    return m_class_bytes_[static_cast<size_t>(byte_class)];
+  }
+
+  // ===================================== LazyDfa ============================================
+  LazyDfa::LazyDfa(const RegularProgram* program): m_program_(program) {
+    m_visit_marks_.resize(program->instructionCount(), 0);
+    m_forward_.forward = true;
+    m_forward_.start_pc = program->startPc();
+    m_backward_.forward = false;
+    m_backward_.start_pc = program->reverseStartPc();
+    reset(m_forward_);
+    reset(m_backward_);
+  }
+
+  LazyDfa::SearchStatus LazyDfa::findMatchStart(const char* text, size_t text_size, size_t from, size_t& match_start) {
+    bool found = false;
+    size_t match_end = 0;
+    while (findLeftmostMatchEnd(text, text_size, from, found, match_end) == PassStatus::FLUSHED) {
+      if (m_flush_count_ > kMaxFlushCount) {
+        return SearchStatus::GAVE_UP;
+      }
+    }
+    if (!found) {
+      return SearchStatus::NOT_FOUND;
+    }
+    while (findMatchStartBefore(text, text_size, from, match_end, found, match_start) == PassStatus::FLUSHED) {
+      if (m_flush_count_ > kMaxFlushCount) {
+        return SearchStatus::GAVE_UP;
+      }
+    }
+    // The forward pass saw a match end there, reading back has to reach its start
+    return found ? SearchStatus::FOUND : SearchStatus::GAVE_UP;
+  }
+
+  LazyDfa::PassStatus LazyDfa::findLeftmostMatchEnd(const char* text, size_t text_size, size_t from, bool& found,
+    size_t& match_end) {
+    found = false;
+    const int32_t end_class = m_program_->byteClassCount();
+    size_t context = from == 0 ? 0 : isWordByte(static_cast<uint8_t>(text[from - 1])) ? 2 : 1;
+    int32_t state = startState(m_forward_, context);
+    if (state == kUnknown) {
+      return PassStatus::FLUSHED;
+    }
+    for (size_t pos = from;; ++pos) {
+      int32_t input_class = pos < text_size ? m_program_->byteClass(static_cast<uint8_t>(text[pos])) : end_class;
+      int32_t next = transition(m_forward_, state, input_class);
+      if (next == kUnknown) {
+        return PassStatus::FLUSHED;
+      }
+      if ((next & 1) != 0) {
+        // Later matches only come from threads that started earlier, the last one seen starts leftmost
+        found = true;
+        match_end = pos;
+      }
+      state = next >> 1;
+      if (state == kDeadState || pos >= text_size) {
+        return PassStatus::DONE;
+      }
+    }
+  }
+
+  LazyDfa::PassStatus LazyDfa::findMatchStartBefore(const char* text, size_t text_size, size_t from, size_t end,
+    bool& found, size_t& match_start) {
+    found = false;
+    const int32_t end_class = m_program_->byteClassCount();
+    size_t context = end == text_size ? 0 : isWordByte(static_cast<uint8_t>(text[end])) ? 2 : 1;
+    int32_t state = startState(m_backward_, context);
+    if (state == kUnknown) {
+      return PassStatus::FLUSHED;
+    }
+    for (size_t pos = end;; --pos) {
+      int32_t input_class = pos > 0 ? m_program_->byteClass(static_cast<uint8_t>(text[pos - 1])) : end_class;
+      int32_t next = transition(m_backward_, state, input_class);
+      if (next == kUnknown) {
+        return PassStatus::FLUSHED;
+      }
+      if ((next & 1) != 0) {
+        found = true;
+        match_start = pos;
+      }
+      state = next >> 1;
+      if (state == kDeadState || pos <= from) {
+        return PassStatus::DONE;
+      }
+    }
+  }
+
+  void LazyDfa::reset(Automaton& automaton) {
+    automaton.transitions.clear();
+    automaton.states.clear();
+    automaton.state_index.clear();
+    automaton.start_states.fill(kUnknown);
+    // The dead state never matches and never leaves itself
+    automaton.states.push_back({});
+    automaton.transitions.resize(static_cast<size_t>(m_program_->byteClassCount()) + 1, kDeadState << 1);
+  }
+
+  int32_t LazyDfa::findOrAddState(Automaton& automaton, const List<int32_t>& pcs, bool after_word, bool at_start,
+    bool searching) {
+    if (pcs.empty() && !searching) {
+      return kDeadState;
+    }
+    U8String key(reinterpret_cast<const char*>(pcs.data()), pcs.size() * sizeof(int32_t));
+    key.push_back(static_cast<char>((after_word ? 1 : 0) | (at_start ? 2 : 0) | (searching ? 4 : 0)));
+    auto it = automaton.state_index.find(key);
+    if (it != automaton.state_index.end()) {
+      return it->second;
+    }
+    if (automaton.states.size() >= kMaxStateCount) {
+      ++m_flush_count_;
+      reset(automaton);
+      return kUnknown;
+    }
+    int32_t index = static_cast<int32_t>(automaton.states.size());
+    automaton.states.push_back({pcs, after_word, at_start, searching});
+    automaton.transitions.resize(automaton.transitions.size() + static_cast<size_t>(m_program_->byteClassCount()) + 1,
+      kUnknown);
+    automaton.state_index.emplace(std::move(key), index);
+    return index;
+  }
+
+  int32_t LazyDfa::startState(Automaton& automaton, size_t context) {
+    if (automaton.start_states[context] == kUnknown) {
+      // Forwards the start pc is not a thread yet, searching states add it at every position they read
+      List<int32_t> pcs;
+      if (!automaton.forward) {
+        pcs.push_back(automaton.start_pc);
+      }
+      automaton.start_states[context] = findOrAddState(automaton, pcs, context == 2, context == 0, automaton.forward);
+    }
+    return automaton.start_states[context];
+  }
+
+  int32_t LazyDfa::transition(Automaton& automaton, int32_t state_index, int32_t input_class) {
+    size_t stride = static_cast<size_t>(m_program_->byteClassCount()) + 1;
+    int32_t value = automaton.transitions[static_cast<size_t>(state_index) * stride + input_class];
+    return value != kUnknown ? value : computeTransition(automaton, state_index, input_class);
+  }
+
+  int32_t LazyDfa::computeTransition(Automaton& automaton, int32_t state_index, int32_t input_class) {
+    const State& state = automaton.states[static_cast<size_t>(state_index)];
+    const bool at_end = input_class == m_program_->byteClassCount();
+    const uint8_t byte = at_end ? 0 : m_program_->classByte(input_class);
+    const bool next_word = !at_end && isWordByte(byte);
+    const bool after_word = state.after_word;
+    const bool at_start = state.at_start;
+
+    if (++m_visit_generation_ == 0) {
+      std::fill(m_visit_marks_.begin(), m_visit_marks_.end(), 0);
+      m_visit_generation_ = 1;
+    }
+    bool matched = false;
+    m_next_pcs_.clear();
+    // Threads are expanded in order, so forwards the next pcs stay ordered by match start and a pc reached
+    // again belongs to a later start; a match drops the threads after it, none of them can start further left
+    const size_t thread_count = state.pcs.size() + (state.searching ? 1 : 0);
+    for (size_t thread = 0; thread < thread_count && !(matched && automaton.forward); ++thread) {
+      m_stack_.clear();
+      m_stack_.push_back(thread < state.pcs.size() ? state.pcs[thread] : automaton.start_pc);
+      while (!m_stack_.empty()) {
+        int32_t pc = m_stack_.back();
+        m_stack_.pop_back();
+        if (m_visit_marks_[pc] == m_visit_generation_) {
+          continue;
+        }
+        m_visit_marks_[pc] = m_visit_generation_;
+        const RegularInstruction& instruction = m_program_->instruction(pc);
+        switch (instruction.opcode) {
+        case RegularOpcode::BYTE_SET:
+          if (!at_end && m_program_->byteSetContains(instruction.byte_set, byte)) {
+            m_next_pcs_.push_back(instruction.next);
+          }
+          break;
+        case RegularOpcode::SPLIT:
+          m_stack_.push_back(instruction.alt);
+          m_stack_.push_back(instruction.next);
+          break;
+        case RegularOpcode::JUMP:
+          m_stack_.push_back(instruction.next);
+          break;
+        case RegularOpcode::ASSERT: {
+          bool holds = false;
+          switch (instruction.assertion) {
+          case RegularAssertion::TEXT_START:
+            holds = at_start;
+            break;
+          case RegularAssertion::TEXT_END:
+            holds = at_end;
+            break;
+          case RegularAssertion::WORD_BOUNDARY:
+            holds = after_word != next_word;
+            break;
+          case RegularAssertion::NOT_WORD_BOUNDARY:
+            holds = after_word == next_word;
+            break;
+          }
+          if (holds) {
+            m_stack_.push_back(instruction.next);
+          }
+          break;
+        }
+        case RegularOpcode::MATCH:
+          matched = true;
+          break;
+        }
+      }
+    }
+
+    int32_t next_state = kDeadState;
+    if (!at_end) {
+      if (!automaton.forward) {
+        std::sort(m_next_pcs_.begin(), m_next_pcs_.end());
+        m_next_pcs_.erase(std::unique(m_next_pcs_.begin(), m_next_pcs_.end()), m_next_pcs_.end());
+      }
+      next_state = findOrAddState(automaton, m_next_pcs_, next_word, false, state.searching && !matched);
+      if (next_state == kUnknown) {
+        return kUnknown;
+      }
+    }
+    int32_t transition = (next_state << 1) | (matched ? 1 : 0);
+    size_t stride = static_cast<size_t>(m_program_->byteClassCount()) + 1;
+    automaton.transitions[static_cast<size_t>(state_index) * stride + input_class] = transition;
+    return transition;
+  }
+}
@@ -41,6 +41,320 @@ namespace NS_SWEETLINE {
   }
 #endif
 
+  // ===================================== DocumentLineStore ============================================
+  size_t DocumentLineStore::size() const {
+    return m_line_count_;
+  }
+
+  bool DocumentLineStore::empty() const {
+    return m_line_count_ == 0;
+  }
+
+  const DocumentLine& DocumentLineStore::operator[](size_t line) const {
+    size_t offset = 0;
+    const size_t block_index = findBlock(line, offset);
+    return m_blocks_[block_index].lines[offset];
+  }
+
+  DocumentLine& DocumentLineStore::operator[](size_t line) {
+    size_t offset = 0;
+    const size_t block_index = findBlock(line, offset);
+    return m_blocks_[block_index].lines[offset];
+  }
+
+  void DocumentLineStore::clear() {
+    m_blocks_.clear();
+    m_block_line_tree_.clear();
+    m_block_char_tree_.clear();
+    m_line_count_ = 0;
+    m_char_count_ = 0;
+  }
+
+  void DocumentLineStore::assign(List<DocumentLine>&& lines) {
+    clear();
+    // Half-full blocks leave room for edits before the first split
+    constexpr size_t kBlockLines = kMaxBlockLines / 2;
+    m_blocks_.resize((lines.size() + kBlockLines - 1) / kBlockLines);
+    for (size_t i = 0; i < m_blocks_.size(); ++i) {
+      LineBlock& block = m_blocks_[i];
+      auto block_begin = lines.begin() + static_cast<ptrdiff_t>(i * kBlockLines);
+      auto block_end = lines.begin() + static_cast<ptrdiff_t>(std::min((i + 1) * kBlockLines, lines.size()));
+      block.lines.assign(std::make_move_iterator(block_begin), std::make_move_iterator(block_end));
+      block.char_counts.reserve(block.lines.size());
+      for (const DocumentLine& line : block.lines) {
+        block.char_counts.push_back(countLineChars(line));
+      }
+      rebuildCharStarts(block);
+    }
+    lines.clear();
+    rebuildBlockIndex();
+  }
+
+  void DocumentLineStore::insert(size_t line, List<DocumentLine>::const_iterator first,
+    List<DocumentLine>::const_iterator last) {
+    if (first == last) {
+      return;
+    }
+    if (line > m_line_count_) {
+      throw std::out_of_range("DocumentLineStore::insert(): Invalid line: " + std::to_string(line));
+    }
+    size_t block_index;
+    size_t offset;
+    bool blocks_changed = false;
+    if (m_blocks_.empty()) {
+      m_blocks_.emplace_back();
+      block_index = 0;
+      offset = 0;
+      blocks_changed = true;
+    } else if (line == m_line_count_) {
+      block_index = m_blocks_.size() - 1;
+      offset = m_blocks_.back().lines.size();
+    } else {
+      block_index = findBlock(line, offset);
+    }
+    LineBlock& block = m_blocks_[block_index];
+    const size_t old_char_count = block.char_count;
+    List<size_t> char_counts;
+    char_counts.reserve(static_cast<size_t>(last - first));
+    for (auto it = first; it != last; ++it) {
+      char_counts.push_back(countLineChars(*it));
+    }
+    block.lines.insert(block.lines.begin() + static_cast<ptrdiff_t>(offset), first, last);
+    block.char_counts.insert(block.char_counts.begin() + static_cast<ptrdiff_t>(offset),
+      char_counts.begin(), char_counts.end());
+    rebuildCharStarts(block);
+    const size_t char_delta = block.char_count - old_char_count;
+    if (splitBlock(block_index) || blocks_changed) {
+      rebuildBlockIndex();
+    } else {
+      updateBlockIndex(block_index, static_cast<size_t>(last - first), char_delta);
+    }
+  }
+
+  void DocumentLineStore::erase(size_t first, size_t last) {
+    if (first >= last) {
+      return;
+    }
+    if (last > m_line_count_) {
+      throw std::out_of_range("DocumentLineStore::erase(): Invalid line: " + std::to_string(last));
+    }
+    size_t offset = 0;
+    const size_t first_block = findBlock(first, offset);
+    size_t block_index = first_block;
+    size_t remaining = last - first;
+    bool blocks_changed = false;
+    // Blocks that kept some lines, at most the first and the last one touched, with their line and char deltas
+    struct BlockDelta {
+      size_t block_index;
+      size_t line_delta;
+      size_t char_delta;
+    };
+    List<BlockDelta> deltas;
+    while (remaining > 0) {
+      LineBlock& block = m_blocks_[block_index];
+      const size_t count = std::min(remaining, block.lines.size() - offset);
+      block.lines.erase(block.lines.begin() + static_cast<ptrdiff_t>(offset),
+        block.lines.begin() + static_cast<ptrdiff_t>(offset + count));
+      block.char_counts.erase(block.char_counts.begin() + static_cast<ptrdiff_t>(offset),
+        block.char_counts.begin() + static_cast<ptrdiff_t>(offset + count));
+      remaining -= count;
+      if (block.lines.empty()) {
+        m_blocks_.erase(m_blocks_.begin() + static_cast<ptrdiff_t>(block_index));
+        blocks_changed = true;
+      } else {
+        const size_t old_char_count = block.char_count;
+        rebuildCharStarts(block);
+        // Unsigned wrap-around keeps the sums exact, the deltas are negative
+        deltas.push_back({block_index, 0 - count, block.char_count - old_char_count});
+        ++block_index;
+      }
+      offset = 0;
+    }
+    // The first block may have lost its tail and the one before it may be short already
+    if (first_block < m_blocks_.size() && mergeBlock(first_block)) {
+      blocks_changed = true;
+    }
+    if (first_block > 0 && mergeBlock(first_block - 1)) {
+      blocks_changed = true;
+    }
+    if (blocks_changed) {
+      rebuildBlockIndex();
+      return;
+    }
+    for (const BlockDelta& delta : deltas) {
+      updateBlockIndex(delta.block_index, delta.line_delta, delta.char_delta);
+    }
+  }
+
+  void DocumentLineStore::recountLine(size_t line) {
+    size_t offset = 0;
+    const size_t block_index = findBlock(line, offset);
+    LineBlock& block = m_blocks_[block_index];
+    const size_t char_count = countLineChars(block.lines[offset]);
+    if (char_count == block.char_counts[offset]) {
+      return;
+    }
+    // Unsigned wrap-around keeps the sums exact when the line shrinks
+    const size_t delta = char_count - block.char_counts[offset];
+    block.char_counts[offset] = char_count;
+    for (size_t i = offset + 1; i < block.char_starts.size(); ++i) {
+      block.char_starts[i] += delta;
+    }
+    block.char_count += delta;
+    updateBlockIndex(block_index, 0, delta);
+  }
+
+  size_t DocumentLineStore::lineCharCount(size_t line) const {
+    size_t offset = 0;
+    const size_t block_index = findBlock(line, offset);
+    return m_blocks_[block_index].char_counts[offset];
+  }
+
+  size_t DocumentLineStore::charIndexOfLine(size_t line) const {
+    size_t offset = 0;
+    const size_t block_index = findBlock(line, offset);
+    return blockCharPrefix(block_index) + m_blocks_[block_index].char_starts[offset];
+  }
+
+  size_t DocumentLineStore::lineAtCharIndex(size_t char_index) const {
+    if (char_index >= m_char_count_) {
+      throw std::out_of_range("Index out of range");
+    }
+    size_t remaining = char_index;
+    const size_t block_index = descendTree(m_block_char_tree_, remaining);
+    const List<size_t>& char_starts = m_blocks_[block_index].char_starts;
+    auto it = std::upper_bound(char_starts.begin(), char_starts.end(), remaining);
+    return blockLinePrefix(block_index) + static_cast<size_t>(it - char_starts.begin()) - 1;
+  }
+
+  size_t DocumentLineStore::totalChars() const {
+    return m_char_count_;
+  }
+
+  size_t DocumentLineStore::findBlock(size_t line, size_t& offset) const {
+    if (line >= m_line_count_) {
+      throw std::out_of_range("Line number out of range");
+    }
+    offset = line;
+    return descendTree(m_block_line_tree_, offset);
+  }
+
+  bool DocumentLineStore::splitBlock(size_t block_index) {
+    LineBlock& block = m_blocks_[block_index];
+    if (block.lines.size() <= kMaxBlockLines) {
+      return false;
+    }
+    constexpr size_t kSplitLines = kMaxBlockLines / 2;
+    List<LineBlock> pieces((block.lines.size() - 1) / kSplitLines);
+    for (size_t i = 0; i < pieces.size(); ++i) {
+      const auto piece_begin = static_cast<ptrdiff_t>((i + 1) * kSplitLines);
+      const auto piece_end = static_cast<ptrdiff_t>(std::min((i + 2) * kSplitLines, block.lines.size()));
+      pieces[i].lines.assign(std::make_move_iterator(block.lines.begin() + piece_begin),
+        std::make_move_iterator(block.lines.begin() + piece_end));
+      pieces[i].char_counts.assign(block.char_counts.begin() + piece_begin, block.char_counts.begin() + piece_end);
+      rebuildCharStarts(pieces[i]);
+    }
+    block.lines.resize(kSplitLines);
+    block.char_counts.resize(kSplitLines);
+    rebuildCharStarts(block);
+    m_blocks_.insert(m_blocks_.begin() + static_cast<ptrdiff_t>(block_index + 1),
+      std::make_move_iterator(pieces.begin()), std::make_move_iterator(pieces.end()));
+    return true;
+  }
+
+  bool DocumentLineStore::mergeBlock(size_t block_index) {
+    if (block_index + 1 >= m_blocks_.size() || m_blocks_[block_index].lines.size() >= kMaxBlockLines / 4) {
+      return false;
+    }
+    LineBlock& block = m_blocks_[block_index];
+    LineBlock& next_block = m_blocks_[block_index + 1];
+    if (block.lines.size() + next_block.lines.size() > kMaxBlockLines) {
+      return false;
+    }
+    block.lines.insert(block.lines.end(), std::make_move_iterator(next_block.lines.begin()),
+      std::make_move_iterator(next_block.lines.end()));
+    block.char_counts.insert(block.char_counts.end(), next_block.char_counts.begin(), next_block.char_counts.end());
+    rebuildCharStarts(block);
+    m_blocks_.erase(m_blocks_.begin() + static_cast<ptrdiff_t>(block_index + 1));
+    return true;
+  }
+
+  void DocumentLineStore::rebuildBlockIndex() {
+    const size_t block_count = m_blocks_.size();
+    m_block_line_tree_.assign(block_count + 1, 0);
+    m_block_char_tree_.assign(block_count + 1, 0);
+    m_line_count_ = 0;
+    m_char_count_ = 0;
+    for (size_t i = 0; i < block_count; ++i) {
+      m_line_count_ += m_blocks_[i].lines.size();
+      m_char_count_ += m_blocks_[i].char_count;
+      // Linear Fenwick build: each node passes its sum on to its parent
+      const size_t node = i + 1;
+      m_block_line_tree_[node] += m_blocks_[i].lines.size();
+      m_block_char_tree_[node] += m_blocks_[i].char_count;
+      const size_t parent = node + (node & (~node + 1));
+      if (parent <= block_count) {
+        m_block_line_tree_[parent] += m_block_line_tree_[node];
+        m_block_char_tree_[parent] += m_block_char_tree_[node];
+      }
+    }
+  }
+
+  void DocumentLineStore::updateBlockIndex(size_t block_index, size_t line_delta, size_t char_delta) {
+    m_line_count_ += line_delta;
+    m_char_count_ += char_delta;
+    for (size_t node = block_index + 1; node < m_block_char_tree_.size(); node += node & (~node + 1)) {
+      m_block_line_tree_[node] += line_delta;
+      m_block_char_tree_[node] += char_delta;
+    }
+  }
+
+  size_t DocumentLineStore::blockLinePrefix(size_t block_index) const {
+    return treePrefix(m_block_line_tree_, block_index);
+  }
+
+  size_t DocumentLineStore::blockCharPrefix(size_t block_index) const {
+    return treePrefix(m_block_char_tree_, block_index);
+  }
+
+  size_t DocumentLineStore::descendTree(const List<size_t>& tree, size_t& value) {
+    size_t block_index = 0;
+    size_t step = 1;
+    while (step * 2 < tree.size()) {
+      step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+      const size_t node = block_index + step;
+      if (node < tree.size() && tree[node] <= value) {
+        block_index = node;
+        value -= tree[node];
+      }
+    }
+    return block_index;
+  }
+
+  size_t DocumentLineStore::treePrefix(const List<size_t>& tree, size_t block_index) {
+    size_t sum = 0;
+    for (size_t node = block_index; node > 0; node -= node & (~node + 1)) {
+      sum += tree[node];
+    }
+    return sum;
+  }
+
+  void DocumentLineStore::rebuildCharStarts(LineBlock& block) {
+    block.char_starts.resize(block.char_counts.size());
+    size_t char_count = 0;
+    for (size_t i = 0; i < block.char_counts.size(); ++i) {
+      block.char_starts[i] = char_count;
+      char_count += block.char_counts[i];
+    }
+    block.char_count = char_count;
+  }
+
+  size_t DocumentLineStore::countLineChars(const DocumentLine& line) {
+    return Utf8Util::countChars(line.text) + Document::getLineEndingWidth(line.ending);
+  }
+
   // ===================================== Document ============================================
   Document::Document(const U8String& uri, const U8String& initial_text): m_uri_(uri) {
     setText(initial_text);
@@ -51,8 +365,9 @@ namespace NS_SWEETLINE {
   }
 
   void Document::setText(const U8String& text) {
-    splitTextIntoLines(text, m_lines_);
-    rebuildLineMetrics();
+    List<DocumentLine> lines;
+    splitTextIntoLines(text, lines);
+    m_lines_.assign(std::move(lines));
   }
 
   U8String Document::getUri() const {
@@ -60,26 +375,28 @@ namespace NS_SWEETLINE {
   }
 
   U8String Document::getText() const {
+    size_t byte_count = 0;
+    m_lines_.forEachLine(0, [&byte_count](const DocumentLine& line) {
+      byte_count += line.text.size() + getLineEndingWidth(line.ending);
+    });
     U8String result;
-    for (const DocumentLine& line : m_lines_) {
+    result.reserve(byte_count);
+    m_lines_.forEachLine(0, [&result](const DocumentLine& line) {
       result += line.text;
       appendLineEnding(result, line.ending);
-    }
+    });
     return result;
   }
 
   size_t Document::totalChars() const {
-    if (m_lines_.empty()) {
-      return 0;
-    }
-    return m_line_start_indices_.back() + m_line_total_widths_.back();
+    return m_lines_.totalChars();
   }
 
   size_t Document::getLineCharCount(size_t line) const {
     if (line >= m_lines_.size()) {
       throw std::out_of_range("getLineCharCount(): Invalid line: " + std::to_string(line));
     }
-    return m_line_total_widths_[line];
+    return m_lines_.lineCharCount(line);
   }
 
   size_t Document::getLineCount() const {
@@ -121,12 +438,53 @@ namespace NS_SWEETLINE {
       // Multi-line patch
       result = patchMultipleLines(range, new_lines);
     }
-    rebuildLineMetricsFrom(range.start.line);
     result.line_delta = static_cast<int32_t>(m_lines_.size()) - static_cast<int32_t>(old_line_count);
     result.char_delta = static_cast<int32_t>(totalChars()) - static_cast<int32_t>(old_total_chars);
     return result;
   }
 
+  PatchResult Document::applyPatches(const List<TextEdit>& edits) {
+    const List<TextEdit> sorted_edits = normalizeEdits(edits);
+    // From the last edit to the first, so the ranges of the edits still to apply are not moved
+    PatchResult result;
+    for (auto it = sorted_edits.rbegin(); it != sorted_edits.rend(); ++it) {
+      PatchResult edit_result = patch(it->range, it->new_text);
+      result.line_delta += edit_result.line_delta;
+      result.char_delta += edit_result.char_delta;
+    }
+    return result;
+  }
+
+  List<TextEdit> Document::normalizeEdits(const List<TextEdit>& edits) const {
+    List<TextEdit> sorted_edits = edits;
+    // patch() appends text after the last line, give such positions a place in the order
+    const size_t last_line = m_lines_.empty() ? 0 : m_lines_.size() - 1;
+    const TextPosition text_end = {last_line, m_lines_.empty() ? 0 : Utf8Util::countChars(m_lines_[last_line].text), 0};
+    for (TextEdit& edit : sorted_edits) {
+      if (edit.range.start.line > last_line) {
+        edit.range.start = text_end;
+      }
+      if (edit.range.end.line > last_line) {
+        edit.range.end = text_end;
+      }
+    }
+    std::stable_sort(sorted_edits.begin(), sorted_edits.end(), [](const TextEdit& left, const TextEdit& right) {
+      if (left.range.start == right.range.start) {
+        return left.range.end < right.range.end;
+      }
+      return left.range.start < right.range.start;
+    });
+    for (size_t i = 0; i < sorted_edits.size(); ++i) {
+      if (sorted_edits[i].range.end < sorted_edits[i].range.start) {
+        throw std::invalid_argument("applyPatches(): Edit range ends before it starts");
+      }
+      if (i > 0 && sorted_edits[i].range.start < sorted_edits[i - 1].range.end) {
+        throw std::invalid_argument("applyPatches(): Edit ranges overlap");
+      }
+    }
+    return sorted_edits;
+  }
+
   PatchResult Document::appendText(const U8String& text) {
     const size_t old_total_chars = totalChars();
     const size_t old_line_count = m_lines_.size();
@@ -136,19 +494,15 @@ namespace NS_SWEETLINE {
       return {};
     }
 
-    size_t rebuild_from_line = 0;
     if (m_lines_.empty()) {
-      m_lines_ = std::move(new_lines);
-      rebuildLineMetrics();
+      m_lines_.assign(std::move(new_lines));
     } else {
-      rebuild_from_line = m_lines_.size() - 1;
-      const LineEnding appended_ending = new_lines[0].ending;
-      m_lines_.back().text += new_lines.empty() ? "" : new_lines[0].text;
-      m_lines_.back().ending = appended_ending;
-      for (size_t i = 1; i < new_lines.size(); ++i) {
-        m_lines_.push_back(new_lines[i]);
-      }
-      rebuildLineMetricsFrom(rebuild_from_line);
+      const size_t last_line = m_lines_.size() - 1;
+      DocumentLine& line = m_lines_[last_line];
+      line.text += new_lines[0].text;
+      line.ending = new_lines[0].ending;
+      m_lines_.recountLine(last_line);
+      m_lines_.insert(m_lines_.size(), new_lines.begin() + 1, new_lines.end());
     }
     PatchResult result;
     result.line_delta = static_cast<int32_t>(m_lines_.size()) - static_cast<int32_t>(old_line_count);
@@ -171,34 +525,15 @@ namespace NS_SWEETLINE {
     if (line >= m_lines_.size()) {
       throw std::out_of_range("charIndexOfLine(): Invalid line: " + std::to_string(line));
     }
-    return m_line_start_indices_[line];
+    return m_lines_.charIndexOfLine(line);
   }
 
   TextPosition Document::charIndexToPosition(size_t char_index) const {
-    if (m_lines_.empty()) {
+    if (char_index >= totalChars()) {
       throw std::out_of_range("Index out of range");
     }
-
-    const size_t total_chars = totalChars();
-    if (char_index >= total_chars) {
-      throw std::out_of_range("Index out of range");
-    }
-
-    auto it = std::upper_bound(m_line_start_indices_.begin(), m_line_start_indices_.end(), char_index);
-    size_t line = it == m_line_start_indices_.begin()
-      ? 0
-      : static_cast<size_t>(std::distance(m_line_start_indices_.begin(), it) - 1);
-    if (line >= m_lines_.size()) {
-      line = m_lines_.size() - 1;
-    }
-
-    const size_t line_start_index = m_line_start_indices_[line];
-    const size_t line_total_width = m_line_total_widths_[line];
-    if (char_index < line_start_index + line_total_width) {
-      return {line, char_index - line_start_index, char_index};
-    }
-
-    throw std::out_of_range("Index out of range");
+    const size_t line = m_lines_.lineAtCharIndex(char_index);
+    return {line, char_index - m_lines_.charIndexOfLine(line), char_index};
   }
 
   bool Document::isValidPosition(const TextPosition& pos) const {
@@ -212,7 +547,7 @@ namespace NS_SWEETLINE {
     if (!isValidPosition(pos)) {
       throw std::out_of_range("Invalid text position");
     }
-    return m_line_start_indices_[pos.line] + pos.column;
+    return m_lines_.charIndexOfLine(pos.line) + pos.column;
   }
 
   void Document::splitTextIntoLines(const U8String& text, List<DocumentLine>& result) {
@@ -245,41 +580,6 @@ namespace NS_SWEETLINE {
     }
   }
 
-  void Document::rebuildLineMetrics() {
-    m_line_total_widths_.resize(m_lines_.size());
-    m_line_start_indices_.resize(m_lines_.size());
-    if (m_lines_.empty()) {
-      return;
-    }
-    rebuildLineMetricsFrom(0);
-  }
-
-  void Document::rebuildLineMetricsFrom(size_t start_line) {
-    const size_t line_count = m_lines_.size();
-    m_line_total_widths_.resize(line_count);
-    m_line_start_indices_.resize(line_count);
-    if (line_count == 0 || start_line >= line_count) {
-      return;
-    }
-
-    for (size_t line = start_line; line < line_count; ++line) {
-      m_line_total_widths_[line] = getLineTotalWidth(m_lines_[line]);
-    }
-
-    if (start_line == 0) {
-      m_line_start_indices_[0] = 0;
-      start_line = 1;
-    }
-
-    for (size_t line = start_line; line < line_count; ++line) {
-      m_line_start_indices_[line] = m_line_start_indices_[line - 1] + m_line_total_widths_[line - 1];
-    }
-  }
-
-  size_t Document::getLineTotalWidth(const DocumentLine& line) {
-    return Utf8Util::countChars(line.text) + getLineEndingWidth(line.ending);
-  }
-
   PatchResult Document::patchSingleLine(const TextRange& range, const List<DocumentLine>& new_lines) {
     DocumentLine& line = m_lines_[range.start.line];
     const LineEnding original_ending = line.ending;
@@ -290,23 +590,25 @@ namespace NS_SWEETLINE {
     // If patch text is empty, replace range with "", i.e. delete text in range
     if (new_lines.empty()) {
       line.text = line.text.substr(0, start_byte) + line.text.substr(end_byte);
+      m_lines_.recountLine(range.start.line);
       return {};
     }
 
     if (new_lines.size() == 1) {
       line.text = line.text.substr(0, start_byte) + new_lines[0].text + line.text.substr(end_byte);
       line.ending = original_ending;
+      m_lines_.recountLine(range.start.line);
       return {};
     } else {
       U8String rest_of_line = line.text.substr(end_byte);
       line.text = line.text.substr(0, start_byte) + new_lines[0].text;
       line.ending = new_lines[0].ending;
-      for (size_t i = 1; i < new_lines.size(); ++i) {
-        m_lines_.insert(m_lines_.begin() + range.start.line + i, new_lines[i]);
-      }
+      m_lines_.insert(range.start.line + 1, new_lines.begin() + 1, new_lines.end());
       size_t last_line_index = range.start.line + new_lines.size() - 1;
       m_lines_[last_line_index].text += rest_of_line;
       m_lines_[last_line_index].ending = original_ending;
+      m_lines_.recountLine(range.start.line);
+      m_lines_.recountLine(last_line_index);
       PatchResult result;
       result.line_delta = static_cast<int32_t>(new_lines.size()) - 1;
       return result;
@@ -330,9 +632,8 @@ namespace NS_SWEETLINE {
       first_line.ending = ending_of_last_line;
       size_t start_delete = start_line + 1;
       size_t end_delete = end_line + 1;
-      if (start_delete < end_delete) {
-        m_lines_.erase(m_lines_.begin() + start_delete, m_lines_.begin() + end_delete);
-      }
+      m_lines_.erase(start_delete, end_delete);
+      m_lines_.recountLine(start_line);
       PatchResult result;
       result.line_delta = -static_cast<int32_t>(end_line - start_line);
       return result;
@@ -343,17 +644,14 @@ namespace NS_SWEETLINE {
 
     size_t delete_start = start_line + 1;
     size_t delete_end = end_line + 1;
-    if (delete_start < delete_end) {
-      m_lines_.erase(m_lines_.begin() + delete_start, m_lines_.begin() + delete_end);
-    }
-
-    for (size_t i = 1; i < new_lines.size(); ++i) {
-      m_lines_.insert(m_lines_.begin() + start_line + i, new_lines[i]);
-    }
+    m_lines_.erase(delete_start, delete_end);
+    m_lines_.insert(start_line + 1, new_lines.begin() + 1, new_lines.end());
 
     size_t last_new_line_index = start_line + new_lines.size() - 1;
     m_lines_[last_new_line_index].text += rest_of_last_line;
     m_lines_[last_new_line_index].ending = ending_of_last_line;
+    m_lines_.recountLine(start_line);
+    m_lines_.recountLine(last_new_line_index);
     PatchResult result;
     result.line_delta = static_cast<int32_t>(new_lines.size() - (end_line - start_line));
     return result;
@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <nlohmann/json.hpp>
 #include "internal_highlight.h"
 #include "sweetline/util.h"
@@ -27,6 +29,11 @@ namespace NS_SWEETLINE {
       size_t pattern_length {0};
     };
 
+    /// Capacity of a string whose text is stored inline, without a heap buffer
+    const size_t kInlineTextCapacity = U8String().capacity();
+    /// Largest span text buffer kept for reuse
+    constexpr size_t kMaxSpareTextCapacity = 4096;
+
     bool isAsciiWordChar(char ch) {
       return (ch >= 'a' && ch <= 'z')
         || (ch >= 'A' && ch <= 'Z')
@@ -115,6 +122,46 @@ namespace NS_SWEETLINE {
       return result;
     }
 
+    /// Count characters in a byte range, ASCII text maps bytes to chars one to one
+    size_t countCharsInRange(const char* begin, const char* end, bool ascii_text) {
+      if (ascii_text) {
+        return static_cast<size_t>(end - begin);
+      }
+      return Utf8Util::countChars(begin, end);
+    }
+
+    /// Step over one character
+    const char* advanceOneChar(const char* it, const char* end, bool ascii_text) {
+      if (ascii_text) {
+        return it + 1;
+      }
+      return Utf8Util::advanceChars(it, end, 1);
+    }
+
+    /// Find the first byte at or after start that is in the set, or end if there is none
+    size_t findFirstByteOf(const char* text, size_t start, size_t end, const ByteSet& bytes) {
+      for (size_t pos = start; pos < end; ++pos) {
+        if (bytes.test(static_cast<unsigned char>(text[pos]))) {
+          return pos;
+        }
+      }
+      return end;
+    }
+
+    /// Index of the token rule whose alternative of the merged pattern matched, -1 if there is none.
+    /// Whole-token groups of the alternatives that were not taken are always unset, only nested groups
+    /// of a failed alternative may keep stale positions, so scanning the whole-token groups is enough
+    int32_t findRegexMatchedRule(const StateRule& state_rule, const OnigRegion* region) {
+      const int* group_begins = region->beg;
+      size_t alternative_count = state_rule.alternative_groups.size();
+      for (size_t alternative = 0; alternative < alternative_count; ++alternative) {
+        if (group_begins[state_rule.alternative_groups[alternative]] != ONIG_REGION_NOTPOS) {
+          return state_rule.alternative_rules[alternative];
+        }
+      }
+      return -1;
+    }
+
     bool isBetterRuleNameMatch(const SharedPtr<SyntaxRule>& candidate, const SharedPtr<SyntaxRule>& current) {
       return current == nullptr || candidate->name < current->name;
     }
@@ -256,6 +303,45 @@ namespace NS_SWEETLINE {
       }
       return slice;
     }
+
+    /// Apply sorted, disjoint line replacements to a per-line table in one pass, a replaced range keeps its
+    /// first entries and gets filler entries for the extra new lines
+    template<typename T>
+    void replaceLineEntries(List<T>& entries, const List<LineReplacement>& replacements, const T& filler) {
+      size_t new_size = entries.size();
+      for (const LineReplacement& replacement : replacements) {
+        new_size = new_size + replacement.new_count - replacement.old_count;
+      }
+      List<T> result;
+      result.reserve(new_size);
+      size_t copied_end = 0;
+      for (const LineReplacement& replacement : replacements) {
+        const size_t kept_count = std::min(replacement.old_count, replacement.new_count);
+        result.insert(result.end(), std::make_move_iterator(entries.begin() + static_cast<ptrdiff_t>(copied_end)),
+          std::make_move_iterator(entries.begin() + static_cast<ptrdiff_t>(replacement.old_start + kept_count)));
+        result.insert(result.end(), replacement.new_count - kept_count, filler);
+        copied_end = replacement.old_start + replacement.old_count;
+      }
+      result.insert(result.end(), std::make_move_iterator(entries.begin() + static_cast<ptrdiff_t>(copied_end)),
+        std::make_move_iterator(entries.end()));
+      entries = std::move(result);
+    }
+
+    /// Line breaks of a text the way Document splits it: \n, \r\n and \r
+    size_t countLineBreaks(const U8String& text) {
+      size_t count = 0;
+      for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\n') {
+          ++count;
+        } else if (text[i] == '\r') {
+          ++count;
+          if (i + 1 < text.size() && text[i + 1] == '\n') {
+            ++i;
+          }
+        }
+      }
+      return count;
+    }
   }
 
   // ===================================== TokenSpan ============================================
@@ -373,8 +459,13 @@ namespace NS_SWEETLINE {
 
   // ===================================== TextAnalyzer ============================================
   TextAnalyzer::TextAnalyzer(const SharedPtr<SyntaxRule>& rule, const HighlightConfig& config)
+    : TextAnalyzer(rule, config, nullptr, nullptr) {
+  }
+
+  TextAnalyzer::TextAnalyzer(const SharedPtr<SyntaxRule>& rule, const HighlightConfig& config,
+    const SharedPtr<LineAnalyzeCache>& line_cache, const SharedPtr<AnalyzeBudgetCounters>& budget_counters)
     : m_rule_(rule), m_config_(config) {
-    m_line_highlight_analyzer_ = makeUniquePtr<LineHighlightAnalyzer>(rule, config);
+    m_line_highlight_analyzer_ = makeUniquePtr<LineHighlightAnalyzer>(rule, config, line_cache, budget_counters);
   }
 
   SharedPtr<DocumentHighlight> TextAnalyzer::analyzeText(const U8String& text) {
@@ -400,6 +491,11 @@ namespace NS_SWEETLINE {
     m_line_highlight_analyzer_->analyzeLine(text, line_info, result);
   }
 
+  void TextAnalyzer::analyzeLine(const char* text, size_t length, const TextLineInfo& line_info,
+    LineAnalyzeResult& result) const {
+    m_line_highlight_analyzer_->analyzeLine(U8StringView(text, length), line_info, result);
+  }
+
   const HighlightConfig& TextAnalyzer::getHighlightConfig() const {
     return m_line_highlight_analyzer_->getHighlightConfig();
   }
@@ -416,26 +512,328 @@ namespace NS_SWEETLINE {
     return analyzer.analyzeLineRange({0, temp_doc == nullptr ? 0 : temp_doc->getLineCount()});
   }
 
+  // ===================================== MatchResult ============================================
+  void MatchResult::reset() {
+    matched = false;
+    start = 0;
+    length = 0;
+    start_byte = 0;
+    end_byte = 0;
+    state = -1;
+    token_rule_idx = -1;
+    matched_group = -1;
+    style = 0;
+    goto_state = -1;
+    matched_text.clear();
+    capture_groups.clear();
+  }
+
+  // ===================================== MatchScratchFrame ============================================
+  MatchScratchFrame::MatchScratchFrame(size_t depth, int32_t group_count): depth(depth) {
+    region = onig_region_new();
+    // Size the region for the widest state up front, so searches never have to grow it
+    onig_region_resize(region, group_count + 1);
+  }
+
+  MatchScratchFrame::~MatchScratchFrame() {
+    if (region != nullptr) {
+      onig_region_free(region, 1);
+    }
+  }
+
+  // ===================================== LineAnalyzeCache ============================================
+  LineAnalyzeCache::LineAnalyzeCache(size_t capacity): m_capacity_(capacity) {
+  }
+
+  bool LineAnalyzeCache::lookup(U8StringView text, const TextLineInfo& info, LineAnalyzeResult& result) {
+    size_t hash = hashKey(text, info.start_state);
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    EntryList::iterator it = find(hash, text, info.start_state);
+    if (it == m_entries_.end()) {
+      ++m_misses_;
+      return false;
+    }
+    ++m_hits_;
+    m_entries_.splice(m_entries_.begin(), m_entries_, it);
+    result.highlight = it->highlight;
+    for (TokenSpan& span : result.highlight.spans) {
+      span.range.start.line = info.line;
+      span.range.start.index += info.start_char_offset;
+      span.range.end.line = info.line;
+      span.range.end.index += info.start_char_offset;
+    }
+    result.end_state = it->end_state;
+    result.char_count = it->char_count;
+    return true;
+  }
+
+  void LineAnalyzeCache::store(U8StringView text, const TextLineInfo& info, const LineAnalyzeResult& result) {
+    if (m_capacity_ == 0) {
+      return;
+    }
+    Entry entry;
+    entry.hash = hashKey(text, info.start_state);
+    entry.text.assign(text.data(), text.size());
+    entry.start_state = info.start_state;
+    entry.highlight = result.highlight;
+    for (TokenSpan& span : entry.highlight.spans) {
+      span.range.start.line = 0;
+      span.range.start.index -= info.start_char_offset;
+      span.range.end.line = 0;
+      span.range.end.index -= info.start_char_offset;
+    }
+    entry.end_state = result.end_state;
+    entry.char_count = result.char_count;
+
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    // Another analyzer may have stored the same line since the lookup missed
+    if (find(entry.hash, text, info.start_state) != m_entries_.end()) {
+      return;
+    }
+    if (m_entries_.size() >= m_capacity_) {
+      EntryList::iterator oldest = std::prev(m_entries_.end());
+      auto range = m_index_.equal_range(oldest->hash);
+      for (auto index_it = range.first; index_it != range.second; ++index_it) {
+        if (index_it->second == oldest) {
+          m_index_.erase(index_it);
+          break;
+        }
+      }
+      m_entries_.erase(oldest);
+    }
+    m_entries_.push_front(std::move(entry));
+    m_index_.emplace(m_entries_.front().hash, m_entries_.begin());
+  }
+
+  void LineAnalyzeCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    m_entries_.clear();
+    m_index_.clear();
+    m_hits_ = 0;
+    m_misses_ = 0;
+  }
+
+  LineCacheStats LineAnalyzeCache::getStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex_);
+    LineCacheStats stats;
+    stats.hits = m_hits_;
+    stats.misses = m_misses_;
+    stats.size = m_entries_.size();
+    stats.capacity = m_capacity_;
+    return stats;
+  }
+
+  size_t LineAnalyzeCache::hashKey(U8StringView text, int32_t start_state) {
+    size_t hash = std::hash<U8StringView>{}(text);
+    return hash ^ (std::hash<int32_t>{}(start_state) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+  }
+
+  LineAnalyzeCache::EntryList::iterator LineAnalyzeCache::find(size_t hash, U8StringView text, int32_t start_state) {
+    auto range = m_index_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const Entry& entry = *it->second;
+      if (entry.start_state == start_state && entry.text == text) {
+        return it->second;
+      }
+    }
+    return m_entries_.end();
+  }
+
   // ===================================== LineHighlightAnalyzer ============================================
-  LineHighlightAnalyzer::LineHighlightAnalyzer(const SharedPtr<SyntaxRule>& syntax_rule, const HighlightConfig& config)
-    : m_rule_(syntax_rule), m_config_(config) {
+  LineHighlightAnalyzer::LineHighlightAnalyzer(const SharedPtr<SyntaxRule>& syntax_rule, const HighlightConfig& config,
+    const SharedPtr<LineAnalyzeCache>& line_cache, const SharedPtr<AnalyzeBudgetCounters>& budget_counters)
+    : m_rule_(syntax_rule), m_config_(config), m_line_cache_(line_cache), m_budget_counters_(budget_counters) {
+    if (m_rule_ != nullptr) {
+      for (const auto& [_, state_rule] : m_rule_->state_rules_map) {
+        m_max_group_count_ = std::max(m_max_group_count_, state_rule.group_count);
+      }
+    }
+    if (m_config_.regex_retry_limit > 0 || m_config_.regex_stack_limit > 0) {
+      m_match_param_ = onig_new_match_param();
+      onig_initialize_match_param(m_match_param_);
+      if (m_config_.regex_retry_limit > 0) {
+        // Bound both a single match attempt and the whole search over every start position
+        onig_set_retry_limit_in_match_of_match_param(m_match_param_, m_config_.regex_retry_limit);
+        onig_set_retry_limit_in_search_of_match_param(m_match_param_, m_config_.regex_retry_limit);
+      }
+      if (m_config_.regex_stack_limit > 0) {
+        onig_set_match_stack_limit_size_of_match_param(m_match_param_, m_config_.regex_stack_limit);
+      }
+    }
   }
 
-  void LineHighlightAnalyzer::analyzeLine(const U8String& text, const TextLineInfo& info, LineAnalyzeResult& result) const {
+  LineHighlightAnalyzer::~LineHighlightAnalyzer() {
+    if (m_match_param_ != nullptr) {
+      onig_free_match_param(m_match_param_);
+    }
+  }
+
+  MatchScratchFrame& LineHighlightAnalyzer::getMatchFrame(size_t depth) const {
+    while (m_match_frames_.size() <= depth) {
+      m_match_frames_.push_back(makeUniquePtr<MatchScratchFrame>(m_match_frames_.size(), m_max_group_count_));
+    }
+    return *m_match_frames_[depth];
+  }
+
+  void LineHighlightAnalyzer::analyzeLine(U8StringView text, const TextLineInfo& info, LineAnalyzeResult& result) const {
+    result.truncated = false;
     if (text.empty()) {
+      recycleSpans(result.highlight);
       result.end_state = info.start_state;
       result.char_count = 0;
       return;
     }
+    if (m_line_cache_ == nullptr) {
+      recycleSpans(result.highlight);
+      analyzeLineText(text, info, result);
+      return;
+    }
+    // A cache hit copies over the old spans in place
+    if (m_line_cache_->lookup(text, info, result)) {
+      return;
+    }
+    recycleSpans(result.highlight);
+    analyzeLineText(text, info, result);
+    // A truncated result depends on timing and limits, not only on the line
+    if (!result.truncated) {
+      m_line_cache_->store(text, info, result);
+    }
+  }
 
-    size_t current_char_pos = 0;
-    int32_t current_state = info.start_state;
-    size_t line_char_count = Utf8Util::countChars(text);
+  void LineHighlightAnalyzer::analyzeLineState(U8StringView text, const TextLineInfo& info,
+    LineAnalyzeResult& result) const {
+    result.truncated = false;
+    recycleSpans(result.highlight);
+    if (text.empty()) {
+      result.end_state = info.start_state;
+      result.char_count = 0;
+      return;
+    }
+    if (m_line_cache_ != nullptr && m_line_cache_->lookup(text, info, result)) {
+      recycleSpans(result.highlight);
+      return;
+    }
+    // Results without spans are never cached, the cache would hand them out to full analyses
+    MatchScratchFrame& frame = getMatchFrame(0);
+    frame.ascii_text = Utf8Util::isAscii(text.data(), text.size());
+    frame.single_line_ascii = frame.ascii_text && text.find('\n') == U8StringView::npos;
+    LineCheckpoint cursor;
+    cursor.state = info.start_state;
+    runTokenLoop(text, info, cursor, kLineEnd, kLineEnd, nullptr, result);
+    finishLine(cursor, result);
+  }
+
+  void LineHighlightAnalyzer::analyzeLineText(U8StringView text, const TextLineInfo& info,
+    LineAnalyzeResult& result) const {
+    MatchScratchFrame& frame = getMatchFrame(0);
+    frame.ascii_text = Utf8Util::isAscii(text.data(), text.size());
+    frame.single_line_ascii = frame.ascii_text && text.find('\n') == U8StringView::npos;
+    LineCheckpoint cursor;
+    cursor.state = info.start_state;
+    runTokenLoop(text, info, cursor, 0, kLineEnd, nullptr, result);
+    finishLine(cursor, result);
+  }
+
+  bool LineHighlightAnalyzer::analyzeLineWindow(U8StringView text, const TextLineInfo& info, size_t start_column,
+    size_t end_column, LongLineCheckpoints& checkpoints, LineAnalyzeResult& result) const {
+    result.truncated = false;
+    if (checkpoints.checkpoints.empty() || checkpoints.start_state != info.start_state) {
+      checkpoints = LongLineCheckpoints();
+      checkpoints.start_state = info.start_state;
+      checkpoints.ascii_text = Utf8Util::isAscii(text.data(), text.size());
+      checkpoints.single_line_ascii = checkpoints.ascii_text && text.find('\n') == U8StringView::npos;
+      checkpoints.checkpoints.push_back({0, 0, info.start_state});
+    }
+    if (checkpoints.complete && start_column >= checkpoints.char_count) {
+      // Nothing left to show, and the line end is already known
+      result.end_state = checkpoints.end_state;
+      result.char_count = checkpoints.char_count;
+      return true;
+    }
+    // Resume from the last checkpoint at or before the first requested column
+    auto it = std::upper_bound(checkpoints.checkpoints.begin(), checkpoints.checkpoints.end(), start_column,
+      [](size_t column, const LineCheckpoint& checkpoint) {
+        return column < checkpoint.char_pos;
+      });
+    LineCheckpoint cursor = *(it - 1);
+    MatchScratchFrame& frame = getMatchFrame(0);
+    frame.ascii_text = checkpoints.ascii_text;
+    frame.single_line_ascii = checkpoints.single_line_ascii;
+    if (!runTokenLoop(text, info, cursor, start_column, end_column, &checkpoints, result)) {
+      return false;
+    }
+    finishLine(cursor, result);
+    // A truncated run depends on timing and limits, a later run may still get further
+    if (!result.truncated) {
+      checkpoints.complete = true;
+      checkpoints.end_state = result.end_state;
+      checkpoints.char_count = result.char_count;
+    }
+    return true;
+  }
+
+  bool LineHighlightAnalyzer::runTokenLoop(U8StringView text, const TextLineInfo& info, LineCheckpoint& cursor,
+    size_t emit_start, size_t stop_column, LongLineCheckpoints* checkpoints, LineAnalyzeResult& result) const {
+    // The cursor is tracked both in bytes (for Oniguruma) and in characters (for spans),
+    // so character positions are only ever counted over the bytes the cursor moves across
+    const char* text_begin = text.data();
+    const char* text_end = text_begin + text.size();
+    size_t current_byte_pos = cursor.byte_pos;
+    size_t current_char_pos = cursor.char_pos;
+    int32_t current_state = cursor.state;
     bool had_zero_width = false;
+    MatchScratchFrame& frame = getMatchFrame(0);
+    const MatchResult& match_result = frame.result;
+    frame.bounds_only = emit_start == kLineEnd;
+    frame.scanner_state = -1;
+    m_regex_limit_hit_ = false;
+    const bool has_time_budget = m_config_.line_time_budget_ms > 0;
+    const std::chrono::steady_clock::time_point deadline = has_time_budget
+      ? std::chrono::steady_clock::now() + std::chrono::milliseconds(m_config_.line_time_budget_ms)
+      : std::chrono::steady_clock::time_point();
+    const size_t checkpoint_distance = std::max<size_t>(m_config_.long_line_window, 1);
     // Keep matching until the last character of the current line
-    while (current_char_pos < line_char_count) {
-      MatchResult match_result = matchAtPosition(text, current_char_pos, current_state);
+    while (current_byte_pos < text.size() && current_char_pos < stop_column) {
+      // Only a cursor that did not just produce a zero-width match can be resumed without losing state
+      if (checkpoints != nullptr && !had_zero_width
+        && current_char_pos >= checkpoints->checkpoints.back().char_pos + checkpoint_distance) {
+        checkpoints->checkpoints.push_back({current_byte_pos, current_char_pos, current_state});
+      }
+      const StateRule* current_state_rule = m_rule_->findStateRule(current_state);
+      if (frame.bounds_only && current_state_rule != nullptr && !current_state_rule->has_goto_rule) {
+        // Without spans to build, a state that cannot be left has nothing more to find on this line
+        current_char_pos += countCharsInRange(text_begin + current_byte_pos, text_end, frame.ascii_text);
+        current_byte_pos = text.size();
+        break;
+      }
+      bool over_time_budget = has_time_budget && std::chrono::steady_clock::now() >= deadline;
+      // A filler run is cut at emit_start, so that spans start there just like per-character matches would
+      size_t run_end_column = current_char_pos < emit_start ? emit_start : stop_column;
+      if (!over_time_budget && !matchFillerRun(text_begin, text_end, current_byte_pos, current_char_pos,
+        run_end_column, current_state, frame)) {
+        matchAtPosition(text_begin, text_end, current_byte_pos, current_char_pos, current_state, frame);
+      }
+      if (over_time_budget || m_regex_limit_hit_) {
+        // Give up on the rest of the line, it stays unstyled and the line ends in the state reached so far
+        if (m_budget_counters_ != nullptr) {
+          std::atomic<size_t>& counter = over_time_budget
+            ? m_budget_counters_->time_budget_exceeded : m_budget_counters_->regex_limit_exceeded;
+          counter.fetch_add(1, std::memory_order_relaxed);
+        }
+        result.truncated = true;
+        current_char_pos += countCharsInRange(text_begin + current_byte_pos, text_end, frame.ascii_text);
+        current_byte_pos = text.size();
+        break;
+      }
       if (!match_result.matched) {
+        // The failed search already tried every later start position in this state, so the rest of the line
+        // is unstyled. Only \G depends on the search start and still needs the per-character retry.
+        if (current_state_rule == nullptr || !current_state_rule->search_start_anchored) {
+          current_char_pos += countCharsInRange(text_begin + current_byte_pos, text_end, frame.ascii_text);
+          current_byte_pos = text.size();
+          break;
+        }
+        current_byte_pos = advanceOneChar(text_begin + current_byte_pos, text_end, frame.ascii_text) - text_begin;
         current_char_pos++;
         had_zero_width = false;
         continue;
@@ -443,6 +841,7 @@ namespace NS_SWEETLINE {
       // Allow at most one zero-width match at the same position to prevent infinite loop
       if (match_result.length == 0) {
         if (had_zero_width) {
+          current_byte_pos = advanceOneChar(text_begin + current_byte_pos, text_end, frame.ascii_text) - text_begin;
           current_char_pos++;
           had_zero_width = false;
           continue;
@@ -451,112 +850,335 @@ namespace NS_SWEETLINE {
       } else {
         had_zero_width = false;
       }
-      if (match_result.length > 0) {
+      if (match_result.length > 0 && match_result.start + match_result.length > emit_start) {
         addLineHighlightResult(result.highlight, info, current_state, match_result);
       }
+      current_byte_pos = match_result.end_byte;
       current_char_pos = match_result.start + match_result.length;
       if (match_result.goto_state >= 0) {
         current_state = match_result.goto_state;
       }
     }
-    StateRule& state_rule = m_rule_->getStateRule(current_state);
-    if (state_rule.line_end_state >= 0) { // If current state has a line-end state, switch to it
-      current_state = state_rule.line_end_state;
+    cursor = {current_byte_pos, current_char_pos, current_state};
+    return current_byte_pos >= text.size();
+  }
+
+  void LineHighlightAnalyzer::finishLine(const LineCheckpoint& cursor, LineAnalyzeResult& result) const {
+    int32_t end_state = cursor.state;
+    const StateRule* state_rule = m_rule_->findStateRule(end_state);
+    // If current state has a line-end state, switch to it
+    if (state_rule != nullptr && state_rule->line_end_state >= 0) {
+      end_state = state_rule->line_end_state;
     }
-    result.end_state = current_state;
-    result.char_count = line_char_count;
+    result.end_state = end_state;
+    result.char_count = cursor.char_pos;
   }
 
   const HighlightConfig& LineHighlightAnalyzer::getHighlightConfig() const {
     return m_config_;
   }
 
-  MatchResult LineHighlightAnalyzer::matchAtPosition(const U8String& text, size_t start_char_pos, int32_t syntax_state) const {
-    MatchResult result;
-    if (!m_rule_->containsRule(syntax_state)) {
-      return result;
+  bool LineHighlightAnalyzer::matchFillerRun(const char* text_begin, const char* text_end, size_t start_byte_pos,
+    size_t start_char_pos, size_t end_column, int32_t syntax_state, MatchScratchFrame& frame) const {
+    const StateRule* state_rule_ptr = m_rule_->findStateRule(syntax_state);
+    if (state_rule_ptr == nullptr) {
+      return false;
     }
-    StateRule& state_rule = m_rule_->getStateRule(syntax_state);
-    size_t start_byte_pos = Utf8Util::charPosToBytePos(text, start_char_pos);
-
-    OnigRegion* region = onig_region_new();
-    const OnigUChar* start = (const OnigUChar*)(text.c_str() + start_byte_pos);
-    const OnigUChar* end = (const OnigUChar*)(text.c_str() + text.length());
-    const OnigUChar* range_end = end;
-
-    int match_byte_pos = onig_search(state_rule.regex, (OnigUChar*)text.c_str(),
-      end, start, range_end, region, ONIG_OPTION_NONE);
-    if (match_byte_pos >= 0) {
-      size_t match_start_byte = match_byte_pos;
-      size_t match_end_byte = region->end[0];
-      if (match_end_byte < match_start_byte) {
-        return result;
+    const StateRule& state_rule = *state_rule_ptr;
+    if (state_rule.filler_rule < 0) {
+      return false;
+    }
+    size_t text_size = text_end - text_begin;
+    size_t run_end_byte;
+    if (state_rule.filler_stop_byte >= 0) {
+      const void* stop = std::memchr(text_begin + start_byte_pos, state_rule.filler_stop_byte,
+        text_size - start_byte_pos);
+      run_end_byte = stop != nullptr ? static_cast<const char*>(stop) - text_begin : text_size;
+    } else {
+      run_end_byte = findFirstByteOf(text_begin, start_byte_pos, text_size, state_rule.filler_stop_bytes);
+    }
+    if (run_end_byte == start_byte_pos) {
+      return false;
+    }
+    // Walk whole characters: a stop byte inside a character whose first byte is not one cannot start a token either
+    size_t end_byte = start_byte_pos;
+    size_t length = 0;
+    if (frame.ascii_text) {
+      length = std::min(run_end_byte - start_byte_pos, end_column - start_char_pos);
+      end_byte = start_byte_pos + length;
+    } else {
+      while (end_byte < run_end_byte && start_char_pos + length < end_column) {
+        end_byte = advanceOneChar(text_begin + end_byte, text_end, false) - text_begin;
+        ++length;
       }
-      size_t match_length_bytes = match_end_byte - match_start_byte;
-
-      size_t match_start_char = Utf8Util::bytePosToCharPos(text, match_start_byte);
-      size_t match_end_char = Utf8Util::bytePosToCharPos(text, match_end_byte);
-      size_t match_length_chars = match_end_char - match_start_char;
+    }
+    const TokenRule& token_rule = state_rule.token_rules[state_rule.filler_rule];
+    MatchResult& result = frame.result;
+    result.reset();
+    result.matched = true;
+    result.start = start_char_pos;
+    result.length = length;
+    result.start_byte = start_byte_pos;
+    result.end_byte = end_byte;
+    result.state = syntax_state;
+    result.token_rule_idx = state_rule.filler_rule;
+    result.matched_group = token_rule.group_offset_start;
+    result.style = token_rule.getGroupStyleId(0);
+    result.goto_state = token_rule.goto_state;
+    if (frame.depth == 0 && m_config_.keep_matched_text && !frame.bounds_only) {
+      // Merged spans keep the text of their first match, which per-character matching would have been one character
+      const char* first_char_end = advanceOneChar(text_begin + start_byte_pos, text_end, frame.ascii_text);
+      result.matched_text.assign(text_begin + start_byte_pos, first_char_end - (text_begin + start_byte_pos));
+    }
+    return true;
+  }
 
-      result.matched = true;
-      result.start = match_start_char;
-      result.length = match_length_chars;
-      result.state = syntax_state;
-      result.matched_text = Utf8Util::utf8Substr(text, match_start_char, match_length_chars);
+  void LineHighlightAnalyzer::matchAtPosition(const char* text_begin, const char* text_end, size_t start_byte_pos,
+    size_t start_char_pos, int32_t syntax_state, MatchScratchFrame& frame) const {
+    MatchResult& result = frame.result;
+    result.reset();
+    const StateRule* state_rule_ptr = m_rule_->findStateRule(syntax_state);
+    if (state_rule_ptr == nullptr) {
+      return;
+    }
+    const StateRule& state_rule = *state_rule_ptr;
 
-      findMatchedRuleAndGroup(state_rule, region, text, match_start_byte, match_end_byte, result);
+    // No token rule can start before the next byte of the state's first-byte set
+    size_t text_size = text_end - text_begin;
+    size_t search_byte_pos = start_byte_pos;
+    if (state_rule.has_first_byte_filter) {
+      search_byte_pos = findFirstByteOf(text_begin, start_byte_pos, text_size, state_rule.first_bytes);
+      if (search_byte_pos >= text_size) {
+        return;
+      }
     }
-    onig_region_free(region, 1);
-    return result;
-  }
 
-  void LineHighlightAnalyzer::findMatchedRuleAndGroup(const StateRule& state_rule, const OnigRegion* region,
-    const U8String& text, size_t match_start_byte, size_t match_end_byte, MatchResult& result) const {
-    for (int32_t rule_idx = 0; rule_idx < static_cast<int32_t>(state_rule.token_rules.size()); ++rule_idx) {
-      const TokenRule& token_rule = state_rule.token_rules[rule_idx];
-      int32_t token_group_start = token_rule.group_offset_start;
-      if (region->beg[token_group_start] != static_cast<int>(match_start_byte)
-        || region->end[token_group_start] != static_cast<int>(match_end_byte)) {
-        continue;
+    size_t match_start_byte = 0;
+    size_t match_end_byte = 0;
+    int32_t rule_idx = -1;
+    bool matched = false;
+    if (state_rule.regex != nullptr) {
+      OnigRegion* region = frame.region;
+      int match_byte_pos = searchStateRegex(state_rule, syntax_state, text_begin, text_end, search_byte_pos, frame);
+      if (match_byte_pos < 0 && match_byte_pos != ONIG_MISMATCH) {
+        // Retry or stack limit exceeded, the caller stops analyzing the line
+        m_regex_limit_hit_ = true;
+        return;
+      }
+      if (match_byte_pos >= 0 && region->end[0] >= match_byte_pos) {
+        matched = true;
+        match_start_byte = match_byte_pos;
+        match_end_byte = region->end[0];
+        rule_idx = findRegexMatchedRule(state_rule, region);
+      }
+    }
+    // A keyword wins when it starts first, or at the same position when its rule comes first in the state
+    KeywordMatch keyword_match;
+    bool keyword_matched = false;
+    if (!state_rule.keyword_trie.empty()) {
+      size_t last_start = matched ? match_start_byte : text_size;
+      keyword_matched = state_rule.keyword_trie.findFirst(text_begin, text_size, search_byte_pos, last_start,
+        keyword_match) && (!matched || keyword_match.start_byte < match_start_byte || keyword_match.rule_idx < rule_idx);
+      if (keyword_matched) {
+        matched = true;
+        match_start_byte = keyword_match.start_byte;
+        match_end_byte = keyword_match.end_byte;
+        rule_idx = keyword_match.rule_idx;
+      }
+    }
+    if (!matched) {
+      return;
+    }
+    // Count characters incrementally from the cursor instead of from the line start
+    size_t match_start_char = start_char_pos
+      + countCharsInRange(text_begin + start_byte_pos, text_begin + match_start_byte, frame.ascii_text);
+    size_t match_length_chars = countCharsInRange(text_begin + match_start_byte, text_begin + match_end_byte,
+      frame.ascii_text);
+
+    result.matched = true;
+    result.start = match_start_char;
+    result.length = match_length_chars;
+    result.start_byte = match_start_byte;
+    result.end_byte = match_end_byte;
+    result.state = syntax_state;
+    // Only line level matches can end up in a TokenSpan, nested subState matches never need their text
+    if (frame.depth == 0 && m_config_.keep_matched_text && !frame.bounds_only) {
+      result.matched_text.assign(text_begin + match_start_byte, match_end_byte - match_start_byte);
+    }
+
+    if (rule_idx >= 0) {
+      applyMatchedRule(state_rule.token_rules[rule_idx], rule_idx, text_begin, frame);
+    }
+  }
+
+  LazyDfa& LineHighlightAnalyzer::getLazyDfa(int32_t syntax_state, const RegularProgram* program) const {
+    UniquePtr<LazyDfa>& dfa = m_lazy_dfas_[syntax_state];
+    if (dfa == nullptr) {
+      dfa = makeUniquePtr<LazyDfa>(program);
+    }
+    return *dfa;
+  }
+
+  int LineHighlightAnalyzer::searchStateRegex(const StateRule& state_rule, int32_t syntax_state, const char* text_begin,
+    const char* text_end, size_t search_byte_pos, MatchScratchFrame& frame) const {
+    const OnigUChar* str = (const OnigUChar*)text_begin;
+    const OnigUChar* start = str + search_byte_pos;
+    const OnigUChar* end = (const OnigUChar*)text_end;
+    if (m_config_.use_builtin_dfa && frame.single_line_ascii && state_rule.regular_program != nullptr) {
+      LazyDfa& dfa = getLazyDfa(syntax_state, state_rule.regular_program.get());
+      size_t match_start = 0;
+      switch (dfa.findMatchStart(text_begin, text_end - text_begin, search_byte_pos, match_start)) {
+      case LazyDfa::SearchStatus::FOUND: {
+        // The DFA only knows where the leftmost match starts, matching there picks the alternative and captures
+        const OnigUChar* at = str + match_start;
+        int match_length = m_match_param_ != nullptr
+          ? onig_match_with_param(state_rule.regex, str, end, at, frame.region, ONIG_OPTION_NONE, m_match_param_)
+          : onig_match(state_rule.regex, str, end, at, frame.region, ONIG_OPTION_NONE);
+        if (match_length >= 0) {
+          return static_cast<int>(match_start);
+        }
+        if (match_length != ONIG_MISMATCH) {
+          // A retry or stack limit, searching the same text again would only pay for it twice
+          return match_length;
+        }
+        break;
+      }
+      case LazyDfa::SearchStatus::NOT_FOUND:
+        return ONIG_MISMATCH;
+      case LazyDfa::SearchStatus::GAVE_UP:
+        break;
+      }
+    }
+    if (m_config_.use_rule_scanner && !state_rule.alternative_regexes.empty()) {
+      int match_start = scanAlternatives(state_rule, syntax_state, text_begin, text_end, search_byte_pos, frame);
+      if (match_start < 0) {
+        return match_start;
+      }
+      // Like after the DFA, matching the merged pattern at the start picks the alternative and captures
+      const OnigUChar* at = str + match_start;
+      int match_length = m_match_param_ != nullptr
+        ? onig_match_with_param(state_rule.regex, str, end, at, frame.region, ONIG_OPTION_NONE, m_match_param_)
+        : onig_match(state_rule.regex, str, end, at, frame.region, ONIG_OPTION_NONE);
+      if (match_length >= 0) {
+        return match_start;
+      }
+      if (match_length != ONIG_MISMATCH) {
+        return match_length;
       }
+    }
+    if (m_match_param_ != nullptr) {
+      return onig_search_with_param(state_rule.regex, str, end, start, end, frame.region, ONIG_OPTION_NONE,
+        m_match_param_);
+    }
+    return onig_search(state_rule.regex, str, end, start, end, frame.region, ONIG_OPTION_NONE);
+  }
+
+  int LineHighlightAnalyzer::scanAlternatives(const StateRule& state_rule, int32_t syntax_state, const char* text_begin,
+    const char* text_end, size_t search_byte_pos, MatchScratchFrame& frame) const {
+    const size_t alternative_count = state_rule.alternative_regexes.size();
+    if (frame.scanner_state != syntax_state || frame.scanner_text_begin != text_begin
+      || frame.scanner_text_end != text_end) {
+      frame.scanner_state = syntax_state;
+      frame.scanner_text_begin = text_begin;
+      frame.scanner_text_end = text_end;
+      frame.scanner_starts.assign(alternative_count, MatchScratchFrame::kUnsearched);
+    }
+    const OnigUChar* str = (const OnigUChar*)text_begin;
+    const OnigUChar* end = (const OnigUChar*)text_end;
+    const size_t text_size = text_end - text_begin;
+    const int search_pos = static_cast<int>(search_byte_pos);
+    int best_start = ONIG_MISMATCH;
+    for (size_t i = 0; i < alternative_count && best_start != search_pos; ++i) {
+      // A match found from an earlier position is still the next one as long as the cursor has not passed it,
+      // and an alternative without a match stays without one for the rest of the text
+      int& start = frame.scanner_starts[i];
+      if (start == MatchScratchFrame::kUnsearched || (start >= 0 && start < search_pos)) {
+        // Skip ahead to the next byte this alternative can start with, it often has none left at all
+        const ByteSet& first_bytes = state_rule.token_rules[state_rule.alternative_rules[i]].first_bytes;
+        size_t search_from = first_bytes.all() ? search_byte_pos
+          : findFirstByteOf(text_begin, search_byte_pos, text_size, first_bytes);
+        if (search_from >= text_size) {
+          start = ONIG_MISMATCH;
+          continue;
+        }
+        OnigRegex regex = state_rule.alternative_regexes[i];
+        start = m_match_param_ != nullptr
+          ? onig_search_with_param(regex, str, end, str + search_from, end, nullptr, ONIG_OPTION_NONE,
+            m_match_param_)
+          : onig_search(regex, str, end, str + search_from, end, nullptr, ONIG_OPTION_NONE);
+        if (start < 0 && start != ONIG_MISMATCH) {
+          int error = start;
+          start = MatchScratchFrame::kUnsearched;
+          return error;
+        }
+      }
+      // Ties go to the earlier alternative, just like in the merged pattern
+      if (start >= 0 && (best_start < 0 || start < best_start)) {
+        best_start = start;
+      }
+    }
+    return best_start;
+  }
 
-      result.token_rule_idx = rule_idx;
-      result.goto_state = token_rule.goto_state;
-      result.style = token_rule.getGroupStyleId(0);
-      result.matched_group = token_group_start;
+  void LineHighlightAnalyzer::applyMatchedRule(const TokenRule& token_rule, int32_t rule_idx, const char* text_begin,
+    MatchScratchFrame& frame) const {
+    MatchResult& result = frame.result;
+    result.token_rule_idx = rule_idx;
+    result.goto_state = token_rule.goto_state;
+    result.style = token_rule.getGroupStyleId(0);
+    result.matched_group = token_rule.group_offset_start;
+    if (frame.bounds_only) {
+      return;
+    }
 
-      // group 0 has subState
-      int32_t whole_sub_state = token_rule.getGroupSubState(0);
-      if (whole_sub_state >= 0) {
-        expandSubStateMatches(result.matched_text, whole_sub_state,
-          result.start, 0, result.capture_groups);
-        return;
+    if (token_rule.keyword_list) {
+      // The only capture group a keyword list can have spans the whole keyword
+      for (int32_t group = 1; group <= token_rule.group_count; ++group) {
+        CaptureGroupMatch group_match;
+        group_match.group = group;
+        group_match.style = token_rule.getGroupStyleId(group);
+        group_match.start = result.start;
+        group_match.length = result.length;
+        result.capture_groups.push_back(group_match);
       }
-      buildCaptureGroups(token_rule, region, text, match_start_byte, match_end_byte, result);
       return;
     }
+
+    // group 0 has subState
+    int32_t whole_sub_state = token_rule.getGroupSubState(0);
+    if (whole_sub_state >= 0) {
+      expandSubStateMatches(text_begin + result.start_byte, text_begin + result.end_byte, whole_sub_state,
+        result.start, 0, frame.depth, result.capture_groups);
+      return;
+    }
+    buildCaptureGroups(token_rule, text_begin, frame);
   }
 
-  void LineHighlightAnalyzer::buildCaptureGroups(const TokenRule& token_rule, const OnigRegion* region,
-    const U8String& text, size_t match_start_byte, size_t match_end_byte, MatchResult& result) const {
+  void LineHighlightAnalyzer::buildCaptureGroups(const TokenRule& token_rule, const char* text_begin,
+    MatchScratchFrame& frame) const {
+    const OnigRegion* region = frame.region;
+    MatchResult& result = frame.result;
+    const char* match_begin = text_begin + result.start_byte;
     int32_t token_group_start = token_rule.group_offset_start;
     for (int32_t group = 1; group <= token_rule.group_count; ++group) {
       int32_t absolute_group = group + token_group_start;
       int group_start_byte = region->beg[absolute_group];
       int group_end_byte = region->end[absolute_group];
-      if (group_start_byte < static_cast<int>(match_start_byte)
-        || group_end_byte > static_cast<int>(match_end_byte)) {
+      if (group_start_byte < static_cast<int>(result.start_byte)
+        || group_end_byte > static_cast<int>(result.end_byte)) {
         continue;
       }
-      size_t group_start_char = Utf8Util::bytePosToCharPos(text, group_start_byte);
-      size_t group_end_char = Utf8Util::bytePosToCharPos(text, group_end_byte);
-      size_t group_length_chars = group_end_char - group_start_char;
+      // Groups always lie inside the match, so count from the match start rather than the line start
+      const char* group_begin = text_begin + group_start_byte;
+      const char* group_end = text_begin + group_end_byte;
+      size_t group_start_char = result.start + countCharsInRange(match_begin, group_begin, frame.ascii_text);
+      size_t group_length_chars = countCharsInRange(group_begin, group_end, frame.ascii_text);
 
       int32_t sub_state = token_rule.getGroupSubState(group);
       if (sub_state >= 0) {
-        // Has subState, recursively match and flatten
-        U8String group_text = Utf8Util::utf8Substr(text, group_start_char, group_length_chars);
-        expandSubStateMatches(group_text, sub_state, group_start_char, group, result.capture_groups);
+        // Has subState, recursively match and flatten over the group's bytes of the same buffer
+        expandSubStateMatches(group_begin, group_end, sub_state, group_start_char, group, frame.depth,
+          result.capture_groups);
       } else {
         // No subState, generate normal CaptureGroupMatch
         CaptureGroupMatch group_match;
@@ -569,15 +1191,31 @@ namespace NS_SWEETLINE {
     }
   }
 
-  void LineHighlightAnalyzer::expandSubStateMatches(const U8String& sub_text, int32_t sub_state,
-    size_t base_char_offset, int32_t group, List<CaptureGroupMatch>& capture_groups) const {
-    size_t sub_text_len = Utf8Util::countChars(sub_text);
+  void LineHighlightAnalyzer::expandSubStateMatches(const char* sub_begin, const char* sub_end, int32_t sub_state,
+    size_t base_char_offset, int32_t group, size_t depth, List<CaptureGroupMatch>& capture_groups) const {
+    size_t sub_size = sub_end - sub_begin;
+    size_t sub_byte_pos = 0;
     size_t sub_pos = 0;
     int32_t current_state = sub_state;
     bool had_zero_width = false;
-    while (sub_pos < sub_text_len) {
-      MatchResult sub_result = matchAtPosition(sub_text, sub_pos, current_state);
+    // The parent level still reads its own region while expanding, so the sub match uses the next frame
+    MatchScratchFrame& frame = getMatchFrame(depth + 1);
+    frame.scanner_state = -1;
+    // A slice of an ASCII line is ASCII as well, otherwise stay on the decoding path
+    frame.ascii_text = getMatchFrame(depth).ascii_text;
+    frame.single_line_ascii = getMatchFrame(depth).single_line_ascii;
+    const MatchResult& sub_result = frame.result;
+    while (sub_byte_pos < sub_size) {
+      matchAtPosition(sub_begin, sub_end, sub_byte_pos, sub_pos, current_state, frame);
+      if (m_regex_limit_hit_) {
+        break;
+      }
       if (!sub_result.matched) {
+        const StateRule* current_state_rule = m_rule_->findStateRule(current_state);
+        if (current_state_rule == nullptr || !current_state_rule->search_start_anchored) {
+          break;
+        }
+        sub_byte_pos = advanceOneChar(sub_begin + sub_byte_pos, sub_end, frame.ascii_text) - sub_begin;
         sub_pos++;
         had_zero_width = false;
         continue;
@@ -585,6 +1223,7 @@ namespace NS_SWEETLINE {
       // Allow at most one zero-width match at the same position to prevent infinite loop
       if (sub_result.length == 0) {
         if (had_zero_width) {
+          sub_byte_pos = advanceOneChar(sub_begin + sub_byte_pos, sub_end, frame.ascii_text) - sub_begin;
           sub_pos++;
           had_zero_width = false;
           continue;
@@ -618,6 +1257,7 @@ namespace NS_SWEETLINE {
           }
         }
       }
+      sub_byte_pos = sub_result.end_byte;
       sub_pos = sub_result.start + sub_result.length;
       if (sub_result.goto_state >= 0) {
         current_state = sub_result.goto_state;
@@ -640,13 +1280,19 @@ namespace NS_SWEETLINE {
         info.start_char_offset + match_result.start + match_result.length
       };
       span.state = syntax_state;
-      span.matched_text = match_result.matched_text;
+      if (m_config_.keep_matched_text) {
+        assignSpanText(span.matched_text, match_result.matched_text);
+      }
       span.style_id = match_result.style;
-      if (m_config_.inline_style && match_result.style > 0) {
-        span.inline_style = m_rule_->getInlineStyle(match_result.style);
+      if (m_config_.inline_style) {
+        if (const InlineStyle* inline_style = m_rule_->findInlineStyle(match_result.style)) {
+          span.inline_style = *inline_style;
+        }
       }
       span.goto_state = match_result.goto_state;
       highlight.pushOrMergeSpan(std::move(span));
+      // A span merged into the previous one still owns its text
+      recycleText(span.matched_text);
     } else {
       for (const CaptureGroupMatch& group_match : match_result.capture_groups) {
         TokenSpan span;
@@ -662,8 +1308,10 @@ namespace NS_SWEETLINE {
         };
         span.state = syntax_state;
         span.style_id = group_match.style;
-        if (m_config_.inline_style && group_match.style > 0) {
-          span.inline_style = m_rule_->getInlineStyle(group_match.style);
+        if (m_config_.inline_style) {
+          if (const InlineStyle* inline_style = m_rule_->findInlineStyle(group_match.style)) {
+            span.inline_style = *inline_style;
+          }
         }
         span.goto_state = match_result.goto_state;
         highlight.pushOrMergeSpan(std::move(span));
@@ -671,24 +1319,216 @@ namespace NS_SWEETLINE {
     }
   }
 
+  void LineHighlightAnalyzer::recycleSpans(LineHighlight& highlight) const {
+    if (m_config_.keep_matched_text) {
+      for (TokenSpan& span : highlight.spans) {
+        recycleText(span.matched_text);
+      }
+    }
+    highlight.spans.clear();
+  }
+
+  void LineHighlightAnalyzer::recycleText(U8String& text) const {
+    // Short texts live inline in the string, oversized buffers are not worth holding on to
+    if (text.capacity() > kInlineTextCapacity && text.capacity() <= kMaxSpareTextCapacity) {
+      m_spare_texts_.push_back(std::move(text));
+    }
+  }
+
+  void LineHighlightAnalyzer::assignSpanText(U8String& span_text, const U8String& matched_text) const {
+    if (matched_text.size() > span_text.capacity() && !m_spare_texts_.empty()) {
+      span_text = std::move(m_spare_texts_.back());
+      m_spare_texts_.pop_back();
+    }
+    span_text.assign(matched_text);
+  }
+
+  // ===================================== PackedHighlightStore ============================================
+  PackedHighlightStore::PackedHighlightStore(bool keep_matched_text): m_keep_matched_text_(keep_matched_text) {
+  }
+
+  size_t PackedHighlightStore::lineCount() const {
+    return m_lines_.size();
+  }
+
+  void PackedHighlightStore::resizeLines(size_t line_count) {
+    if (line_count < m_lines_.size()) {
+      releaseSlots(line_count, m_lines_.size());
+    }
+    m_lines_.resize(line_count);
+  }
+
+  void PackedHighlightStore::replaceLines(const List<LineReplacement>& replacements) {
+    for (const LineReplacement& replacement : replacements) {
+      if (replacement.old_count > replacement.new_count) {
+        releaseSlots(replacement.old_start + replacement.new_count, replacement.old_start + replacement.old_count);
+      }
+    }
+    replaceLineEntries(m_lines_, replacements, LineSlot {});
+    compactIfWasteful();
+  }
+
+  void PackedHighlightStore::clear() {
+    m_spans_.clear();
+    m_matched_texts_.clear();
+    m_lines_.clear();
+    m_live_span_count_ = 0;
+    m_pending_line_count_ = 0;
+  }
+
+  void PackedHighlightStore::setLine(size_t line, const LineHighlight& highlight) {
+    LineSlot& slot = m_lines_[line];
+    if (slot.pending) {
+      slot.pending = false;
+      --m_pending_line_count_;
+    }
+    const uint32_t count = static_cast<uint32_t>(highlight.spans.size());
+    if (count > slot.capacity) {
+      // A slot at the end of the buffer grows in place, any other one moves to the end
+      if (static_cast<size_t>(slot.offset) + slot.capacity != m_spans_.size()) {
+        slot.offset = static_cast<uint32_t>(m_spans_.size());
+      }
+      slot.capacity = count;
+      m_spans_.resize(static_cast<size_t>(slot.offset) + count);
+      if (m_keep_matched_text_) {
+        m_matched_texts_.resize(m_spans_.size());
+      }
+    }
+    if (m_keep_matched_text_) {
+      for (uint32_t i = count; i < slot.count; ++i) {
+        m_matched_texts_[slot.offset + i].clear();
+      }
+    }
+    m_live_span_count_ = m_live_span_count_ - slot.count + count;
+    slot.count = count;
+    for (uint32_t i = 0; i < count; ++i) {
+      const TokenSpan& token_span = highlight.spans[i];
+      Span& span = m_spans_[slot.offset + i];
+      span.column = static_cast<uint32_t>(token_span.range.start.column);
+      span.length = static_cast<uint32_t>(token_span.range.end.column - token_span.range.start.column);
+      span.style_id = token_span.style_id;
+      span.state = token_span.state;
+      span.goto_state = token_span.goto_state;
+      if (m_keep_matched_text_) {
+        m_matched_texts_[slot.offset + i] = token_span.matched_text;
+      }
+    }
+    compactIfWasteful();
+  }
+
+  bool PackedHighlightStore::isLineReusableWith(size_t line, const LineHighlight& highlight) const {
+    const LineSlot& slot = m_lines_[line];
+    if (slot.count != highlight.spans.size()) {
+      return false;
+    }
+    for (uint32_t i = 0; i < slot.count; ++i) {
+      const Span& span = m_spans_[slot.offset + i];
+      const TokenSpan& token_span = highlight.spans[i];
+      if (span.column != token_span.range.start.column
+        || span.column + span.length != token_span.range.end.column
+        || span.style_id != token_span.style_id
+        || span.state != token_span.state
+        || span.goto_state != token_span.goto_state) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t PackedHighlightStore::spanCount(size_t line) const {
+    return m_lines_[line].count;
+  }
+
+  const PackedHighlightStore::Span* PackedHighlightStore::lineSpans(size_t line) const {
+    return m_spans_.data() + m_lines_[line].offset;
+  }
+
+  const U8String& PackedHighlightStore::matchedText(size_t line, size_t index) const {
+    static const U8String kEmpty;
+    if (!m_keep_matched_text_) {
+      return kEmpty;
+    }
+    return m_matched_texts_[m_lines_[line].offset + index];
+  }
+
+  void PackedHighlightStore::setLinePending(size_t line) {
+    LineSlot& slot = m_lines_[line];
+    if (m_keep_matched_text_) {
+      for (uint32_t i = 0; i < slot.count; ++i) {
+        m_matched_texts_[slot.offset + i].clear();
+      }
+    }
+    m_live_span_count_ -= slot.count;
+    slot.count = 0;
+    if (!slot.pending) {
+      slot.pending = true;
+      ++m_pending_line_count_;
+    }
+  }
+
+  bool PackedHighlightStore::isLinePending(size_t line) const {
+    return m_lines_[line].pending;
+  }
+
+  bool PackedHighlightStore::hasPendingLines() const {
+    return m_pending_line_count_ > 0;
+  }
+
+  void PackedHighlightStore::releaseSlots(size_t begin, size_t end) {
+    for (size_t line = begin; line < end; ++line) {
+      m_live_span_count_ -= m_lines_[line].count;
+      if (m_lines_[line].pending) {
+        --m_pending_line_count_;
+      }
+    }
+  }
+
+  void PackedHighlightStore::compactIfWasteful() {
+    // Rewrite the buffer in line order once dead space outweighs the live spans
+    constexpr size_t kMinCompactWaste = 4096;
+    const size_t waste = m_spans_.size() - m_live_span_count_;
+    if (waste < kMinCompactWaste || waste <= m_live_span_count_) {
+      return;
+    }
+    List<Span> spans;
+    spans.reserve(m_live_span_count_);
+    List<U8String> matched_texts;
+    if (m_keep_matched_text_) {
+      matched_texts.reserve(m_live_span_count_);
+    }
+    for (LineSlot& slot : m_lines_) {
+      const uint32_t offset = static_cast<uint32_t>(spans.size());
+      spans.insert(spans.end(), m_spans_.begin() + slot.offset, m_spans_.begin() + slot.offset + slot.count);
+      if (m_keep_matched_text_) {
+        for (uint32_t i = 0; i < slot.count; ++i) {
+          matched_texts.push_back(std::move(m_matched_texts_[slot.offset + i]));
+        }
+      }
+      slot.offset = offset;
+      slot.capacity = slot.count;
+    }
+    m_spans_ = std::move(spans);
+    m_matched_texts_ = std::move(matched_texts);
+  }
+
   // ===================================== InternalDocumentAnalyzer ============================================
   InternalDocumentAnalyzer::InternalDocumentAnalyzer(const SharedPtr<Document>& document, const SharedPtr<SyntaxRule>& rule,
-    const HighlightConfig& config): m_document_(document), m_rule_(rule), m_config_(config) {
-    m_highlight_ = makeSharedPtr<DocumentHighlight>();
-    m_line_highlight_analyzer_ = makeUniquePtr<LineHighlightAnalyzer>(m_rule_, config);
+    const HighlightConfig& config, const SharedPtr<LineAnalyzeCache>& line_cache,
+    const SharedPtr<AnalyzeBudgetCounters>& budget_counters)
+    : m_document_(document), m_highlight_(config.keep_matched_text), m_rule_(rule), m_config_(config) {
+    m_line_highlight_analyzer_ = makeUniquePtr<LineHighlightAnalyzer>(m_rule_, config, line_cache, budget_counters);
     m_scope_guide_analyzer_ = makeUniquePtr<ScopeGuideAnalyzer>(m_rule_, m_document_, config);
     m_bracket_pair_analyzer_ = makeUniquePtr<BracketPairAnalyzer>(m_rule_, m_document_, config);
   }
 
   void InternalDocumentAnalyzer::resetAnalysisCache() {
-    if (m_highlight_ != nullptr) {
-      m_highlight_->reset();
-    }
+    m_highlight_.clear();
     m_line_syntax_states_.clear();
     m_valid_line_count_ = 0;
-    m_reusable_tail_start_ = 0;
-    m_reusable_tail_lines_dirty_ = false;
-    m_reusable_tail_indices_dirty_ = false;
+    m_dirty_line_ranges_.clear();
+    m_long_lines_.clear();
+    m_provisional_ = ProvisionalLines();
+    m_sync_free_lines_ = {};
   }
 
   void InternalDocumentAnalyzer::invalidateAnalysisFrom(size_t line) {
@@ -708,64 +1548,94 @@ namespace NS_SWEETLINE {
   }
 
   void InternalDocumentAnalyzer::ensureCacheSize(size_t line_count) {
-    if (m_highlight_ == nullptr) {
-      m_highlight_ = makeSharedPtr<DocumentHighlight>();
-    }
-    if (m_highlight_->lines.size() < line_count) {
-      m_highlight_->lines.resize(line_count);
+    if (m_highlight_.lineCount() < line_count) {
+      m_highlight_.resizeLines(line_count);
     }
     if (m_line_syntax_states_.size() < line_count) {
       m_line_syntax_states_.resize(line_count, SyntaxRule::kDefaultStateId);
     }
   }
 
-  void InternalDocumentAnalyzer::syncCachedLinesAfterPatch(
-    size_t change_start_line, size_t old_end_line, int32_t line_delta, int32_t char_delta) {
-    if (m_highlight_ == nullptr) {
+  void InternalDocumentAnalyzer::syncCachedLinesAfterPatch(const List<LineReplacement>& replacements) {
+    if (replacements.empty()) {
       return;
     }
-    size_t cached_line_count = m_highlight_->lines.size();
-    if (change_start_line >= cached_line_count) {
-      return;
+    const size_t cached_line_count = m_highlight_.lineCount();
+    // Replacements inside the cache move its lines, the first one reaching the end of the cache cuts it there
+    List<LineReplacement> cached_replacements;
+    List<LineRange> dirty_ranges;
+    ptrdiff_t shift = 0;
+    size_t cut_line = 0;
+    bool cut = false;
+    for (const LineReplacement& replacement : replacements) {
+      const size_t new_start = static_cast<size_t>(static_cast<ptrdiff_t>(replacement.old_start) + shift);
+      if (replacement.old_start + replacement.old_count >= cached_line_count) {
+        cut_line = new_start;
+        cut = true;
+        break;
+      }
+      cached_replacements.push_back(replacement);
+      dirty_ranges.push_back({new_start, replacement.new_count});
+      shift += static_cast<ptrdiff_t>(replacement.new_count) - static_cast<ptrdiff_t>(replacement.old_count);
+    }
+    if (!cut) {
+      cut_line = static_cast<size_t>(static_cast<ptrdiff_t>(cached_line_count) + shift);
+    }
+
+    // Lines that were already dirty stay dirty, a dirty line inside a replacement widens to the whole replacement
+    size_t replacement_index = 0;
+    ptrdiff_t line_shift = 0;
+    auto map_line = [&](size_t line, bool range_end) {
+      while (replacement_index < cached_replacements.size()
+        && cached_replacements[replacement_index].old_start + cached_replacements[replacement_index].old_count <= line) {
+        const LineReplacement& passed = cached_replacements[replacement_index];
+        line_shift += static_cast<ptrdiff_t>(passed.new_count) - static_cast<ptrdiff_t>(passed.old_count);
+        ++replacement_index;
+      }
+      if (replacement_index < cached_replacements.size()
+        && cached_replacements[replacement_index].old_start <= line) {
+        const LineReplacement& covering = cached_replacements[replacement_index];
+        const size_t new_start = static_cast<size_t>(static_cast<ptrdiff_t>(covering.old_start) + line_shift);
+        return range_end ? new_start + covering.new_count - 1 : new_start;
+      }
+      return static_cast<size_t>(static_cast<ptrdiff_t>(line) + line_shift);
+    };
+    for (const LineRange& range : m_dirty_line_ranges_) {
+      if (range.start_line >= cached_line_count) {
+        break;
+      }
+      const size_t start_line = map_line(range.start_line, false);
+      const size_t end_line = map_line(std::min(range.start_line + range.line_count, cached_line_count) - 1, true);
+      dirty_ranges.push_back({start_line, end_line + 1 - start_line});
+    }
+    std::sort(dirty_ranges.begin(), dirty_ranges.end(), [](const LineRange& left, const LineRange& right) {
+      return left.start_line < right.start_line;
+    });
+    m_dirty_line_ranges_.clear();
+    for (const LineRange& range : dirty_ranges) {
+      const size_t end_line = std::min(range.start_line + range.line_count, cut_line);
+      if (range.start_line >= end_line) {
+        continue;
+      }
+      if (!m_dirty_line_ranges_.empty()
+        && range.start_line <= m_dirty_line_ranges_.back().start_line + m_dirty_line_ranges_.back().line_count) {
+        LineRange& last = m_dirty_line_ranges_.back();
+        last.line_count = std::max(last.line_count, end_line - last.start_line);
+      } else {
+        m_dirty_line_ranges_.push_back({range.start_line, end_line - range.start_line});
+      }
     }
 
-    size_t old_tail_begin = old_end_line + 1;
-    if (old_tail_begin >= cached_line_count) {
-      m_highlight_->lines.resize(change_start_line);
-      m_line_syntax_states_.resize(change_start_line);
-      m_valid_line_count_ = std::min(m_valid_line_count_, change_start_line);
-      m_reusable_tail_start_ = m_highlight_->lines.size();
-      m_reusable_tail_lines_dirty_ = false;
-      m_reusable_tail_indices_dirty_ = false;
-      return;
+    // Only the line table moves: positions of the reused lines follow from the line slots and the document
+    if (!cached_replacements.empty()) {
+      m_highlight_.replaceLines(cached_replacements);
+      replaceLineEntries(m_line_syntax_states_, cached_replacements, SyntaxRule::kDefaultStateId);
     }
-
-    size_t new_tail_begin = old_tail_begin;
-    if (line_delta >= 0) {
-      new_tail_begin += static_cast<size_t>(line_delta);
-    } else {
-      new_tail_begin -= static_cast<size_t>(-line_delta);
-    }
-    if (line_delta > 0) {
-      m_highlight_->lines.insert(
-        m_highlight_->lines.begin() + static_cast<ptrdiff_t>(old_tail_begin),
-        static_cast<size_t>(line_delta), {});
-      m_line_syntax_states_.insert(
-        m_line_syntax_states_.begin() + static_cast<ptrdiff_t>(old_tail_begin),
-        static_cast<size_t>(line_delta), SyntaxRule::kDefaultStateId);
-    } else if (line_delta < 0) {
-      m_highlight_->lines.erase(
-        m_highlight_->lines.begin() + static_cast<ptrdiff_t>(new_tail_begin),
-        m_highlight_->lines.begin() + static_cast<ptrdiff_t>(old_tail_begin));
-      m_line_syntax_states_.erase(
-        m_line_syntax_states_.begin() + static_cast<ptrdiff_t>(new_tail_begin),
-        m_line_syntax_states_.begin() + static_cast<ptrdiff_t>(old_tail_begin));
-    }
-
-    m_valid_line_count_ = std::min(m_valid_line_count_, change_start_line);
-    m_reusable_tail_start_ = new_tail_begin;
-    m_reusable_tail_lines_dirty_ = line_delta != 0;
-    m_reusable_tail_indices_dirty_ = m_config_.show_index && char_delta != 0;
+    if (cut_line < m_highlight_.lineCount()) {
+      m_highlight_.resizeLines(cut_line);
+      m_line_syntax_states_.resize(cut_line);
+    }
+    m_valid_line_count_ = std::min(m_valid_line_count_, replacements.front().old_start);
   }
 
   bool LineHighlight::isReusableWith(const LineHighlight& other) const {
@@ -781,34 +1651,54 @@ namespace NS_SWEETLINE {
     return true;
   }
 
-  void InternalDocumentAnalyzer::rebaseReusableTailFrom(size_t start_line, size_t end_line_exclusive) {
-    if (m_document_ == nullptr
-      || m_highlight_ == nullptr
-      || start_line >= end_line_exclusive
-      || (!m_reusable_tail_lines_dirty_ && !m_reusable_tail_indices_dirty_)) {
-      return;
+  const InlineStyle* InternalDocumentAnalyzer::getInlineStyle(int32_t style_id) const {
+    if (!m_config_.inline_style) {
+      return nullptr;
     }
-    size_t total_line_count = std::min({end_line_exclusive, m_highlight_->lines.size(), m_document_->getLineCount()});
-    if (start_line >= total_line_count) {
-      return;
+    return m_rule_->findInlineStyle(style_id);
+  }
+
+  void InternalDocumentAnalyzer::expandLine(size_t line, size_t line_start_index, LineHighlight& highlight) const {
+    const size_t span_count = m_highlight_.spanCount(line);
+    const PackedHighlightStore::Span* spans = m_highlight_.lineSpans(line);
+    highlight.spans.resize(span_count);
+    for (size_t i = 0; i < span_count; ++i) {
+      const PackedHighlightStore::Span& span = spans[i];
+      TokenSpan& token_span = highlight.spans[i];
+      token_span.range.start = {line, span.column, line_start_index + span.column};
+      token_span.range.end = {line, span.column + span.length, line_start_index + span.column + span.length};
+      token_span.matched_text = m_highlight_.matchedText(line, i);
+      token_span.style_id = span.style_id;
+      const InlineStyle* inline_style = getInlineStyle(span.style_id);
+      token_span.inline_style = inline_style == nullptr ? InlineStyle {} : *inline_style;
+      token_span.state = span.state;
+      token_span.goto_state = span.goto_state;
     }
-    size_t line_start_index = m_reusable_tail_indices_dirty_ ? m_document_->charIndexOfLine(start_line) : 0;
-    for (size_t line = start_line; line < total_line_count; ++line) {
-      LineHighlight& line_highlight = m_highlight_->lines[line];
-      for (TokenSpan& span : line_highlight.spans) {
-        if (m_reusable_tail_lines_dirty_) {
-          span.range.start.line = line;
-          span.range.end.line = line;
-        }
-        if (m_reusable_tail_indices_dirty_) {
-          span.range.start.index = line_start_index + span.range.start.column;
-          span.range.end.index = line_start_index + span.range.end.column;
-        }
-      }
-      if (m_reusable_tail_indices_dirty_) {
-        line_start_index += m_document_->getLineCharCount(line);
-      }
+  }
+
+  SharedPtr<DocumentHighlight> InternalDocumentAnalyzer::buildDocumentHighlight() const {
+    auto highlight = makeSharedPtr<DocumentHighlight>();
+    const size_t line_count = m_highlight_.lineCount();
+    highlight->lines.resize(line_count);
+    for (size_t line = 0; line < line_count; ++line) {
+      expandLine(line, m_document_->charIndexOfLine(line), highlight->lines[line]);
+    }
+    return highlight;
+  }
+
+  size_t InternalDocumentAnalyzer::clipValidRange(const LineRange& visible_range, size_t& start_line) const {
+    start_line = 0;
+    if (m_document_ == nullptr) {
+      return 0;
     }
+    const size_t total_line_count = m_document_->getLineCount();
+    start_line = std::min(visible_range.start_line, total_line_count);
+    if (visible_range.line_count == 0 || start_line >= total_line_count) {
+      return 0;
+    }
+    size_t end_line = start_line + std::min(visible_range.line_count, total_line_count - start_line);
+    end_line = std::min({end_line, m_valid_line_count_, m_highlight_.lineCount()});
+    return end_line > start_line ? end_line - start_line : 0;
   }
 
   SharedPtr<DocumentHighlightSlice> InternalDocumentAnalyzer::buildValidSlice(const LineRange& visible_range) const {
@@ -817,24 +1707,29 @@ namespace NS_SWEETLINE {
       return slice;
     }
     slice->total_line_count = m_document_->getLineCount();
-    slice->start_line = std::min(visible_range.start_line, slice->total_line_count);
-    if (visible_range.line_count == 0 || slice->start_line >= slice->total_line_count) {
-      return slice;
-    }
-    size_t available_count = slice->total_line_count - slice->start_line;
-    size_t slice_line_count = std::min(visible_range.line_count, available_count);
-    slice->lines.reserve(slice_line_count);
+    const size_t slice_line_count = clipValidRange(visible_range, slice->start_line);
+    slice->lines.resize(slice_line_count);
     for (size_t i = 0; i < slice_line_count; ++i) {
       size_t line = slice->start_line + i;
-      if (m_highlight_ == nullptr || line >= m_valid_line_count_ || line >= m_highlight_->lines.size()) {
-        break;
-      }
-      slice->lines.push_back(m_highlight_->lines[line]);
+      expandLine(line, m_document_->charIndexOfLine(line), slice->lines[i]);
     }
     return slice;
   }
 
+  bool InternalDocumentAnalyzer::isLongLine(const DocumentLine& document_line) const {
+    return m_config_.long_line_threshold > 0 && document_line.text.size() > m_config_.long_line_threshold;
+  }
+
+  LongLineCheckpoints& InternalDocumentAnalyzer::getLongLineCheckpoints(size_t line) {
+    return m_long_lines_[line];
+  }
+
   void InternalDocumentAnalyzer::ensureAnalyzedThrough(size_t inclusive_end_line) {
+    advanceAnalysisThrough(inclusive_end_line, 0);
+    materializePendingLines(0, inclusive_end_line);
+  }
+
+  void InternalDocumentAnalyzer::advanceAnalysisThrough(size_t inclusive_end_line, size_t first_full_line) {
     if (m_rule_ == nullptr || m_document_ == nullptr) {
       return;
     }
@@ -848,48 +1743,109 @@ namespace NS_SWEETLINE {
       return;
     }
 
-    size_t comparable_cached_end = m_highlight_ == nullptr ? 0 : m_highlight_->lines.size();
-    size_t comparable_reusable_start = std::min(m_reusable_tail_start_, comparable_cached_end);
+    size_t comparable_cached_end = m_highlight_.lineCount();
+    size_t dirty_index = 0;
     ensureCacheSize(target_line + 1);
     size_t line_start_index = m_document_->charIndexOfLine(m_valid_line_count_);
 
+    LineAnalyzeResult result;
     while (m_valid_line_count_ <= target_line) {
       size_t line = m_valid_line_count_;
       int32_t current_state = line == 0 ? SyntaxRule::kDefaultStateId : m_line_syntax_states_[line - 1];
       const DocumentLine& document_line = m_document_->getLine(line);
       TextLineInfo info = {line, current_state, line_start_index};
-      LineAnalyzeResult result;
-      m_line_highlight_analyzer_->analyzeLine(document_line.text, info, result);
+      const bool long_line = isLongLine(document_line);
+      const bool fast_forward = line < first_full_line && !long_line;
+      if (long_line) {
+        result.highlight.spans.clear();
+        // Only the end state is needed here, the spans of a long line come from column windows
+        m_line_highlight_analyzer_->analyzeLineWindow(document_line.text, info, LineHighlightAnalyzer::kLineEnd,
+          LineHighlightAnalyzer::kLineEnd, getLongLineCheckpoints(line), result);
+      } else if (fast_forward) {
+        m_line_highlight_analyzer_->analyzeLineState(document_line.text, info, result);
+      } else {
+        m_line_highlight_analyzer_->analyzeLine(document_line.text, info, result);
+      }
 
-      bool comparable_old = line >= comparable_reusable_start && line < comparable_cached_end;
+      while (dirty_index < m_dirty_line_ranges_.size()
+        && m_dirty_line_ranges_[dirty_index].start_line + m_dirty_line_ranges_[dirty_index].line_count <= line) {
+        ++dirty_index;
+      }
+      bool dirty = dirty_index < m_dirty_line_ranges_.size() && m_dirty_line_ranges_[dirty_index].start_line <= line;
+      bool comparable_old = !dirty && line < comparable_cached_end;
       int32_t old_state = comparable_old ? m_line_syntax_states_[line] : SyntaxRule::kDefaultStateId;
+      // The lines below only depend on the end state, a fast-forwarded line has no spans to compare anyway
       bool stable = comparable_old
         && old_state == result.end_state
-        && result.highlight.isReusableWith(m_highlight_->lines[line]);
+        && (fast_forward || m_highlight_.isLineReusableWith(line, result.highlight));
 
       m_line_syntax_states_[line] = result.end_state;
-      m_highlight_->lines[line] = std::move(result.highlight);
+      if (fast_forward) {
+        m_highlight_.setLinePending(line);
+      } else {
+        m_highlight_.setLine(line, result.highlight);
+      }
       m_valid_line_count_ = line + 1;
       line_start_index += result.char_count + Document::getLineEndingWidth(document_line.ending);
 
       if (stable) {
-        if (line + 1 < comparable_cached_end) {
-          rebaseReusableTailFrom(line + 1, comparable_cached_end);
-        }
+        // The cached lines up to the next changed one were analyzed from this same state
         m_valid_line_count_ = comparable_cached_end;
-        m_reusable_tail_start_ = comparable_cached_end;
-        m_reusable_tail_lines_dirty_ = false;
-        m_reusable_tail_indices_dirty_ = false;
+        if (dirty_index < m_dirty_line_ranges_.size()) {
+          m_valid_line_count_ = std::min(m_valid_line_count_, m_dirty_line_ranges_[dirty_index].start_line);
+        }
         if (m_valid_line_count_ <= target_line) {
           line_start_index = m_document_->charIndexOfLine(m_valid_line_count_);
         }
       }
     }
 
-    if (m_highlight_ != nullptr && m_valid_line_count_ >= m_highlight_->lines.size()) {
-      m_reusable_tail_start_ = m_highlight_->lines.size();
-      m_reusable_tail_lines_dirty_ = false;
-      m_reusable_tail_indices_dirty_ = false;
+    // Dirty ranges behind the analyzed lines are done
+    auto first_pending_range = std::find_if(m_dirty_line_ranges_.begin(), m_dirty_line_ranges_.end(),
+      [this](const LineRange& range) { return range.start_line + range.line_count > m_valid_line_count_; });
+    m_dirty_line_ranges_.erase(m_dirty_line_ranges_.begin(), first_pending_range);
+    // The first cached line left behind was analyzed from the old end state of the line above, which is overwritten
+    // now, so that line can no longer vouch for it and it is analyzed again when the analysis resumes
+    if (m_valid_line_count_ < m_highlight_.lineCount()
+      && (m_dirty_line_ranges_.empty() || m_dirty_line_ranges_.front().start_line > m_valid_line_count_)) {
+      if (!m_dirty_line_ranges_.empty() && m_dirty_line_ranges_.front().start_line == m_valid_line_count_ + 1) {
+        --m_dirty_line_ranges_.front().start_line;
+        ++m_dirty_line_ranges_.front().line_count;
+      } else {
+        m_dirty_line_ranges_.insert(m_dirty_line_ranges_.begin(), {m_valid_line_count_, 1});
+      }
+    }
+    // The exact analysis caught up with the lines analyzed from a sync point
+    if (!m_provisional_.lines.empty() && m_valid_line_count_ > m_provisional_.start_line) {
+      m_provisional_ = ProvisionalLines();
+    }
+  }
+
+  void InternalDocumentAnalyzer::materializePendingLines(size_t start_line, size_t inclusive_end_line) {
+    if (!m_highlight_.hasPendingLines()) {
+      return;
+    }
+    const size_t end_line = inclusive_end_line < m_valid_line_count_ ? inclusive_end_line + 1 : m_valid_line_count_;
+    LineAnalyzeResult result;
+    for (size_t line = start_line; line < end_line; ++line) {
+      if (!m_highlight_.isLinePending(line)) {
+        continue;
+      }
+      int32_t start_state = line == 0 ? SyntaxRule::kDefaultStateId : m_line_syntax_states_[line - 1];
+      TextLineInfo info = {line, start_state, m_document_->charIndexOfLine(line)};
+      m_line_highlight_analyzer_->analyzeLine(m_document_->getLine(line).text, info, result);
+      m_highlight_.setLine(line, result.highlight);
+    }
+  }
+
+  void InternalDocumentAnalyzer::ensureAnalyzedInLineRange(const LineRange& visible_range) {
+    if (m_document_ != nullptr
+      && visible_range.line_count > 0
+      && visible_range.start_line < m_document_->getLineCount()) {
+      size_t end_line = visible_range.start_line + visible_range.line_count - 1;
+      // Lines above the range only need their end state, their spans are analyzed once they are requested
+      advanceAnalysisThrough(end_line, visible_range.start_line);
+      materializePendingLines(visible_range.start_line, end_line);
     }
   }
 
@@ -910,45 +1866,236 @@ namespace NS_SWEETLINE {
     return m_document_->charIndexToPosition(char_index);
   }
 
-  SharedPtr<DocumentHighlight> InternalDocumentAnalyzer::analyzeHighlight() {
+  void InternalDocumentAnalyzer::analyzeAllLines() {
     if (m_rule_ == nullptr) {
-      return nullptr;
+      return;
     }
     resetAnalysisCache();
     if (m_document_ != nullptr && m_document_->getLineCount() > 0) {
       ensureAnalyzedThrough(m_document_->getLineCount() - 1);
     }
-    return m_highlight_;
+  }
+
+  void InternalDocumentAnalyzer::applyPatch(const TextRange& range, const U8String& new_text) {
+    if (m_rule_ == nullptr) {
+      return;
+    }
+    // Past the last line the patch appends to the last line
+    const size_t line_count = m_document_->getLineCount();
+    const size_t last_line = line_count > 0 ? line_count - 1 : 0;
+    const size_t change_start_line = std::min(range.start.line, last_line);
+    const size_t old_end_line = std::max(std::min(range.end.line, last_line), change_start_line);
+    PatchResult patch_result = m_document_->patch(range, new_text);
+    const size_t old_count = old_end_line - change_start_line + 1;
+    const ptrdiff_t new_count = static_cast<ptrdiff_t>(old_count) + patch_result.line_delta;
+    invalidateChangedLines({{change_start_line, old_count, static_cast<size_t>(std::max<ptrdiff_t>(new_count, 1))}});
+  }
+
+  void InternalDocumentAnalyzer::applyPatches(const List<TextEdit>& edits) {
+    if (m_rule_ == nullptr) {
+      return;
+    }
+    const List<TextEdit> sorted_edits = m_document_->normalizeEdits(edits);
+    if (sorted_edits.empty()) {
+      return;
+    }
+    // Edits sharing a line become one replacement, the line count of each follows from the new text alone
+    List<LineReplacement> replacements;
+    for (const TextEdit& edit : sorted_edits) {
+      const size_t start_line = edit.range.start.line;
+      const size_t end_line = edit.range.end.line;
+      const size_t line_breaks = countLineBreaks(edit.new_text);
+      if (!replacements.empty()
+        && start_line < replacements.back().old_start + replacements.back().old_count) {
+        LineReplacement& replacement = replacements.back();
+        replacement.old_count += end_line - start_line;
+        replacement.new_count += line_breaks;
+      } else {
+        replacements.push_back({start_line, end_line - start_line + 1, line_breaks + 1});
+      }
+    }
+    m_document_->applyPatches(sorted_edits);
+    invalidateChangedLines(replacements);
+  }
+
+  void InternalDocumentAnalyzer::invalidateChangedLines(const List<LineReplacement>& replacements) {
+    syncCachedLinesAfterPatch(replacements);
+    const size_t change_start_line = replacements.front().old_start;
+    for (auto it = m_long_lines_.begin(); it != m_long_lines_.end();) {
+      it = it->first >= change_start_line ? m_long_lines_.erase(it) : std::next(it);
+    }
+    if (change_start_line < m_provisional_.start_line + m_provisional_.lines.size()) {
+      m_provisional_ = ProvisionalLines();
+    }
+    if (change_start_line < m_sync_free_lines_.start_line + m_sync_free_lines_.line_count) {
+      m_sync_free_lines_ = {};
+    }
+    invalidateAnalysisFrom(change_start_line);
+    invalidateIndentGuidesFrom(change_start_line);
+    invalidateBracketPairsFrom(change_start_line);
+  }
+
+  SharedPtr<DocumentHighlight> InternalDocumentAnalyzer::analyzeHighlight() {
+    if (m_rule_ == nullptr) {
+      return nullptr;
+    }
+    analyzeAllLines();
+    return buildDocumentHighlight();
   }
 
   SharedPtr<DocumentHighlightSlice> InternalDocumentAnalyzer::analyzeHighlightLineRange(const LineRange& visible_range) {
     if (m_rule_ == nullptr) {
       return nullptr;
     }
-    if (m_document_ != nullptr
-      && visible_range.line_count > 0
-      && visible_range.start_line < m_document_->getLineCount()) {
-      size_t end_line = visible_range.start_line + visible_range.line_count - 1;
-      ensureAnalyzedThrough(end_line);
+    return analyzeVisibleSlice(visible_range);
+  }
+
+  SharedPtr<DocumentHighlightSlice> InternalDocumentAnalyzer::analyzeVisibleSlice(const LineRange& visible_range) {
+    SharedPtr<DocumentHighlightSlice> slice = analyzeFromSyncPoint(visible_range);
+    if (slice != nullptr) {
+      return slice;
     }
+    ensureAnalyzedInLineRange(visible_range);
     return buildValidSlice(visible_range);
   }
 
+  SharedPtr<DocumentHighlightSlice> InternalDocumentAnalyzer::analyzeFromSyncPoint(const LineRange& visible_range) {
+    const size_t sync_distance = m_config_.sync_distance;
+    if (sync_distance == 0 || m_rule_->sync_rules.empty() || m_document_ == nullptr) {
+      return nullptr;
+    }
+    const size_t total_line_count = m_document_->getLineCount();
+    const size_t start_line = visible_range.start_line;
+    // Close enough to the analyzed lines, the exact analysis costs no more than starting from a sync point
+    if (visible_range.line_count == 0 || start_line >= total_line_count
+      || start_line - std::min(start_line, m_valid_line_count_) <= sync_distance) {
+      return nullptr;
+    }
+    const size_t end_line = start_line + std::min(visible_range.line_count, total_line_count - start_line);
+
+    // Lines analyzed from an earlier sync point are extended as long as it is still close enough
+    if (m_provisional_.lines.empty() || m_provisional_.start_line > start_line
+      || start_line - m_provisional_.start_line > sync_distance) {
+      const size_t lowest_line = start_line - sync_distance + 1;
+      const size_t free_end = m_sync_free_lines_.start_line + m_sync_free_lines_.line_count;
+      int32_t sync_state = -1;
+      size_t sync_line = start_line + 1;
+      while (sync_line > lowest_line && sync_state < 0) {
+        --sync_line;
+        if (sync_line >= m_sync_free_lines_.start_line && sync_line < free_end) {
+          // Scrolling through lines without a sync point does not match them again every frame
+          sync_line = std::max(m_sync_free_lines_.start_line, lowest_line);
+          continue;
+        }
+        sync_state = m_rule_->matchSyncState(m_document_->getLine(sync_line).text);
+      }
+      rememberSyncFreeLines(sync_state < 0 ? sync_line : sync_line + 1, start_line + 1);
+      if (sync_state < 0) {
+        return nullptr;
+      }
+      m_provisional_ = ProvisionalLines();
+      m_provisional_.start_line = sync_line;
+      m_provisional_.start_state = sync_state;
+    }
+    size_t line = m_provisional_.start_line + m_provisional_.lines.size();
+    size_t line_start_index = line < end_line ? m_document_->charIndexOfLine(line) : 0;
+    LineAnalyzeResult result;
+    for (; line < end_line; ++line) {
+      const DocumentLine& document_line = m_document_->getLine(line);
+      int32_t start_state = m_provisional_.end_states.empty()
+        ? m_provisional_.start_state : m_provisional_.end_states.back();
+      TextLineInfo info = {line, start_state, line_start_index};
+      if (isLongLine(document_line)) {
+        // Like in the exact analysis, the spans of a long line only come from column windows
+        m_line_highlight_analyzer_->analyzeLineState(document_line.text, info, result);
+      } else {
+        m_line_highlight_analyzer_->analyzeLine(document_line.text, info, result);
+      }
+      m_provisional_.lines.push_back(result.highlight);
+      m_provisional_.end_states.push_back(result.end_state);
+      line_start_index += result.char_count + Document::getLineEndingWidth(document_line.ending);
+    }
+
+    auto slice = makeSharedPtr<DocumentHighlightSlice>();
+    slice->start_line = start_line;
+    slice->total_line_count = total_line_count;
+    slice->provisional = true;
+    const size_t offset = start_line - m_provisional_.start_line;
+    slice->lines.assign(m_provisional_.lines.begin() + static_cast<ptrdiff_t>(offset),
+      m_provisional_.lines.begin() + static_cast<ptrdiff_t>(offset + end_line - start_line));
+    return slice;
+  }
+
+  void InternalDocumentAnalyzer::rememberSyncFreeLines(size_t start_line, size_t end_line) {
+    if (start_line >= end_line) {
+      return;
+    }
+    const size_t free_end = m_sync_free_lines_.start_line + m_sync_free_lines_.line_count;
+    if (m_sync_free_lines_.line_count > 0 && start_line <= free_end && end_line >= m_sync_free_lines_.start_line) {
+      start_line = std::min(start_line, m_sync_free_lines_.start_line);
+      end_line = std::max(end_line, free_end);
+    }
+    m_sync_free_lines_ = {start_line, end_line - start_line};
+  }
+
+  SharedPtr<DocumentHighlightSlice> InternalDocumentAnalyzer::analyzeHighlightLineRange(const LineRange& visible_range,
+    const ColumnRange& visible_columns) {
+    if (m_rule_ == nullptr) {
+      return nullptr;
+    }
+    auto slice = makeSharedPtr<DocumentHighlightSlice>();
+    if (m_document_ == nullptr) {
+      return slice;
+    }
+    const size_t total_line_count = m_document_->getLineCount();
+    slice->total_line_count = total_line_count;
+    slice->start_line = std::min(visible_range.start_line, total_line_count);
+    if (visible_range.line_count == 0 || slice->start_line >= total_line_count) {
+      return slice;
+    }
+    const size_t end_line = slice->start_line + std::min(visible_range.line_count, total_line_count - slice->start_line);
+    const size_t start_column = visible_columns.start_column;
+    const size_t end_column = visible_columns.column_count > LineHighlightAnalyzer::kLineEnd - start_column
+      ? LineHighlightAnalyzer::kLineEnd : start_column + visible_columns.column_count;
+    const auto outside_columns = [start_column, end_column](const TokenSpan& span) {
+      return span.range.end.column <= start_column || span.range.start.column >= end_column;
+    };
+
+    slice->lines.resize(end_line - slice->start_line);
+    LineAnalyzeResult result;
+    for (size_t line = slice->start_line; line < end_line; ++line) {
+      const DocumentLine& document_line = m_document_->getLine(line);
+      List<TokenSpan>& spans = slice->lines[line - slice->start_line].spans;
+      if (!isLongLine(document_line)) {
+        ensureAnalyzedInLineRange({line, 1});
+        expandLine(line, m_document_->charIndexOfLine(line), slice->lines[line - slice->start_line]);
+        spans.erase(std::remove_if(spans.begin(), spans.end(), outside_columns), spans.end());
+        continue;
+      }
+      // A long line only needs its start state, the window is analyzed from the nearest checkpoint
+      if (line > 0) {
+        advanceAnalysisThrough(line - 1, line);
+      }
+      int32_t start_state = line == 0 ? SyntaxRule::kDefaultStateId : m_line_syntax_states_[line - 1];
+      TextLineInfo info = {line, start_state, m_document_->charIndexOfLine(line)};
+      result.highlight.spans.clear();
+      m_line_highlight_analyzer_->analyzeLineWindow(document_line.text, info, start_column, end_column,
+        getLongLineCheckpoints(line), result);
+      spans = std::move(result.highlight.spans);
+      spans.erase(std::remove_if(spans.begin(), spans.end(), outside_columns), spans.end());
+    }
+    return slice;
+  }
+
   SharedPtr<DocumentHighlight> InternalDocumentAnalyzer::analyzeHighlightIncremental(const TextRange& range, const U8String& new_text) {
     if (m_rule_ == nullptr) {
       return nullptr;
     }
-    size_t old_end_line = range.end.line;
-    PatchResult patch_result = m_document_->patch(range, new_text);
-    size_t change_start_line = range.start.line;
-    syncCachedLinesAfterPatch(change_start_line, old_end_line, patch_result.line_delta, patch_result.char_delta);
-    invalidateAnalysisFrom(change_start_line);
-    invalidateIndentGuidesFrom(change_start_line);
-    invalidateBracketPairsFrom(change_start_line);
+    applyPatch(range, new_text);
     if (m_document_ != nullptr && m_document_->getLineCount() > 0) {
       ensureAnalyzedThrough(m_document_->getLineCount() - 1);
     }
-    return m_highlight_;
+    return buildDocumentHighlight();
   }
 
   SharedPtr<DocumentHighlight> InternalDocumentAnalyzer::analyzeHighlightIncremental(size_t start_index, size_t end_index, const U8String& new_text) {
@@ -962,26 +2109,46 @@ namespace NS_SWEETLINE {
     if (m_rule_ == nullptr) {
       return nullptr;
     }
-    size_t old_end_line = range.end.line;
-    PatchResult patch_result = m_document_->patch(range, new_text);
-    size_t change_start_line = range.start.line;
-    syncCachedLinesAfterPatch(change_start_line, old_end_line, patch_result.line_delta, patch_result.char_delta);
-    invalidateAnalysisFrom(change_start_line);
-    invalidateIndentGuidesFrom(change_start_line);
-    invalidateBracketPairsFrom(change_start_line);
-    if (m_document_ != nullptr
-      && visible_range.line_count > 0
-      && visible_range.start_line < m_document_->getLineCount()) {
-      size_t end_line = visible_range.start_line + visible_range.line_count - 1;
-      ensureAnalyzedThrough(end_line);
+    applyPatch(range, new_text);
+    return analyzeVisibleSlice(visible_range);
+  }
+
+  SharedPtr<DocumentHighlight> InternalDocumentAnalyzer::analyzeHighlightIncrementalBatch(const List<TextEdit>& edits) {
+    if (m_rule_ == nullptr) {
+      return nullptr;
     }
-    return buildValidSlice(visible_range);
+    applyPatches(edits);
+    if (m_document_ != nullptr && m_document_->getLineCount() > 0) {
+      ensureAnalyzedThrough(m_document_->getLineCount() - 1);
+    }
+    return buildDocumentHighlight();
+  }
+
+  SharedPtr<DocumentHighlightSlice> InternalDocumentAnalyzer::analyzeHighlightIncrementalBatchInLineRange(
+    const List<TextEdit>& edits, const LineRange& visible_range) {
+    if (m_rule_ == nullptr) {
+      return nullptr;
+    }
+    applyPatches(edits);
+    return analyzeVisibleSlice(visible_range);
   }
 
-  SharedPtr<DocumentHighlightSlice> InternalDocumentAnalyzer::getHighlightSlice(const LineRange& visible_range) const {
+  void InternalDocumentAnalyzer::materializeLineRange(const LineRange& visible_range) {
+    if (visible_range.line_count > 0 && visible_range.start_line < m_valid_line_count_) {
+      size_t line_count = std::min(visible_range.line_count, m_valid_line_count_ - visible_range.start_line);
+      materializePendingLines(visible_range.start_line, visible_range.start_line + line_count - 1);
+    }
+  }
+
+  SharedPtr<DocumentHighlightSlice> InternalDocumentAnalyzer::getHighlightSlice(const LineRange& visible_range) {
+    materializeLineRange(visible_range);
     return buildValidSlice(visible_range);
   }
 
+  const PackedHighlightStore& InternalDocumentAnalyzer::getPackedHighlight() const {
+    return m_highlight_;
+  }
+
   SharedPtr<Document> InternalDocumentAnalyzer::getDocument() const {
     return m_document_;
   }
@@ -1020,7 +2187,9 @@ namespace NS_SWEETLINE {
 
   // ===================================== DocumentAnalyzer ============================================
   DocumentAnalyzer::DocumentAnalyzer(const SharedPtr<Document>& document, const SharedPtr<SyntaxRule>& rule,
-    const HighlightConfig& config): analyzer_impl_(makeUniquePtr<InternalDocumentAnalyzer>(document, rule, config)) {
+    const HighlightConfig& config, const SharedPtr<LineAnalyzeCache>& line_cache,
+    const SharedPtr<AnalyzeBudgetCounters>& budget_counters)
+    : analyzer_impl_(makeUniquePtr<InternalDocumentAnalyzer>(document, rule, config, line_cache, budget_counters)) {
   }
 
   SharedPtr<DocumentHighlight> DocumentAnalyzer::analyze() const {
@@ -1031,6 +2200,11 @@ namespace NS_SWEETLINE {
     return analyzer_impl_->analyzeHighlightLineRange(visible_range);
   }
 
+  SharedPtr<DocumentHighlightSlice> DocumentAnalyzer::analyzeLineRange(const LineRange& visible_range,
+    const ColumnRange& visible_columns) const {
+    return analyzer_impl_->analyzeHighlightLineRange(visible_range, visible_columns);
+  }
+
   SharedPtr<DocumentHighlight> DocumentAnalyzer::analyzeIncremental(const TextRange& range, const U8String& new_text) const {
     return analyzer_impl_->analyzeHighlightIncremental(range, new_text);
   }
@@ -1040,6 +2214,15 @@ namespace NS_SWEETLINE {
     return analyzer_impl_->analyzeHighlightIncrementalInLineRange(range, new_text, visible_range);
   }
 
+  SharedPtr<DocumentHighlight> DocumentAnalyzer::analyzeIncrementalBatch(const List<TextEdit>& edits) const {
+    return analyzer_impl_->analyzeHighlightIncrementalBatch(edits);
+  }
+
+  SharedPtr<DocumentHighlightSlice> DocumentAnalyzer::analyzeIncrementalBatchInLineRange(
+    const List<TextEdit>& edits, const LineRange& visible_range) const {
+    return analyzer_impl_->analyzeHighlightIncrementalBatchInLineRange(edits, visible_range);
+  }
+
   SharedPtr<DocumentHighlightSlice> DocumentAnalyzer::getHighlightSlice(const LineRange& visible_range) const {
     return analyzer_impl_->getHighlightSlice(visible_range);
   }
@@ -1072,9 +2255,14 @@ namespace NS_SWEETLINE {
     return analyzer_impl_->analyzeBracketPairsInLineRange(visible_range);
   }
 
+  InternalDocumentAnalyzer& getInternalDocumentAnalyzer(const DocumentAnalyzer& analyzer) {
+    return *analyzer.analyzer_impl_;
+  }
+
   // ===================================== HighlightEngine ============================================
   HighlightEngine::HighlightEngine(const HighlightConfig& config): m_config_(config) {
     m_style_mapping_ = makeSharedPtr<StyleMapping>();
+    m_budget_counters_ = makeSharedPtr<AnalyzeBudgetCounters>();
   }
 
   void HighlightEngine::defineMacro(const U8String& macro_name) {
@@ -1090,16 +2278,18 @@ namespace NS_SWEETLINE {
   }
 
   SharedPtr<SyntaxRule> HighlightEngine::compileSyntaxFromJson(const U8String& json) {
-    UniquePtr<SyntaxRuleCompiler> compiler = makeUniquePtr<SyntaxRuleCompiler>(m_style_mapping_, m_config_.inline_style, this);
+    UniquePtr<SyntaxRuleCompiler> compiler = makeUniquePtr<SyntaxRuleCompiler>(m_style_mapping_, m_config_.inline_style, this,
+      m_config_.use_rule_scanner);
     SharedPtr<SyntaxRule> rule = compiler->compileSyntaxFromJson(json);
-    m_syntax_rules_.emplace(rule);
+    registerSyntaxRule(rule);
     return rule;
   }
 
   SharedPtr<SyntaxRule> HighlightEngine::compileSyntaxFromFile(const U8String& file) {
-    UniquePtr<SyntaxRuleCompiler> compiler = makeUniquePtr<SyntaxRuleCompiler>(m_style_mapping_, m_config_.inline_style, this);
+    UniquePtr<SyntaxRuleCompiler> compiler = makeUniquePtr<SyntaxRuleCompiler>(m_style_mapping_, m_config_.inline_style, this,
+      m_config_.use_rule_scanner);
     SharedPtr<SyntaxRule> rule = compiler->compileSyntaxFromFile(file);
-    m_syntax_rules_.emplace(rule);
+    registerSyntaxRule(rule);
     return rule;
   }
 
@@ -1130,7 +2320,7 @@ namespace NS_SWEETLINE {
     if (rule == nullptr) {
       return nullptr;
     }
-    return makeSharedPtr<TextAnalyzer>(rule, m_config_);
+    return createTextAnalyzer(rule);
   }
 
   SharedPtr<TextAnalyzer> HighlightEngine::createAnalyzerByFileName(const U8String& file_name) const {
@@ -1138,7 +2328,7 @@ namespace NS_SWEETLINE {
     if (rule == nullptr) {
       return nullptr;
     }
-    return makeSharedPtr<TextAnalyzer>(rule, m_config_);
+    return createTextAnalyzer(rule);
   }
 
   SharedPtr<DocumentAnalyzer> HighlightEngine::loadDocument(const SharedPtr<Document>& document) {
@@ -1149,7 +2339,8 @@ namespace NS_SWEETLINE {
       if (rule == nullptr) {
         return nullptr;
       }
-      SharedPtr<DocumentAnalyzer> analyzer = SharedPtr<DocumentAnalyzer>(new DocumentAnalyzer(document, rule, m_config_));
+      SharedPtr<DocumentAnalyzer> analyzer = SharedPtr<DocumentAnalyzer>(
+        new DocumentAnalyzer(document, rule, m_config_, getLineCache(rule), m_budget_counters_));
       m_analyzer_map_.insert_or_assign(uri, analyzer);
       return analyzer;
     } else {
@@ -1160,4 +2351,45 @@ namespace NS_SWEETLINE {
   void HighlightEngine::removeDocument(const U8String& uri) {
     m_analyzer_map_.erase(uri);
   }
+
+  LineCacheStats HighlightEngine::getLineCacheStats() const {
+    LineCacheStats total;
+    for (const auto& [rule, cache] : m_line_caches_) {
+      LineCacheStats stats = cache->getStats();
+      total.hits += stats.hits;
+      total.misses += stats.misses;
+      total.size += stats.size;
+      total.capacity += stats.capacity;
+    }
+    return total;
+  }
+
+  void HighlightEngine::clearLineCache() {
+    for (const auto& [rule, cache] : m_line_caches_) {
+      cache->clear();
+    }
+  }
+
+  AnalyzeBudgetStats HighlightEngine::getAnalyzeBudgetStats() const {
+    AnalyzeBudgetStats stats;
+    stats.time_budget_exceeded = m_budget_counters_->time_budget_exceeded.load(std::memory_order_relaxed);
+    stats.regex_limit_exceeded = m_budget_counters_->regex_limit_exceeded.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  void HighlightEngine::registerSyntaxRule(const SharedPtr<SyntaxRule>& rule) {
+    m_syntax_rules_.emplace(rule);
+    if (m_config_.line_cache_capacity > 0) {
+      m_line_caches_.insert_or_assign(rule, makeSharedPtr<LineAnalyzeCache>(m_config_.line_cache_capacity));
+    }
+  }
+
+  SharedPtr<LineAnalyzeCache> HighlightEngine::getLineCache(const SharedPtr<SyntaxRule>& rule) const {
+    auto it = m_line_caches_.find(rule);
+    return it == m_line_caches_.end() ? nullptr : it->second;
+  }
+
+  SharedPtr<TextAnalyzer> HighlightEngine::createTextAnalyzer(const SharedPtr<SyntaxRule>& rule) const {
+    return SharedPtr<TextAnalyzer>(new TextAnalyzer(rule, m_config_, getLineCache(rule), m_budget_counters_));
+  }
 }
@@ -59,7 +59,10 @@ namespace NS_SWEETLINE {
       return text.empty() || text.find_first_not_of(" \t") == U8String::npos;
     }
 
-    int32_t toColumn(const U8String& text, size_t byte_pos) {
+    int32_t toColumn(const U8String& text, size_t byte_pos, bool ascii_line) {
+      if (ascii_line) {
+        return static_cast<int32_t>(byte_pos);
+      }
       return static_cast<int32_t>(Utf8Util::bytePosToCharPos(text, byte_pos));
     }
 
@@ -292,6 +295,7 @@ namespace NS_SWEETLINE {
 
     const U8String& text = m_document_->getLine(line).text;
     const bool blank_line = isBlankLine(text);
+    const bool ascii_line = Utf8Util::isAscii(text);
     const int32_t indent_column = blank_line ? -1 : computeLeadingWhitespace(text, m_config_.tab_size);
     const int32_t indent_char_column = blank_line ? -1 : leadingWhitespaceColumn(text);
     const bool visible = context != nullptr && line >= context->visible_start && line <= context->visible_end;
@@ -470,7 +474,7 @@ namespace NS_SWEETLINE {
         if (!matchesRuleToken(text, byte_pos, scope.rule->end, scope.kind)) {
           continue;
         }
-        const int32_t token_column = toColumn(text, byte_pos);
+        const int32_t token_column = toColumn(text, byte_pos, ascii_line);
         const size_t token_size = scope.rule->end.size();
         if (visible) {
           LineScopeState& line_state = context->result->line_states[visible_index];
@@ -496,7 +500,7 @@ namespace NS_SWEETLINE {
           if (!matchesBranchToken(text, byte_pos, branch)) {
             continue;
           }
-          const int32_t token_column = toColumn(text, byte_pos);
+          const int32_t token_column = toColumn(text, byte_pos, ascii_line);
           IndentGuideLine::BranchPoint branch_point {static_cast<int32_t>(line), token_column};
           scope.branches.push_back(branch_point);
           if (visible && scope.guide_index >= 0) {
@@ -518,7 +522,7 @@ namespace NS_SWEETLINE {
         if (!matchesRuleToken(text, byte_pos, scope_rule->start, scope_rule->kind)) {
           continue;
         }
-        const int32_t token_column = toColumn(text, byte_pos);
+        const int32_t token_column = toColumn(text, byte_pos, ascii_line);
         ActiveScope scope;
         scope.rule = scope_rule;
         scope.kind = scope_rule->kind;
@@ -0,0 +1,166 @@
+#ifndef SWEETLINE_INTERNAL_DFA_H
+#define SWEETLINE_INTERNAL_DFA_H
+
+#include <array>
+#include <cstdint>
+#include "sweetline/macro.h"
+#include "internal_pattern.h"
+
+namespace NS_SWEETLINE {
+  /// Opcode of a RegularProgram instruction
+  enum struct RegularOpcode : int8_t {
+    /// Consume one byte of the set, then continue at next
+    BYTE_SET = 0,
+    /// Continue at both next and alt
+    SPLIT,
+    /// Continue at next
+    JUMP,
+    /// Continue at next when the assertion holds
+    ASSERT,
+    /// A match ends here
+    MATCH
+  };
+
+  /// Zero-width assertion of a RegularProgram, resolved from the characters around the position
+  enum struct RegularAssertion : int8_t {
+    TEXT_START = 0,
+    TEXT_END,
+    WORD_BOUNDARY,
+    NOT_WORD_BOUNDARY
+  };
+
+  struct RegularInstruction {
+    RegularOpcode opcode {RegularOpcode::MATCH};
+    RegularAssertion assertion {RegularAssertion::TEXT_START};
+    int32_t next {-1};
+    int32_t alt {-1};
+    /// Byte set index in RegularProgram, BYTE_SET only
+    int32_t byte_set {-1};
+  };
+
+  /// Thompson NFA of the alternatives of a merged state pattern, for single-line ASCII text.
+  /// On such text the parsed pattern model is exact: \n never occurs, so ^ and \A, $, \z and \Z coincide,
+  /// and no character outside ASCII has to be classified. Whether a match starts at a position does not
+  /// depend on alternative order or greediness, which is all the DFA has to decide.
+  /// The program holds the alternatives twice: forwards, and backwards from a match end towards its start.
+  class RegularProgram {
+  public:
+    /// Compile the alternatives of a merged pattern
+    /// @return nullptr when some alternative uses a construct that is not regular (backreferences,
+    ///   lookaround, atomic groups, possessive repeats, \G...) or the program would be too large
+    static UniquePtr<RegularProgram> compile(const List<const PatternTree*>& alternatives);
+
+    int32_t startPc() const;
+
+    /// Entry of the reversed alternatives, which read the text from right to left
+    int32_t reverseStartPc() const;
+
+    const RegularInstruction& instruction(int32_t pc) const;
+
+    size_t instructionCount() const;
+
+    bool byteSetContains(int32_t byte_set, uint8_t byte) const;
+
+    /// Number of byte classes, ASCII bytes of one class are never told apart by the program
+    int32_t byteClassCount() const;
+
+    /// Byte class of an ASCII byte
+    int32_t byteClass(uint8_t byte) const;
+
+    /// Representative ASCII byte of a byte class
+    uint8_t classByte(int32_t byte_class) const;
+  private:
+    List<RegularInstruction> m_instructions_;
+    List<AsciiSet> m_byte_sets_;
+    int32_t m_start_pc_ {-1};
+    int32_t m_reverse_start_pc_ {-1};
+    std::array<uint8_t, 128> m_byte_classes_ {};
+    List<uint8_t> m_class_bytes_;
+
+    friend class RegularProgramBuilder;
+  };
+
+  /// DFA over a RegularProgram, built lazily while matching. The program may be shared; a LazyDfa holds
+  /// the transition cache, so each instance must only be used by one thread at a time.
+  /// A search is one unanchored forward pass that finds the end of a match starting leftmost, then one
+  /// backward pass from that end to the start, so it reads every byte at most twice.
+  class LazyDfa {
+  public:
+    enum struct SearchStatus : int8_t {
+      FOUND = 0,
+      NOT_FOUND,
+      /// The transition cache overflowed too often, the caller has to search with Oniguruma
+      GAVE_UP
+    };
+
+    explicit LazyDfa(const RegularProgram* program);
+
+    /// Find the leftmost position in [from, text_size] where a match starts
+    /// @param text Single-line ASCII text, assertions see it as the whole string
+    /// @param match_start Receives the match start
+    SearchStatus findMatchStart(const char* text, size_t text_size, size_t from, size_t& match_start);
+  private:
+    /// Transition value of a state that was not computed yet
+    static constexpr int32_t kUnknown = -1;
+    /// Index of the state without any thread
+    static constexpr int32_t kDeadState = 0;
+
+    struct State {
+      /// Program counters of the threads before their epsilon closure. Forwards they are ordered by the
+      /// position their match started at, earliest first; backwards they are sorted
+      List<int32_t> pcs;
+      /// Whether the character already read is a word character
+      bool after_word {false};
+      /// Whether nothing was read yet and the state is at the edge of the text it reads from
+      bool at_start {false};
+      /// Forwards only: whether a match may still start at the current position
+      bool searching {false};
+    };
+
+    /// Transition cache of one reading direction
+    struct Automaton {
+      bool forward {true};
+      int32_t start_pc {-1};
+      /// Per state, byteClassCount() + 1 transitions (the last one for the edge of the text),
+      /// each (next state << 1) | whether a match ends before the transition's character
+      List<int32_t> transitions;
+      List<State> states;
+      HashMap<U8String, int32_t> state_index;
+      /// Start state by context: 0 at the text edge, 1 next to a non-word character, 2 next to a word character
+      std::array<int32_t, 3> start_states {};
+    };
+
+    enum struct PassStatus : int8_t {
+      DONE = 0,
+      /// The cache was flushed under the pass, its state indexes are gone
+      FLUSHED
+    };
+
+    const RegularProgram* m_program_;
+    Automaton m_forward_;
+    Automaton m_backward_;
+    size_t m_flush_count_ {0};
+    /// Scratch buffers of the epsilon closure
+    List<int32_t> m_stack_;
+    List<int32_t> m_next_pcs_;
+    List<uint32_t> m_visit_marks_;
+    uint32_t m_visit_generation_ {0};
+
+    void reset(Automaton& automaton);
+    /// Index of the state, added if new; kUnknown when the cache was flushed to make room
+    int32_t findOrAddState(Automaton& automaton, const List<int32_t>& pcs, bool after_word, bool at_start,
+      bool searching);
+    int32_t startState(Automaton& automaton, size_t context);
+    /// Transition of a state, kUnknown when the cache was flushed meanwhile
+    int32_t computeTransition(Automaton& automaton, int32_t state_index, int32_t input_class);
+    int32_t transition(Automaton& automaton, int32_t state_index, int32_t input_class);
+    /// Read forwards from a position, match_end receives the end of a match that starts leftmost, if any
+    PassStatus findLeftmostMatchEnd(const char* text, size_t text_size, size_t from, bool& found,
+      size_t& match_end);
+    /// Read backwards from a match end, match_start receives the leftmost start in [from, end] matching up to it
+    PassStatus findMatchStartBefore(const char* text, size_t text_size, size_t from, size_t end, bool& found,
+      size_t& match_start);
+  };
+}
+
+#endif //SWEETLINE_INTERNAL_DFA_H
@@ -1,6 +1,11 @@
 #ifndef SWEETLINE_INTERNAL_HIGHLIGHT_H
 #define SWEETLINE_INTERNAL_HIGHLIGHT_H
 
+#include <atomic>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 #include "sweetline/highlight.h"
 #include "internal_syntax.h"
 
@@ -24,6 +29,10 @@ namespace NS_SWEETLINE {
     size_t start {0};
     /// Matched character length
     size_t length {0};
+    /// Matched start byte position
+    size_t start_byte {0};
+    /// Matched end byte position (exclusive)
+    size_t end_byte {0};
     /// Current state
     int32_t state {-1};
     /// Index of the matched token rule
@@ -38,40 +47,322 @@ namespace NS_SWEETLINE {
     U8String matched_text;
     /// All matched capture groups
     List<CaptureGroupMatch> capture_groups;
+
+    /// Reset to the unmatched state while keeping buffer capacity
+    void reset();
+  };
+
+  /// Reusable matching buffers for one subState nesting level
+  struct MatchScratchFrame {
+    /// Nesting level, 0 for the line itself
+    size_t depth {0};
+    /// Whether the text matched at this level is pure ASCII, so byte and char positions coincide
+    bool ascii_text {false};
+    /// Whether the text is ASCII without line breaks, which is what a state's RegularProgram can match
+    bool single_line_ascii {false};
+    /// Whether matches only need their bounds and rule, because no span is built from them: capture groups,
+    /// subState matches and matched text are skipped, none of them can change the state
+    bool bounds_only {false};
+    /// Region reused by every search at this level
+    OnigRegion* region {nullptr};
+    /// Match result reused by every search at this level
+    MatchResult result;
+    /// Rule scanner cache (HighlightConfig::use_rule_scanner) of one state over one text: the next match start of
+    /// each alternative at or after the position it was searched from, ONIG_MISMATCH when none is left,
+    /// kUnsearched before the first search
+    int32_t scanner_state {-1};
+    const char* scanner_text_begin {nullptr};
+    const char* scanner_text_end {nullptr};
+    List<int> scanner_starts;
+
+    static constexpr int kUnsearched = std::numeric_limits<int>::min();
+
+    explicit MatchScratchFrame(size_t depth, int32_t group_count);
+    MatchScratchFrame(const MatchScratchFrame&) = delete;
+    MatchScratchFrame& operator=(const MatchScratchFrame&) = delete;
+    ~MatchScratchFrame();
+  };
+
+  /// Bounded LRU cache of line analysis results keyed by line text and start state, shared by every analyzer of
+  /// one syntax rule. Spans are stored relative to their line (line 0, indexes from the line start) and rebased
+  /// on lookup. Lookups and stores may come from several threads.
+  class LineAnalyzeCache {
+  public:
+    explicit LineAnalyzeCache(size_t capacity);
+
+    /// Fill result from the cache
+    /// @return Whether the line was cached
+    bool lookup(U8StringView text, const TextLineInfo& info, LineAnalyzeResult& result);
+
+    /// Cache the analysis result of a line, evicting the least recently used line when full
+    void store(U8StringView text, const TextLineInfo& info, const LineAnalyzeResult& result);
+
+    void clear();
+
+    LineCacheStats getStats() const;
+  private:
+    struct Entry {
+      size_t hash {0};
+      U8String text;
+      int32_t start_state {0};
+      LineHighlight highlight;
+      int32_t end_state {0};
+      size_t char_count {0};
+    };
+    using EntryList = std::list<Entry>;
+
+    size_t m_capacity_ {0};
+    /// Most recently used first
+    EntryList m_entries_;
+    std::unordered_multimap<size_t, EntryList::iterator> m_index_;
+    size_t m_hits_ {0};
+    size_t m_misses_ {0};
+    mutable std::mutex m_mutex_;
+
+    static size_t hashKey(U8StringView text, int32_t start_state);
+    EntryList::iterator find(size_t hash, U8StringView text, int32_t start_state);
+  };
+
+  /// Engine-wide counters behind AnalyzeBudgetStats, updated by analyzers on any thread
+  struct AnalyzeBudgetCounters {
+    std::atomic<size_t> time_budget_exceeded {0};
+    std::atomic<size_t> regex_limit_exceeded {0};
+  };
+
+  /// Cursor of the token loop inside a line, analysis can resume from it
+  struct LineCheckpoint {
+    size_t byte_pos {0};
+    size_t char_pos {0};
+    int32_t state {SyntaxRule::kDefaultStateId};
+  };
+
+  /// Resume points of a line longer than HighlightConfig::long_line_threshold, analyzed in column windows
+  struct LongLineCheckpoints {
+    /// Start state the checkpoints were computed from
+    int32_t start_state {SyntaxRule::kDefaultStateId};
+    bool ascii_text {false};
+    bool single_line_ascii {false};
+    /// Checkpoints in column order, at least HighlightConfig::long_line_window characters apart, the first one at the line start
+    List<LineCheckpoint> checkpoints;
+    /// Whether some window reached the line end; end_state and char_count are only valid then
+    bool complete {false};
+    int32_t end_state {SyntaxRule::kDefaultStateId};
+    size_t char_count {0};
   };
 
   /// Single line text syntax analysis
+  /// Holds reusable matching buffers, so one instance must not analyze lines from several threads at once
   class LineHighlightAnalyzer {
   public:
+    /// Column past every line end
+    static constexpr size_t kLineEnd = std::numeric_limits<size_t>::max();
+
     LineHighlightAnalyzer(const SharedPtr<SyntaxRule>& syntax_rule,
-      const HighlightConfig& config = HighlightConfig::kDefault);
+      const HighlightConfig& config = HighlightConfig::kDefault, const SharedPtr<LineAnalyzeCache>& line_cache = nullptr,
+      const SharedPtr<AnalyzeBudgetCounters>& budget_counters = nullptr);
+    LineHighlightAnalyzer(const LineHighlightAnalyzer&) = delete;
+    LineHighlightAnalyzer& operator=(const LineHighlightAnalyzer&) = delete;
+    ~LineHighlightAnalyzer();
 
     /// Analyze a line by passing the line number and corresponding text
     /// @param text Line text content
     /// @param info Metadata including start highlight state and line number
-    /// @param result Highlight result, receives analysis output
+    /// @param result Highlight result, receives analysis output. Its previous spans are replaced, a result reused
+    ///   across lines keeps its capacity, so analyzing a line allocates nothing once the analyzer is warm
     /// @return Some information after analysis for subsequent use
-    void analyzeLine(const U8String& text, const TextLineInfo& info, LineAnalyzeResult& result) const;
+    void analyzeLine(U8StringView text, const TextLineInfo& info, LineAnalyzeResult& result) const;
+
+    /// Analyze a line for its end state and character count only, result.highlight is left empty
+    void analyzeLineState(U8StringView text, const TextLineInfo& info, LineAnalyzeResult& result) const;
+
+    /// Analyze the columns [start_column, end_column) of a long line, resuming from the last checkpoint at or before
+    /// start_column and stopping once the cursor reaches end_column. Spans of the tokens that end after start_column
+    /// are appended to result.highlight, and checkpoints are recorded along the way. Pass kLineEnd as both columns
+    /// to only compute the line end.
+    /// @param checkpoints Resume points of the line, recomputed when they come from another start state
+    /// @return Whether the line end was reached; result.end_state and result.char_count are only set then
+    bool analyzeLineWindow(U8StringView text, const TextLineInfo& info, size_t start_column, size_t end_column,
+      LongLineCheckpoints& checkpoints, LineAnalyzeResult& result) const;
 
     /// Get the currently configured highlight options
     const HighlightConfig& getHighlightConfig() const;
   private:
     SharedPtr<SyntaxRule> m_rule_;
     HighlightConfig m_config_;
+    /// Engine-wide cache of analyzed lines, nullptr when disabled
+    SharedPtr<LineAnalyzeCache> m_line_cache_;
+    /// Engine-wide truncation counters, nullptr outside an engine
+    SharedPtr<AnalyzeBudgetCounters> m_budget_counters_;
+    /// Retry and stack limits of every regex search, nullptr when HighlightConfig sets none
+    OnigMatchParam* m_match_param_ {nullptr};
+    /// Set when a regex search of the current line ran over a limit, which ends the line's analysis
+    mutable bool m_regex_limit_hit_ {false};
+    /// Scratch buffers by subState depth, grown on demand and reused across lines
+    mutable List<UniquePtr<MatchScratchFrame>> m_match_frames_;
+    /// DFAs of the states that have a RegularProgram, built on first use
+    mutable HashMap<int32_t, UniquePtr<LazyDfa>> m_lazy_dfas_;
+    /// Heap buffers of span texts taken back from replaced results, handed out to new spans
+    mutable List<U8String> m_spare_texts_;
+    int32_t m_max_group_count_ {0};
+
+    MatchScratchFrame& getMatchFrame(size_t depth) const;
+
+    LazyDfa& getLazyDfa(int32_t syntax_state, const RegularProgram* program) const;
+
+    /// Search the merged pattern of a state, with the state's DFA when it can locate the match
+    /// @return Oniguruma's byte position of the match, ONIG_MISMATCH, or an error code when a limit was exceeded
+    int searchStateRegex(const StateRule& state_rule, int32_t syntax_state, const char* text_begin,
+      const char* text_end, size_t search_byte_pos, MatchScratchFrame& frame) const;
+
+    /// Find the leftmost match start of a state's alternatives from their cached next matches, searching again
+    /// only the alternatives whose cached match lies before search_byte_pos
+    /// @return Byte position of the match start, ONIG_MISMATCH, or an error code when a limit was exceeded
+    int scanAlternatives(const StateRule& state_rule, int32_t syntax_state, const char* text_begin,
+      const char* text_end, size_t search_byte_pos, MatchScratchFrame& frame) const;
+
+    void analyzeLineText(U8StringView text, const TextLineInfo& info, LineAnalyzeResult& result) const;
+
+    /// Match tokens from cursor until the line end or until the cursor reaches stop_column, leaving the cursor where it
+    /// stopped. Only tokens that end after emit_start produce spans.
+    /// @param checkpoints Receives checkpoints past its last one, nullptr to record none
+    /// @return Whether the line end was reached
+    bool runTokenLoop(U8StringView text, const TextLineInfo& info, LineCheckpoint& cursor, size_t emit_start,
+      size_t stop_column, LongLineCheckpoints* checkpoints, LineAnalyzeResult& result) const;
+
+    /// Apply the line end transition of the state the cursor ended in
+    void finishLine(const LineCheckpoint& cursor, LineAnalyzeResult& result) const;
+
+    /// Match the run of the state's filler rule starting at the cursor, up to the next byte another rule may start
+    /// with, as if the filler had matched each of its characters. The result is written to frame.result
+    /// @param end_column Column the run must not extend past
+    /// @return Whether there was such a run, otherwise the cursor has to go through matchAtPosition
+    bool matchFillerRun(const char* text_begin, const char* text_end, size_t start_byte_pos, size_t start_char_pos,
+      size_t end_column, int32_t syntax_state, MatchScratchFrame& frame) const;
+
+    /// Search for the next token starting at the given cursor, the result is written to frame.result
+    /// @param text_begin Start of the text to match against; for subState matching, the start of the group inside the line
+    /// @param text_end End of the text, anchors such as $ and \z see it as the end of the string
+    /// @param start_byte_pos Byte position of the cursor, relative to text_begin
+    /// @param start_char_pos Character position of the cursor, used as the anchor for char conversion
+    /// @param syntax_state State whose rules are searched
+    /// @param frame Scratch frame of the current nesting level
+    void matchAtPosition(const char* text_begin, const char* text_end, size_t start_byte_pos, size_t start_char_pos,
+      int32_t syntax_state, MatchScratchFrame& frame) const;
+
+    /// Fill the token rule dependent part of frame.result for the rule that produced the match
+    void applyMatchedRule(const TokenRule& token_rule, int32_t rule_idx, const char* text_begin,
+      MatchScratchFrame& frame) const;
+
+    void buildCaptureGroups(const TokenRule& token_rule, const char* text_begin, MatchScratchFrame& frame) const;
+
+    /// Match a subState over the bytes [sub_begin, sub_end) of the buffer being analyzed, without copying them
+    void expandSubStateMatches(const char* sub_begin, const char* sub_end, int32_t sub_state, size_t base_char_offset,
+      int32_t group, size_t depth, List<CaptureGroupMatch>& capture_groups) const;
 
-    MatchResult matchAtPosition(const U8String& text, size_t start_char_pos, int32_t syntax_state) const;
+    void addLineHighlightResult(LineHighlight& highlight, const TextLineInfo& info,
+      int32_t syntax_state, const MatchResult& match_result) const;
 
-    void findMatchedRuleAndGroup(const StateRule& state_rule, const OnigRegion* region,
-      const U8String& text, size_t match_start_byte, size_t match_end_byte, MatchResult& result) const;
+    /// Clear the spans, keeping the heap buffers of their texts for the next spans
+    void recycleSpans(LineHighlight& highlight) const;
 
-    void buildCaptureGroups(const TokenRule& token_rule, const OnigRegion* region,
-      const U8String& text, size_t match_start_byte, size_t match_end_byte, MatchResult& result) const;
+    /// Keep the heap buffer of a span text that is no longer used
+    void recycleText(U8String& text) const;
 
-    void expandSubStateMatches(const U8String& sub_text, int32_t sub_state,
-      size_t base_char_offset, int32_t group, List<CaptureGroupMatch>& capture_groups) const;
+    /// Copy a matched text into a span text, reusing a spare heap buffer when the text does not fit inline
+    void assignSpanText(U8String& span_text, const U8String& matched_text) const;
+  };
 
-    void addLineHighlightResult(LineHighlight& highlight, const TextLineInfo& info,
-      int32_t syntax_state, const MatchResult& match_result) const;
+  /// Lines [old_start, old_start + old_count) of a line table replaced by new_count lines
+  struct LineReplacement {
+    size_t old_start {0};
+    size_t old_count {0};
+    size_t new_count {0};
+  };
+
+  /// Compact highlight storage of a whole document: the spans of every line live in one contiguous buffer,
+  /// addressed through a per-line slot table. Line numbers and character indexes are not stored, they follow
+  /// from the slot position and the document, so inserting or removing lines never touches the spans.
+  /// TokenSpan objects are only rebuilt at API boundaries (see InternalDocumentAnalyzer::expandLine).
+  class PackedHighlightStore {
+  public:
+    /// Packed form of a TokenSpan
+    struct Span {
+      /// Start column in the line
+      uint32_t column {0};
+      /// Length in characters
+      uint32_t length {0};
+      int32_t style_id {0};
+      int32_t state {0};
+      int32_t goto_state {-1};
+    };
+
+    /// @param keep_matched_text Whether matched texts are stored next to the spans
+    explicit PackedHighlightStore(bool keep_matched_text);
+
+    size_t lineCount() const;
+
+    /// Grow or shrink the line table, new lines have no spans
+    void resizeLines(size_t line_count);
+
+    /// Apply sorted, disjoint replacements in one pass over the line table. A replaced range keeps its first
+    /// slots, extra new lines are empty and extra old lines are dropped
+    void replaceLines(const List<LineReplacement>& replacements);
+
+    void clear();
+
+    /// Replace the spans of a line; spans that fit into the line's current slot are written in place,
+    /// otherwise they are appended and the old slot becomes garbage until the next compaction
+    void setLine(size_t line, const LineHighlight& highlight);
+
+    /// Whether the stored line has the same spans (ignoring positions outside the line) as highlight
+    bool isLineReusableWith(size_t line, const LineHighlight& highlight) const;
+
+    size_t spanCount(size_t line) const;
+
+    /// First span of a line, valid until the store is modified
+    const Span* lineSpans(size_t line) const;
+
+    /// Matched text of the index-th span of a line, empty when matched texts are not kept
+    const U8String& matchedText(size_t line, size_t index) const;
+
+    /// Drop the spans of a line whose end state was computed without them, until setLine fills it in
+    void setLinePending(size_t line);
+
+    /// Whether the spans of a line still have to be analyzed
+    bool isLinePending(size_t line) const;
+
+    bool hasPendingLines() const;
+  private:
+    struct LineSlot {
+      uint32_t offset {0};
+      uint32_t count {0};
+      uint32_t capacity {0};
+      bool pending {false};
+    };
+
+    List<Span> m_spans_;
+    /// Parallel to m_spans_, only filled when matched texts are kept
+    List<U8String> m_matched_texts_;
+    List<LineSlot> m_lines_;
+    /// Sum of the span counts of all lines, the rest of m_spans_ is spare slot capacity or garbage
+    size_t m_live_span_count_ {0};
+    size_t m_pending_line_count_ {0};
+    bool m_keep_matched_text_ {false};
+
+    void releaseSlots(size_t begin, size_t end);
+    void compactIfWasteful();
+  };
+
+  /// Lines analyzed from a sync point, ahead of the exact analysis
+  struct ProvisionalLines {
+    /// Sync line, the first analyzed line
+    size_t start_line {0};
+    /// State the sync rule assigned to the sync line
+    int32_t start_state {SyntaxRule::kDefaultStateId};
+    /// Highlights of the lines from start_line on
+    List<LineHighlight> lines;
+    /// End state of each line in lines
+    List<int32_t> end_states;
   };
 
   class ScopeGuideAnalyzer;
@@ -80,12 +371,16 @@ namespace NS_SWEETLINE {
   class InternalDocumentAnalyzer {
   public:
     explicit InternalDocumentAnalyzer(const SharedPtr<Document>& document, const SharedPtr<SyntaxRule>& rule,
-      const HighlightConfig& config = HighlightConfig::kDefault);
+      const HighlightConfig& config = HighlightConfig::kDefault, const SharedPtr<LineAnalyzeCache>& line_cache = nullptr,
+      const SharedPtr<AnalyzeBudgetCounters>& budget_counters = nullptr);
 
     SharedPtr<DocumentHighlight> analyzeHighlight();
 
     SharedPtr<DocumentHighlightSlice> analyzeHighlightLineRange(const LineRange& visible_range);
 
+    SharedPtr<DocumentHighlightSlice> analyzeHighlightLineRange(const LineRange& visible_range,
+      const ColumnRange& visible_columns);
+
     SharedPtr<DocumentHighlight> analyzeHighlightIncremental(const TextRange& range, const U8String& new_text);
 
     SharedPtr<DocumentHighlight> analyzeHighlightIncremental(size_t start_index, size_t end_index, const U8String& new_text);
@@ -93,7 +388,45 @@ namespace NS_SWEETLINE {
     SharedPtr<DocumentHighlightSlice> analyzeHighlightIncrementalInLineRange(const TextRange& range, const U8String& new_text,
       const LineRange& visible_range);
 
-    SharedPtr<DocumentHighlightSlice> getHighlightSlice(const LineRange& visible_range) const;
+    SharedPtr<DocumentHighlight> analyzeHighlightIncrementalBatch(const List<TextEdit>& edits);
+
+    SharedPtr<DocumentHighlightSlice> analyzeHighlightIncrementalBatchInLineRange(const List<TextEdit>& edits,
+      const LineRange& visible_range);
+
+    /// Slice of the cached result; lines that were only fast-forwarded get their spans analyzed first
+    SharedPtr<DocumentHighlightSlice> getHighlightSlice(const LineRange& visible_range);
+
+    /// Analyze the whole document from scratch, leaving the result in the packed store only
+    void analyzeAllLines();
+
+    /// Patch the document and invalidate every cached result from the first changed line on
+    void applyPatch(const TextRange& range, const U8String& new_text);
+
+    /// Apply a batch of non-overlapping edits, moving the cached lines once. Only the changed lines are marked
+    /// dirty, the unchanged lines between them are reused as soon as the analysis reaches them in a stable state
+    void applyPatches(const List<TextEdit>& edits);
+
+    /// Analyze every line up to inclusive_end_line, including the spans of lines that only have their end state
+    void ensureAnalyzedThrough(size_t inclusive_end_line);
+
+    /// Analyze every line of a visible range that is not analyzed yet; lines above the range that are not analyzed
+    /// yet only get their end state
+    void ensureAnalyzedInLineRange(const LineRange& visible_range);
+
+    /// Analyze the spans of the lines of a visible range that were only fast-forwarded, leaving other lines alone
+    void materializeLineRange(const LineRange& visible_range);
+
+    /// Clip a visible range to the lines that are analyzed
+    /// @return Number of lines of the clipped range, starting at start_line
+    size_t clipValidRange(const LineRange& visible_range, size_t& start_line) const;
+
+    const PackedHighlightStore& getPackedHighlight() const;
+
+    /// Inline style of a style ID, nullptr when inline styles are off or the span is unstyled
+    const InlineStyle* getInlineStyle(int32_t style_id) const;
+
+    /// Rebuild the TokenSpans of an analyzed line
+    void expandLine(size_t line, size_t line_start_index, LineHighlight& highlight) const;
 
     SharedPtr<IndentGuideResult> analyzeIndentGuides();
 
@@ -115,20 +448,45 @@ namespace NS_SWEETLINE {
 
     void invalidateBracketPairsFrom(size_t line);
 
-    void syncCachedLinesAfterPatch(size_t change_start_line, size_t old_end_line, int32_t line_delta, int32_t char_delta);
+    /// Move the cached lines to follow sorted, disjoint line replacements and mark the new lines dirty.
+    /// Cached lines past a replacement that reaches the end of the cache are dropped
+    void syncCachedLinesAfterPatch(const List<LineReplacement>& replacements);
+
+    /// Move the caches after a patch and invalidate every result from the first changed line on
+    void invalidateChangedLines(const List<LineReplacement>& replacements);
 
     void ensureCacheSize(size_t line_count);
 
-    void ensureAnalyzedThrough(size_t inclusive_end_line);
+    /// Analyze the lines up to inclusive_end_line that have no end state yet. Lines before first_full_line are
+    /// fast-forwarded: only their end state is computed, and their spans are left pending
+    void advanceAnalysisThrough(size_t inclusive_end_line, size_t first_full_line);
+
+    /// Analyze the spans of the pending lines in [start_line, inclusive_end_line]
+    void materializePendingLines(size_t start_line, size_t inclusive_end_line);
 
     TextPosition resolveCharBoundaryPosition(size_t char_index) const;
 
-    void rebaseReusableTailFrom(size_t start_line, size_t end_line_exclusive);
+    SharedPtr<DocumentHighlight> buildDocumentHighlight() const;
 
     SharedPtr<DocumentHighlightSlice> buildValidSlice(const LineRange& visible_range) const;
 
+    /// Slice of a visible range, analyzed from a sync point when the range starts far past the analyzed lines
+    /// and a sync point is close enough above it, otherwise exactly
+    SharedPtr<DocumentHighlightSlice> analyzeVisibleSlice(const LineRange& visible_range);
+
+    /// Provisional slice analyzed from the nearest sync point above the range, nullptr when there is none
+    SharedPtr<DocumentHighlightSlice> analyzeFromSyncPoint(const LineRange& visible_range);
+    /// Add [start_line, end_line) to m_sync_free_lines_, or replace it when the two do not touch
+    void rememberSyncFreeLines(size_t start_line, size_t end_line);
+
+    /// Whether a line is analyzed in column windows
+    bool isLongLine(const DocumentLine& document_line) const;
+
+    /// Checkpoints of a long line, created on first use
+    LongLineCheckpoints& getLongLineCheckpoints(size_t line);
+
     SharedPtr<Document> m_document_;
-    SharedPtr<DocumentHighlight> m_highlight_;
+    PackedHighlightStore m_highlight_;
     SharedPtr<SyntaxRule> m_rule_;
     UniquePtr<LineHighlightAnalyzer> m_line_highlight_analyzer_;
     UniquePtr<ScopeGuideAnalyzer> m_scope_guide_analyzer_;
@@ -136,11 +494,22 @@ namespace NS_SWEETLINE {
     HighlightConfig m_config_;
     List<int32_t> m_line_syntax_states_;
     size_t m_valid_line_count_ {0};
-    size_t m_reusable_tail_start_ {0};
-    bool m_reusable_tail_lines_dirty_ {false};
-    bool m_reusable_tail_indices_dirty_ {false};
+    /// Sorted, disjoint ranges of cached lines at or past m_valid_line_count_ whose text or start state may have
+    /// changed since they were analyzed. The other cached lines past m_valid_line_count_ are reused once an analyzed
+    /// line before them ends in the state and with the spans they were analyzed with
+    List<LineRange> m_dirty_line_ranges_;
+    /// Checkpoints of the long lines by line, dropped from the first changed line on at every patch
+    HashMap<size_t, LongLineCheckpoints> m_long_lines_;
+    /// Lines analyzed from a sync point, dropped once the exact analysis reaches them or an edit touches them
+    ProvisionalLines m_provisional_;
+    /// Lines already matched against the sync rules without a hit, skipped by the next search for a sync point
+    /// and dropped when an edit starts above their end
+    LineRange m_sync_free_lines_;
   };
 
+  /// Internal analyzer behind a DocumentAnalyzer, lets the C API read the packed highlight directly
+  InternalDocumentAnalyzer& getInternalDocumentAnalyzer(const DocumentAnalyzer& analyzer);
+
   /// Indent guide analyzer independent of highlight analysis
   class ScopeGuideAnalyzer {
   public:
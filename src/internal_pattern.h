@@ -0,0 +1,161 @@
+#ifndef SWEETLINE_INTERNAL_PATTERN_H
+#define SWEETLINE_INTERNAL_PATTERN_H
+
+#include <bitset>
+#include <cstdint>
+#include <utility>
+#include "sweetline/macro.h"
+
+namespace NS_SWEETLINE {
+  /// Set of byte values
+  using ByteSet = std::bitset<256>;
+  /// Set of ASCII characters
+  using AsciiSet = std::bitset<128>;
+
+  /// Node kind of a parsed token pattern
+  enum struct PatternNodeKind : int8_t {
+    /// Matches the empty string
+    EMPTY = 0,
+    /// Matches one character out of a set
+    CHAR_SET,
+    /// Matches all children one after another
+    CONCAT,
+    /// Matches the first child that succeeds, in order
+    ALTERNATION,
+    /// Matches the child between min and max times
+    REPEAT,
+    /// Groups the child, capturing or not
+    GROUP,
+    /// Zero-width assertion such as ^ or \b
+    ASSERTION,
+    /// Zero-width lookahead or lookbehind
+    LOOKAROUND,
+    /// Construct that the analysis does not model (backreferences, \p{...}, conditionals...)
+    OPAQUE
+  };
+
+  /// Zero-width assertion kind
+  enum struct PatternAssertion : int8_t {
+    LINE_START = 0,
+    LINE_END,
+    STRING_START,
+    STRING_END,
+    STRING_END_OR_NEWLINE,
+    WORD_BOUNDARY,
+    NOT_WORD_BOUNDARY,
+    SEARCH_START
+  };
+
+  /// Node of a parsed token pattern
+  struct PatternNode {
+    PatternNodeKind kind {PatternNodeKind::EMPTY};
+    /// CHAR_SET: matching ASCII characters
+    AsciiSet ascii;
+    /// CHAR_SET: whether some non-ASCII character may match as well
+    bool non_ascii {false};
+    /// CHAR_SET: whether the set comes from a single literal character
+    bool literal {false};
+    /// REPEAT: minimum count
+    int32_t min {0};
+    /// REPEAT: maximum count, -1 means unbounded
+    int32_t max {-1};
+    /// REPEAT: whether the repeat is greedy
+    bool greedy {true};
+    /// REPEAT: whether the repeat is possessive
+    bool possessive {false};
+    /// GROUP: whether the group captures
+    bool capturing {false};
+    /// GROUP: whether the group is atomic (?>...)
+    bool atomic {false};
+    /// ASSERTION: assertion kind
+    PatternAssertion assertion {PatternAssertion::LINE_START};
+    /// LOOKAROUND: whether it looks behind instead of ahead
+    bool behind {false};
+    /// LOOKAROUND: whether it is a negative lookaround
+    bool negative {false};
+    /// Child node indices in the owning PatternTree
+    List<int32_t> children;
+  };
+
+  /// Parsed form of one Oniguruma token pattern, used for compile-time analysis.
+  /// Parsing never fails: anything the parser does not understand becomes an OPAQUE node,
+  /// which every analysis treats as "may match anything".
+  class PatternTree {
+  public:
+    /// Parse a pattern in Oniguruma syntax
+    /// @param pattern Pattern text
+    static PatternTree parse(const U8String& pattern);
+
+    /// Index of the root node
+    int32_t root() const;
+
+    /// Get a node by index
+    const PatternNode& node(int32_t index) const;
+
+    /// Whether any node is OPAQUE
+    bool hasOpaque() const;
+
+    /// Whether the subtree can match the empty string
+    bool isNullable(int32_t index) const;
+
+    /// Superset of the bytes a non-empty match of the subtree can start with
+    ByteSet firstBytes(int32_t index) const;
+
+    /// Superset of the bytes a match of the whole pattern can start with; all bytes when the pattern is nullable,
+    /// since an empty match may then happen at any position
+    ByteSet matchStartBytes() const;
+
+    /// Extract the words of a keyword list pattern such as \b(?:kw1|kw2|...)\b or \b(kw1|kw2|...)\b,
+    /// where every word consists of ASCII word characters only
+    /// @param words Receives the words in pattern order
+    /// @return Whether the pattern has exactly this shape
+    bool extractKeywordList(List<U8String>& words) const;
+  private:
+    List<PatternNode> m_nodes_;
+    int32_t m_root_ {-1};
+    bool m_has_opaque_ {false};
+
+    friend class PatternParser;
+  };
+
+  /// Keyword found by KeywordTrie::findFirst
+  struct KeywordMatch {
+    size_t start_byte {0};
+    size_t end_byte {0};
+    /// Lowest token rule index whose keyword list contains the word
+    int32_t rule_idx {-1};
+  };
+
+  /// Trie over the keyword lists of one state, matching them the way \b(?:kw1|kw2|...)\b would:
+  /// a keyword only matches a whole word, using Oniguruma's (Unicode) notion of word characters
+  class KeywordTrie {
+  public:
+    /// Add a keyword of a token rule, a word already added keeps the lower rule index
+    void addWord(const U8String& word, int32_t rule_idx);
+
+    /// Whether no keyword was added
+    bool empty() const;
+
+    void clear();
+
+    /// Find the leftmost keyword starting at or after from and no later than last_start
+    /// @param text Text being searched, words may extend up to text_size
+    /// @param from Character aligned byte position to search from, the character before it still decides word boundaries
+    /// @param last_start Last byte position where a keyword may start
+    /// @param match Receives the keyword match
+    bool findFirst(const char* text, size_t text_size, size_t from, size_t last_start, KeywordMatch& match) const;
+  private:
+    struct Node {
+      /// Child nodes by ASCII word byte
+      List<std::pair<char, int32_t>> children;
+      /// Token rule index when a keyword ends here, -1 otherwise
+      int32_t rule_idx {-1};
+    };
+    List<Node> m_nodes_;
+
+    /// Match the word starting at start against the trie, end receives the end of the word
+    int32_t matchWord(const char* text, size_t text_size, size_t start, size_t& end) const;
+  };
+}
+
+#endif //SWEETLINE_INTERNAL_PATTERN_H
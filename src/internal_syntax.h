@@ -5,6 +5,8 @@
 #include <oniguruma/oniguruma.h>
 #include <nlohmann/json.hpp>
 #include "sweetline/syntax.h"
+#include "internal_dfa.h"
+#include "internal_pattern.h"
 
 namespace NS_SWEETLINE {
   class HighlightEngine;
@@ -25,11 +27,19 @@ namespace NS_SWEETLINE {
     int32_t group_offset_start {0};
     /// Target state to transition to
     int32_t goto_state {-1};
+    /// Bytes a match of this token can start with
+    ByteSet first_bytes;
+    /// Whether this token is a pure keyword list matched by StateRule::keyword_trie, outside the merged pattern
+    bool keyword_list {false};
 
     /// SubState name by capture group
     HashMap<int32_t, U8String> sub_state_strs;
     /// SubState ID by capture group
     HashMap<int32_t, int32_t> sub_states;
+    /// Style ID indexed by capture group, built from style_ids after compilation
+    List<int32_t> group_style_table;
+    /// SubState ID indexed by capture group (-1 for none), built from sub_states after compilation
+    List<int32_t> group_sub_state_table;
 
     int32_t getGroupStyleId(int32_t group) const;
     int32_t getGroupSubState(int32_t group) const;
@@ -65,6 +75,36 @@ namespace NS_SWEETLINE {
     OnigRegex regex {nullptr};
     /// Total capture group count of the merged pattern
     int32_t group_count {0};
+    /// Whether the merged pattern uses \G, whose meaning depends on where a search starts,
+    /// so a failed search does not rule out matches from later start positions
+    bool search_start_anchored {false};
+    /// Bytes a match of any token rule can start with, searches skip ahead to the next such byte
+    ByteSet first_bytes;
+    /// Whether first_bytes excludes any byte, so that skipping ahead can pay off
+    bool has_first_byte_filter {false};
+    /// Keywords of all keyword list tokens, matched instead of the merged pattern
+    KeywordTrie keyword_trie;
+    /// Whole-token group of each alternative of the merged pattern, in alternative order
+    List<int32_t> alternative_groups;
+    /// Token rule index of each alternative of the merged pattern
+    List<int32_t> alternative_rules;
+    /// Regular form of the merged pattern that finds match starts without backtracking,
+    /// nullptr when some alternative is not regular
+    SharedPtr<RegularProgram> regular_program;
+    /// Pattern of each alternative of the merged pattern compiled on its own, in alternative order, for
+    /// HighlightConfig::use_rule_scanner. Empty unless the compiling engine enables it and the state has several
+    /// alternatives, no \G and no group references, which would mean something else outside the merged pattern
+    List<OnigRegex> alternative_regexes;
+    /// Whether some token rule moves to another state; without one, a line that enters the state stays in it
+    bool has_goto_rule {false};
+    /// Token rule matching any single character without captures or state change, -1 if there is none.
+    /// This is the body of a comment or string state: rules after it can never match, and bytes outside
+    /// filler_stop_bytes belong to it, so whole runs of them are covered without searching
+    int32_t filler_rule {-1};
+    /// Bytes a match of any token rule before filler_rule can start with
+    ByteSet filler_stop_bytes;
+    /// The only byte of filler_stop_bytes (a single-byte terminator such as " or '), -1 when there are several
+    int32_t filler_stop_byte {-1};
     /// importSyntax request list
     List<ImportSyntaxRequest> import_requests;
 
@@ -141,6 +181,20 @@ namespace NS_SWEETLINE {
     /// ID, generated after parsing
     int32_t rule_id {0};
 
+#ifdef SWEETLINE_DEBUG
+    void dump() const;
+#endif
+  };
+
+  /// Sync rule: a line matching the pattern is assumed to start in the state, without analyzing the lines above
+  struct SyncRule {
+    /// Regex pattern searched in the line text
+    U8String pattern;
+    /// State name parsed from JSON
+    U8String state_str;
+    /// State the matching line starts in
+    int32_t state {0};
+
 #ifdef SWEETLINE_DEBUG
     void dump() const;
 #endif
@@ -149,7 +203,8 @@ namespace NS_SWEETLINE {
   /// Syntax rule compiler
   class SyntaxRuleCompiler {
   public:
-    explicit SyntaxRuleCompiler(const SharedPtr<StyleMapping>& style_mapping, bool inline_style, HighlightEngine* engine = nullptr);
+    explicit SyntaxRuleCompiler(const SharedPtr<StyleMapping>& style_mapping, bool inline_style, HighlightEngine* engine = nullptr,
+      bool rule_scanner = false);
 
     /// Compile syntax rule from JSON
     /// @param json JSON content of the syntax rule
@@ -164,6 +219,8 @@ namespace NS_SWEETLINE {
     SharedPtr<StyleMapping> m_style_mapping_;
     bool m_inline_style_ {false};
     HighlightEngine* m_engine_ {nullptr};
+    /// Whether states also compile each alternative on its own, see StateRule::alternative_regexes
+    bool m_rule_scanner_ {false};
 
     static void parseSyntaxName(const SharedPtr<SyntaxRule>& rule, nlohmann::json& root);
     static void parseFileNames(const SharedPtr<SyntaxRule>& rule, nlohmann::json& root);
@@ -182,7 +239,10 @@ namespace NS_SWEETLINE {
     void parseState(const SharedPtr<SyntaxRule>& rule, StateRule& state_rule, const nlohmann::json& state_json);
 		void parseScopeRules(const SharedPtr<SyntaxRule>& rule, nlohmann::json& root);
     static void parseBracketRules(const SharedPtr<SyntaxRule>& rule, nlohmann::json& root);
-    static void compileStatePattern(StateRule& state_rule);
+    static void parseSyncRules(const SharedPtr<SyntaxRule>& rule, nlohmann::json& root);
+    void compileStatePattern(StateRule& state_rule) const;
+    /// Build the id-indexed tables the analyzer reads instead of the hash maps
+    static void buildRuleTables(const SharedPtr<SyntaxRule>& rule);
     void processImportSyntaxRequests(const SharedPtr<SyntaxRule>& rule);
     void importSyntaxRule(const SharedPtr<SyntaxRule>& target_rule, int32_t target_state_id,
       const SharedPtr<SyntaxRule>& source_rule);
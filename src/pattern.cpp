@@ -0,0 +1,1031 @@
+#include <oniguruma/oniguruma.h>
+#include "internal_pattern.h"
+
+namespace NS_SWEETLINE {
+  namespace {
+    struct PatternFlags {
+      bool ignore_case {false};
+      bool dot_all {false};
+    };
+
+    bool isAsciiLetter(uint32_t ch) {
+      return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+    }
+
+    bool isAsciiDigit(uint32_t ch) {
+      return ch >= '0' && ch <= '9';
+    }
+
+    int32_t hexValue(char ch) {
+      if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+      }
+      if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+      }
+      if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+      }
+      return -1;
+    }
+
+    AsciiSet makeAsciiRange(uint32_t first, uint32_t last) {
+      AsciiSet set;
+      for (uint32_t ch = first; ch <= last && ch < 128; ++ch) {
+        set.set(ch);
+      }
+      return set;
+    }
+
+    const AsciiSet& digitSet() {
+      static const AsciiSet set = makeAsciiRange('0', '9');
+      return set;
+    }
+
+    const AsciiSet& wordSet() {
+      static const AsciiSet set = makeAsciiRange('a', 'z') | makeAsciiRange('A', 'Z')
+        | makeAsciiRange('0', '9') | makeAsciiRange('_', '_');
+      return set;
+    }
+
+    const AsciiSet& spaceSet() {
+      static const AsciiSet set = makeAsciiRange('\t', '\r') | makeAsciiRange(' ', ' ');
+      return set;
+    }
+
+    const AsciiSet& hexDigitSet() {
+      static const AsciiSet set = makeAsciiRange('0', '9') | makeAsciiRange('a', 'f') | makeAsciiRange('A', 'F');
+      return set;
+    }
+
+    bool isAsciiWordByte(unsigned char byte) {
+      return isAsciiLetter(byte) || isAsciiDigit(byte) || byte == '_';
+    }
+
+    /// Whether the character starting at pos is a word character, the same test \b and \w use
+    bool isWordCharAt(const char* text, size_t text_size, size_t pos) {
+      unsigned char byte = static_cast<unsigned char>(text[pos]);
+      if (byte < 0x80) {
+        return isAsciiWordByte(byte);
+      }
+      const OnigUChar* begin = reinterpret_cast<const OnigUChar*>(text + pos);
+      const OnigUChar* end = reinterpret_cast<const OnigUChar*>(text + text_size);
+      OnigCodePoint code = ONIGENC_MBC_TO_CODE(ONIG_ENCODING_UTF8, begin, end);
+      return ONIGENC_IS_CODE_WORD(ONIG_ENCODING_UTF8, code);
+    }
+
+    /// Whether the character ending right before pos is a word character, false at the start of the text
+    bool isWordCharBefore(const char* text, size_t text_size, size_t pos) {
+      if (pos == 0) {
+        return false;
+      }
+      size_t prev = pos - 1;
+      while (prev > 0 && (static_cast<unsigned char>(text[prev]) & 0xC0) == 0x80) {
+        --prev;
+      }
+      return isWordCharAt(text, text_size, prev);
+    }
+
+    /// Byte length of the UTF-8 character starting with the lead byte, invalid bytes count as one
+    size_t utf8CharLength(unsigned char lead) {
+      return lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    }
+
+    /// Add the other case of every ASCII letter in the set
+    void addCaseVariants(AsciiSet& set) {
+      for (uint32_t ch = 'a'; ch <= 'z'; ++ch) {
+        uint32_t upper = ch - 'a' + 'A';
+        if (set.test(ch) || set.test(upper)) {
+          set.set(ch);
+          set.set(upper);
+        }
+      }
+    }
+  }
+
+  /// Recursive descent parser producing a PatternTree
+  class PatternParser {
+  public:
+    explicit PatternParser(const U8String& pattern): m_pattern_(pattern) {
+    }
+
+    PatternTree parse() {
+      PatternFlags flags;
+      m_tree_.m_root_ = parseAlternation(flags);
+      if (m_pos_ < m_pattern_.size()) {
+        // Unbalanced ')' is a syntax error in Oniguruma, keep the tree conservative
+        m_tree_.m_root_ = wrapOpaque(m_tree_.m_root_);
+        m_pos_ = m_pattern_.size();
+      }
+      return std::move(m_tree_);
+    }
+  private:
+    const U8String& m_pattern_;
+    size_t m_pos_ {0};
+    PatternTree m_tree_;
+
+    bool atEnd() const {
+      return m_pos_ >= m_pattern_.size();
+    }
+
+    char peek(size_t offset = 0) const {
+      return m_pos_ + offset < m_pattern_.size() ? m_pattern_[m_pos_ + offset] : '\0';
+    }
+
+    bool startsWith(const char* text) const {
+      return m_pos_ <= m_pattern_.size() && m_pattern_.compare(m_pos_, std::char_traits<char>::length(text), text) == 0;
+    }
+
+    int32_t addNode(PatternNode&& node) {
+      if (node.kind == PatternNodeKind::OPAQUE) {
+        m_tree_.m_has_opaque_ = true;
+      }
+      m_tree_.m_nodes_.push_back(std::move(node));
+      return static_cast<int32_t>(m_tree_.m_nodes_.size() - 1);
+    }
+
+    int32_t addEmpty() {
+      return addNode(PatternNode {});
+    }
+
+    int32_t addOpaque() {
+      PatternNode node;
+      node.kind = PatternNodeKind::OPAQUE;
+      return addNode(std::move(node));
+    }
+
+    int32_t wrapOpaque(int32_t child) {
+      PatternNode node;
+      node.kind = PatternNodeKind::OPAQUE;
+      node.children.push_back(child);
+      return addNode(std::move(node));
+    }
+
+    int32_t addCharSet(const AsciiSet& ascii, bool non_ascii, const PatternFlags& flags, bool literal = false) {
+      PatternNode node;
+      node.kind = PatternNodeKind::CHAR_SET;
+      node.ascii = ascii;
+      node.non_ascii = non_ascii;
+      node.literal = literal;
+      if (flags.ignore_case) {
+        addCaseVariants(node.ascii);
+        // Unicode case folding maps some non-ASCII characters onto ASCII letters (KELVIN SIGN, LONG S...)
+        node.non_ascii = true;
+        node.literal = false;
+      }
+      return addNode(std::move(node));
+    }
+
+    int32_t addCodePoint(uint32_t code_point, const PatternFlags& flags) {
+      if (code_point < 128) {
+        AsciiSet set;
+        set.set(code_point);
+        return addCharSet(set, false, flags, true);
+      }
+      if (flags.ignore_case) {
+        // Multi-character folds (such as sharp s and "ss") are not modelled
+        return addOpaque();
+      }
+      return addCharSet({}, true, flags);
+    }
+
+    int32_t addAssertion(PatternAssertion assertion) {
+      PatternNode node;
+      node.kind = PatternNodeKind::ASSERTION;
+      node.assertion = assertion;
+      return addNode(std::move(node));
+    }
+
+    /// Decode one UTF-8 encoded character at the cursor
+    uint32_t takeCodePoint() {
+      unsigned char lead = static_cast<unsigned char>(m_pattern_[m_pos_++]);
+      if (lead < 0x80) {
+        return lead;
+      }
+      size_t extra = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+      uint32_t code_point = lead & (0x3F >> extra);
+      for (size_t i = 0; i < extra && !atEnd(); ++i) {
+        code_point = (code_point << 6) | (static_cast<unsigned char>(m_pattern_[m_pos_++]) & 0x3F);
+      }
+      // Anything non-ASCII only matters as "not ASCII" for the analysis
+      return code_point < 128 ? 0x80 : code_point;
+    }
+
+    /// Parse \xHH, \x{H...} or \uHHHH after the escape letter has been consumed, -1 on failure
+    int64_t takeHexCodePoint(char kind) {
+      int64_t value = 0;
+      if (kind == 'x' && peek() == '{') {
+        ++m_pos_;
+        size_t digits = 0;
+        while (!atEnd() && hexValue(peek()) >= 0 && digits < 8) {
+          value = value * 16 + hexValue(m_pattern_[m_pos_++]);
+          ++digits;
+        }
+        if (digits == 0 || peek() != '}') {
+          return -1;
+        }
+        ++m_pos_;
+        return value;
+      }
+      size_t max_digits = kind == 'x' ? 2 : 4;
+      size_t digits = 0;
+      while (digits < max_digits && !atEnd() && hexValue(peek()) >= 0) {
+        value = value * 16 + hexValue(m_pattern_[m_pos_++]);
+        ++digits;
+      }
+      if (digits == 0 || (kind == 'u' && digits != 4)) {
+        return -1;
+      }
+      // \xHH above 0x7F denotes a raw byte in Oniguruma, which the analysis does not model
+      if (kind == 'x' && value >= 0x80) {
+        return -1;
+      }
+      return value;
+    }
+
+    /// Character class shorthand such as \d, false if the letter is not one
+    static bool shorthandClass(char letter, AsciiSet& ascii, bool& non_ascii) {
+      switch (letter) {
+      case 'd':
+        ascii = digitSet();
+        non_ascii = true;
+        return true;
+      case 'w':
+        ascii = wordSet();
+        non_ascii = true;
+        return true;
+      case 's':
+        ascii = spaceSet();
+        non_ascii = true;
+        return true;
+      case 'h':
+        ascii = hexDigitSet();
+        non_ascii = false;
+        return true;
+      case 'D':
+        ascii = ~digitSet();
+        non_ascii = true;
+        return true;
+      case 'W':
+        ascii = ~wordSet();
+        non_ascii = true;
+        return true;
+      case 'S':
+        ascii = ~spaceSet();
+        non_ascii = true;
+        return true;
+      case 'H':
+        ascii = ~hexDigitSet();
+        non_ascii = true;
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    /// Control escapes shared by atoms and classes, -1 if the letter is not one
+    static int32_t controlEscape(char letter) {
+      switch (letter) {
+      case 't':
+        return '\t';
+      case 'n':
+        return '\n';
+      case 'r':
+        return '\r';
+      case 'f':
+        return '\f';
+      case 'v':
+        return '\v';
+      case 'a':
+        return 0x07;
+      case 'e':
+        return 0x1B;
+      default:
+        return -1;
+      }
+    }
+
+    int32_t parseAlternation(const PatternFlags& flags) {
+      List<int32_t> branches;
+      branches.push_back(parseSequence(flags));
+      while (peek() == '|') {
+        ++m_pos_;
+        branches.push_back(parseSequence(flags));
+      }
+      if (branches.size() == 1) {
+        return branches[0];
+      }
+      PatternNode node;
+      node.kind = PatternNodeKind::ALTERNATION;
+      node.children = std::move(branches);
+      return addNode(std::move(node));
+    }
+
+    int32_t parseSequence(const PatternFlags& flags) {
+      List<int32_t> items;
+      while (!atEnd() && peek() != '|' && peek() != ')') {
+        if (startsWith("(?") && isIsolatedOptionGroup()) {
+          // (?i) applies to the rest of the enclosing group, including later alternatives
+          PatternFlags inner_flags = flags;
+          if (!parseOptionLetters(inner_flags) || peek() != ')') {
+            items.push_back(addOpaque());
+            skipToGroupEnd();
+            break;
+          }
+          ++m_pos_;
+          items.push_back(parseAlternation(inner_flags));
+          break;
+        }
+        int32_t atom = parseAtom(flags);
+        items.push_back(parseQuantifiers(atom));
+      }
+      if (items.empty()) {
+        return addEmpty();
+      }
+      if (items.size() == 1) {
+        return items[0];
+      }
+      PatternNode node;
+      node.kind = PatternNodeKind::CONCAT;
+      node.children = std::move(items);
+      return addNode(std::move(node));
+    }
+
+    /// Whether the cursor is at "(?flags)" rather than "(?flags:...)"
+    bool isIsolatedOptionGroup() const {
+      size_t i = m_pos_ + 2;
+      while (i < m_pattern_.size() && (isAsciiLetter(static_cast<unsigned char>(m_pattern_[i])) || m_pattern_[i] == '-')) {
+        ++i;
+      }
+      return i > m_pos_ + 2 && i < m_pattern_.size() && m_pattern_[i] == ')';
+    }
+
+    /// Parse option letters after "(?", stopping at ':' or ')'; false for options the analysis does not model
+    bool parseOptionLetters(PatternFlags& flags) {
+      m_pos_ += 2;
+      bool enable = true;
+      bool supported = true;
+      while (!atEnd() && peek() != ':' && peek() != ')') {
+        char ch = m_pattern_[m_pos_++];
+        if (ch == '-') {
+          enable = false;
+        } else if (ch == 'i') {
+          flags.ignore_case = enable;
+        } else if (ch == 'm') {
+          flags.dot_all = enable;
+        } else {
+          supported = false;
+        }
+      }
+      return supported;
+    }
+
+    /// Skip the remainder of the current group, honoring escapes, classes and nesting
+    void skipToGroupEnd() {
+      int32_t depth = 0;
+      while (!atEnd()) {
+        char ch = peek();
+        if (ch == '\\') {
+          m_pos_ += 2;
+          continue;
+        }
+        if (ch == '[') {
+          skipClass();
+          continue;
+        }
+        if (ch == '(') {
+          ++depth;
+        } else if (ch == ')') {
+          if (depth == 0) {
+            return;
+          }
+          --depth;
+        }
+        ++m_pos_;
+      }
+    }
+
+    void skipClass() {
+      int32_t depth = 0;
+      while (!atEnd()) {
+        char ch = m_pattern_[m_pos_++];
+        if (ch == '\\') {
+          ++m_pos_;
+        } else if (ch == '[') {
+          ++depth;
+        } else if (ch == ']') {
+          if (--depth <= 0) {
+            return;
+          }
+        }
+      }
+    }
+
+    int32_t parseAtom(const PatternFlags& flags) {
+      char ch = peek();
+      switch (ch) {
+      case '(':
+        return parseGroup(flags);
+      case '[':
+        return parseClass(flags);
+      case '.': {
+        ++m_pos_;
+        AsciiSet set;
+        set.set();
+        if (!flags.dot_all) {
+          set.reset('\n');
+        }
+        PatternFlags plain_flags;
+        return addCharSet(set, true, plain_flags);
+      }
+      case '^':
+        ++m_pos_;
+        return addAssertion(PatternAssertion::LINE_START);
+      case '$':
+        ++m_pos_;
+        return addAssertion(PatternAssertion::LINE_END);
+      case '\\':
+        return parseEscape(flags);
+      case '*':
+      case '+':
+      case '?':
+        // Repeat without a target is rejected by Oniguruma
+        ++m_pos_;
+        return addOpaque();
+      default:
+        return addCodePoint(takeCodePoint(), flags);
+      }
+    }
+
+    int32_t parseEscape(const PatternFlags& flags) {
+      ++m_pos_;
+      if (atEnd()) {
+        return addOpaque();
+      }
+      char letter = m_pattern_[m_pos_++];
+      switch (letter) {
+      case 'b':
+        return addAssertion(PatternAssertion::WORD_BOUNDARY);
+      case 'B':
+        return addAssertion(PatternAssertion::NOT_WORD_BOUNDARY);
+      case 'A':
+        return addAssertion(PatternAssertion::STRING_START);
+      case 'z':
+        return addAssertion(PatternAssertion::STRING_END);
+      case 'Z':
+        return addAssertion(PatternAssertion::STRING_END_OR_NEWLINE);
+      case 'G':
+        return addAssertion(PatternAssertion::SEARCH_START);
+      case 'x':
+      case 'u': {
+        int64_t code_point = takeHexCodePoint(letter);
+        if (code_point < 0) {
+          return addOpaque();
+        }
+        return addCodePoint(static_cast<uint32_t>(code_point), flags);
+      }
+      default:
+        break;
+      }
+      AsciiSet ascii;
+      bool non_ascii = false;
+      if (shorthandClass(letter, ascii, non_ascii)) {
+        return addCharSet(ascii, non_ascii, flags);
+      }
+      int32_t control = controlEscape(letter);
+      if (control >= 0) {
+        return addCodePoint(static_cast<uint32_t>(control), flags);
+      }
+      unsigned char byte = static_cast<unsigned char>(letter);
+      if (byte >= 0x80) {
+        --m_pos_;
+        return addCodePoint(takeCodePoint(), flags);
+      }
+      if (isAsciiLetter(byte) || isAsciiDigit(byte)) {
+        // Backreferences, properties, \K, \R, \X and other letter escapes
+        return addOpaque();
+      }
+      return addCodePoint(byte, flags);
+    }
+
+    int32_t parseGroup(const PatternFlags& flags) {
+      PatternNode node;
+      node.kind = PatternNodeKind::GROUP;
+      PatternFlags inner_flags = flags;
+      bool opaque = false;
+      if (startsWith("(?#")) {
+        while (!atEnd() && peek() != ')') {
+          ++m_pos_;
+        }
+        if (atEnd()) {
+          return addOpaque();
+        }
+        ++m_pos_;
+        return addEmpty();
+      }
+      if (startsWith("(?:")) {
+        m_pos_ += 3;
+      } else if (startsWith("(?=") || startsWith("(?!")) {
+        node.kind = PatternNodeKind::LOOKAROUND;
+        node.negative = peek(2) == '!';
+        m_pos_ += 3;
+      } else if (startsWith("(?<=") || startsWith("(?<!")) {
+        node.kind = PatternNodeKind::LOOKAROUND;
+        node.behind = true;
+        node.negative = peek(3) == '!';
+        m_pos_ += 4;
+      } else if (startsWith("(?>")) {
+        node.atomic = true;
+        m_pos_ += 3;
+      } else if (startsWith("(?<") || startsWith("(?'") || startsWith("(?P<")) {
+        char close = peek(2) == '\'' ? '\'' : '>';
+        while (!atEnd() && peek() != close) {
+          ++m_pos_;
+        }
+        if (atEnd()) {
+          return addOpaque();
+        }
+        ++m_pos_;
+        node.capturing = true;
+      } else if (startsWith("(?")) {
+        if (!parseOptionLetters(inner_flags) || peek() != ':') {
+          opaque = true;
+        } else {
+          ++m_pos_;
+        }
+      } else {
+        ++m_pos_;
+        node.capturing = true;
+      }
+
+      int32_t body;
+      if (opaque) {
+        skipToGroupEnd();
+        body = addOpaque();
+      } else {
+        body = parseAlternation(inner_flags);
+      }
+      if (peek() != ')') {
+        return wrapOpaque(body);
+      }
+      ++m_pos_;
+      node.children.push_back(body);
+      return addNode(std::move(node));
+    }
+
+    /// Parse one class member character (literal or escape) for ranges, -1 for shorthand or unsupported escapes
+    int64_t takeClassCodePoint() {
+      if (peek() != '\\') {
+        return takeCodePoint();
+      }
+      ++m_pos_;
+      if (atEnd()) {
+        return -1;
+      }
+      char letter = m_pattern_[m_pos_++];
+      if (letter == 'x' || letter == 'u') {
+        return takeHexCodePoint(letter);
+      }
+      if (letter == 'b') {
+        return 0x08;
+      }
+      int32_t control = controlEscape(letter);
+      if (control >= 0) {
+        return control;
+      }
+      unsigned char byte = static_cast<unsigned char>(letter);
+      if (byte >= 0x80) {
+        --m_pos_;
+        return takeCodePoint();
+      }
+      if (isAsciiLetter(byte) || isAsciiDigit(byte)) {
+        return -1;
+      }
+      return byte;
+    }
+
+    int32_t parseClass(const PatternFlags& flags) {
+      size_t class_start = m_pos_;
+      ++m_pos_;
+      bool negated = false;
+      if (peek() == '^') {
+        negated = true;
+        ++m_pos_;
+      }
+      AsciiSet ascii;
+      bool non_ascii = false;
+      bool non_ascii_member = false;
+      bool opaque = peek() == ']';
+      while (!atEnd() && peek() != ']' && !opaque) {
+        if (peek() == '[' || startsWith("&&")) {
+          // POSIX brackets, nested classes and intersections are not modelled
+          opaque = true;
+          break;
+        }
+        if (peek() == '\\') {
+          AsciiSet shorthand;
+          bool shorthand_non_ascii = false;
+          if (m_pos_ + 1 < m_pattern_.size() && shorthandClass(peek(1), shorthand, shorthand_non_ascii)) {
+            m_pos_ += 2;
+            ascii |= shorthand;
+            non_ascii = non_ascii || shorthand_non_ascii;
+            continue;
+          }
+        }
+        int64_t first = takeClassCodePoint();
+        if (first < 0) {
+          opaque = true;
+          break;
+        }
+        int64_t last = first;
+        if (peek() == '-' && peek(1) != ']' && peek(1) != '\0') {
+          ++m_pos_;
+          if (peek() == '[' || (peek() == '\\' && m_pos_ + 1 < m_pattern_.size() && isAsciiLetter(
+            static_cast<unsigned char>(peek(1))) && controlEscape(peek(1)) < 0 && peek(1) != 'x' && peek(1) != 'u')) {
+            opaque = true;
+            break;
+          }
+          last = takeClassCodePoint();
+          if (last < first) {
+            opaque = true;
+            break;
+          }
+        }
+        if (first < 128) {
+          ascii |= makeAsciiRange(static_cast<uint32_t>(first), static_cast<uint32_t>(std::min<int64_t>(last, 127)));
+        }
+        if (last >= 128) {
+          non_ascii = true;
+          non_ascii_member = true;
+        }
+      }
+      // Case folding maps some non-ASCII members onto ASCII text (KELVIN SIGN onto "k", sharp s onto "ss")
+      if (flags.ignore_case && non_ascii_member) {
+        opaque = true;
+      }
+      if (opaque || atEnd()) {
+        m_pos_ = class_start;
+        skipClass();
+        return addOpaque();
+      }
+      ++m_pos_;
+      if (flags.ignore_case) {
+        addCaseVariants(ascii);
+        non_ascii = true;
+      }
+      if (negated) {
+        ascii = ~ascii;
+        non_ascii = true;
+      }
+      PatternFlags plain_flags;
+      return addCharSet(ascii, non_ascii, plain_flags);
+    }
+
+    /// Parse an interval quantifier body "{n}", "{n,}", "{,m}" or "{n,m}", false if the text is a literal brace
+    bool parseInterval(int32_t& min, int32_t& max) {
+      size_t i = m_pos_ + 1;
+      auto readNumber = [&](int32_t& value) {
+        size_t start = i;
+        value = 0;
+        while (i < m_pattern_.size() && isAsciiDigit(static_cast<unsigned char>(m_pattern_[i])) && i - start < 6) {
+          value = value * 10 + (m_pattern_[i] - '0');
+          ++i;
+        }
+        return i > start;
+      };
+      int32_t low = 0;
+      int32_t high = -1;
+      bool has_low = readNumber(low);
+      if (i < m_pattern_.size() && m_pattern_[i] == ',') {
+        ++i;
+        bool has_high = readNumber(high);
+        if (!has_low && !has_high) {
+          return false;
+        }
+        if (!has_high) {
+          high = -1;
+        }
+      } else if (has_low) {
+        high = low;
+      } else {
+        return false;
+      }
+      if (i >= m_pattern_.size() || m_pattern_[i] != '}') {
+        return false;
+      }
+      m_pos_ = i + 1;
+      min = has_low ? low : 0;
+      max = high;
+      return true;
+    }
+
+    int32_t parseQuantifiers(int32_t atom) {
+      while (!atEnd()) {
+        PatternNode node;
+        node.kind = PatternNodeKind::REPEAT;
+        bool interval = false;
+        char ch = peek();
+        if (ch == '*') {
+          node.min = 0;
+          node.max = -1;
+          ++m_pos_;
+        } else if (ch == '+') {
+          node.min = 1;
+          node.max = -1;
+          ++m_pos_;
+        } else if (ch == '?') {
+          node.min = 0;
+          node.max = 1;
+          ++m_pos_;
+        } else if (ch == '{' && parseInterval(node.min, node.max)) {
+          interval = true;
+        } else {
+          break;
+        }
+        if (peek() == '?') {
+          node.greedy = false;
+          ++m_pos_;
+        } else if (peek() == '+' && !interval) {
+          // In Oniguruma syntax "{n,m}+" repeats the interval again instead of making it possessive
+          node.possessive = true;
+          ++m_pos_;
+        }
+        node.children.push_back(atom);
+        atom = addNode(std::move(node));
+      }
+      return atom;
+    }
+  };
+
+  // ===================================== PatternTree ============================================
+  PatternTree PatternTree::parse(const U8String& pattern) {
+    PatternParser parser(pattern);
+    return parser.parse();
+  }
+
+  int32_t PatternTree::root() const {
+    return m_root_;
+  }
+
+  const PatternNode& PatternTree::node(int32_t index) const {
+    return m_nodes_[static_cast<size_t>(index)];
+  }
+
+  bool PatternTree::hasOpaque() const {
+    return m_has_opaque_;
+  }
+
+  bool PatternTree::isNullable(int32_t index) const {
+    const PatternNode& current = node(index);
+    switch (current.kind) {
+    case PatternNodeKind::CHAR_SET:
+      return false;
+    case PatternNodeKind::CONCAT:
+      for (int32_t child : current.children) {
+        if (!isNullable(child)) {
+          return false;
+        }
+      }
+      return true;
+    case PatternNodeKind::ALTERNATION:
+      for (int32_t child : current.children) {
+        if (isNullable(child)) {
+          return true;
+        }
+      }
+      return false;
+    case PatternNodeKind::REPEAT:
+      return current.min == 0 || isNullable(current.children[0]);
+    case PatternNodeKind::GROUP:
+      return isNullable(current.children[0]);
+    default:
+      return true;
+    }
+  }
+
+  ByteSet PatternTree::firstBytes(int32_t index) const {
+    const PatternNode& current = node(index);
+    ByteSet result;
+    switch (current.kind) {
+    case PatternNodeKind::CHAR_SET:
+      for (size_t ch = 0; ch < 128; ++ch) {
+        if (current.ascii.test(ch)) {
+          result.set(ch);
+        }
+      }
+      if (current.non_ascii) {
+        for (size_t byte = 0x80; byte < 256; ++byte) {
+          result.set(byte);
+        }
+      }
+      return result;
+    case PatternNodeKind::CONCAT:
+      for (int32_t child : current.children) {
+        result |= firstBytes(child);
+        if (!isNullable(child)) {
+          break;
+        }
+      }
+      return result;
+    case PatternNodeKind::ALTERNATION:
+      for (int32_t child : current.children) {
+        result |= firstBytes(child);
+      }
+      return result;
+    case PatternNodeKind::REPEAT:
+      if (current.max == 0) {
+        return result;
+      }
+      return firstBytes(current.children[0]);
+    case PatternNodeKind::GROUP:
+      return firstBytes(current.children[0]);
+    case PatternNodeKind::OPAQUE:
+      result.set();
+      return result;
+    default:
+      // Zero-width nodes never consume the first byte themselves
+      return result;
+    }
+  }
+
+  ByteSet PatternTree::matchStartBytes() const {
+    if (m_root_ < 0 || isNullable(m_root_)) {
+      ByteSet all;
+      all.set();
+      return all;
+    }
+    return firstBytes(m_root_);
+  }
+
+  bool PatternTree::extractKeywordList(List<U8String>& words) const {
+    words.clear();
+    if (m_root_ < 0 || m_has_opaque_) {
+      return false;
+    }
+    auto isWordBoundary = [this](int32_t index) {
+      const PatternNode& current = node(index);
+      return current.kind == PatternNodeKind::ASSERTION && current.assertion == PatternAssertion::WORD_BOUNDARY;
+    };
+    // Single ASCII word character written literally
+    auto appendLiteral = [this](int32_t index, U8String& word) {
+      const PatternNode& current = node(index);
+      if (current.kind != PatternNodeKind::CHAR_SET || !current.literal || current.non_ascii || current.ascii.count() != 1) {
+        return false;
+      }
+      for (size_t ch = 0; ch < 128; ++ch) {
+        if (current.ascii.test(ch)) {
+          if (!isAsciiWordByte(static_cast<unsigned char>(ch))) {
+            return false;
+          }
+          word.push_back(static_cast<char>(ch));
+          return true;
+        }
+      }
+      return false;
+    };
+    auto appendWord = [&](int32_t index) {
+      U8String word;
+      const PatternNode& current = node(index);
+      if (current.kind == PatternNodeKind::CONCAT) {
+        for (int32_t child : current.children) {
+          if (!appendLiteral(child, word)) {
+            return false;
+          }
+        }
+      } else if (!appendLiteral(index, word)) {
+        return false;
+      }
+      words.push_back(std::move(word));
+      return true;
+    };
+
+    const PatternNode& root_node = node(m_root_);
+    if (root_node.kind != PatternNodeKind::CONCAT || root_node.children.size() < 3
+      || !isWordBoundary(root_node.children.front()) || !isWordBoundary(root_node.children.back())) {
+      return false;
+    }
+    if (root_node.children.size() > 3) {
+      // \bword\b
+      U8String word;
+      for (size_t i = 1; i + 1 < root_node.children.size(); ++i) {
+        if (!appendLiteral(root_node.children[i], word)) {
+          return false;
+        }
+      }
+      words.push_back(std::move(word));
+      return true;
+    }
+    int32_t body = root_node.children[1];
+    const PatternNode& group = node(body);
+    if (group.kind == PatternNodeKind::GROUP) {
+      if (group.atomic) {
+        return false;
+      }
+      body = group.children[0];
+    }
+    const PatternNode& body_node = node(body);
+    if (body_node.kind == PatternNodeKind::ALTERNATION) {
+      for (int32_t branch : body_node.children) {
+        if (!appendWord(branch)) {
+          words.clear();
+          return false;
+        }
+      }
+      return true;
+    }
+    return appendWord(body);
+  }
+
+  // ===================================== KeywordTrie ============================================
+  void KeywordTrie::addWord(const U8String& word, int32_t rule_idx) {
+    if (m_nodes_.empty()) {
+      m_nodes_.emplace_back();
+    }
+    int32_t current = 0;
+    for (char ch : word) {
+      int32_t next = -1;
+      for (const auto& [child_ch, child] : m_nodes_[current].children) {
+        if (child_ch == ch) {
+          next = child;
+          break;
+        }
+      }
+      if (next < 0) {
+        next = static_cast<int32_t>(m_nodes_.size());
+        m_nodes_[current].children.emplace_back(ch, next);
+        m_nodes_.emplace_back();
+      }
+      current = next;
+    }
+    // The same word in two rules belongs to the earlier one, as in the merged alternation
+    if (m_nodes_[current].rule_idx < 0) {
+      m_nodes_[current].rule_idx = rule_idx;
+    }
+  }
+
+  bool KeywordTrie::empty() const {
+    return m_nodes_.empty();
+  }
+
+  void KeywordTrie::clear() {
+    m_nodes_.clear();
+  }
+
+  bool KeywordTrie::findFirst(const char* text, size_t text_size, size_t from, size_t last_start,
+    KeywordMatch& match) const {
+    if (m_nodes_.empty()) {
+      return false;
+    }
+    bool prev_word = isWordCharBefore(text, text_size, from);
+    size_t pos = from;
+    while (pos <= last_start && pos < text_size) {
+      unsigned char byte = static_cast<unsigned char>(text[pos]);
+      if (byte >= 0x80) {
+        // Keywords are ASCII, so a non-ASCII character only matters for the word boundary after it
+        prev_word = isWordCharAt(text, text_size, pos);
+        pos += utf8CharLength(byte);
+        continue;
+      }
+      bool word = isAsciiWordByte(byte);
+      if (word && !prev_word) {
+        size_t word_end = pos;
+        int32_t rule_idx = matchWord(text, text_size, pos, word_end);
+        if (rule_idx >= 0) {
+          match.start_byte = pos;
+          match.end_byte = word_end;
+          match.rule_idx = rule_idx;
+          return true;
+        }
+      }
+      prev_word = word;
+      ++pos;
+    }
+    return false;
+  }
+
+  int32_t KeywordTrie::matchWord(const char* text, size_t text_size, size_t start, size_t& end) const {
+    int32_t current = 0;
+    size_t pos = start;
+    while (pos < text_size && isAsciiWordByte(static_cast<unsigned char>(text[pos]))) {
+      int32_t next = -1;
+      for (const auto& [child_ch, child] : m_nodes_[current].children) {
+        if (child_ch == text[pos]) {
+          next = child;
+          break;
+        }
+      }
+      if (next < 0) {
+        // The word goes on past every keyword sharing its prefix
+        return -1;
+      }
+      current = next;
+      ++pos;
+    }
+    if (pos < text_size && isWordCharAt(text, text_size, pos)) {
+      // A non-ASCII word character continues the word, so there is no \b here
+      return -1;
+    }
+    end = pos;
+    return m_nodes_[current].rule_idx;
+  }
+}
@@ -10,6 +10,12 @@
 namespace NS_SWEETLINE {
   struct SyntaxRuleRuntimeData {
     List<OnigRegex> file_name_pattern_regexes;
+    /// Compiled patterns of SyntaxRule::sync_rules, in the same order
+    List<OnigRegex> sync_regexes;
+    /// State rules indexed by state ID (nullptr for unused IDs), built from state_rules_map after compilation
+    List<const StateRule*> state_rule_table;
+    /// Inline styles indexed by style ID (nullptr for IDs without one), built from inline_styles after compilation
+    List<const InlineStyle*> inline_style_table;
   };
 
   namespace {
@@ -112,14 +118,63 @@ namespace NS_SWEETLINE {
       if (regex == nullptr) {
         return false;
       }
-      OnigRegion* region = onig_region_new();
       OnigUChar* text_ptr = reinterpret_cast<OnigUChar*>(const_cast<char*>(text.c_str()));
       OnigUChar* text_end = text_ptr + text.size();
-      int status = onig_search(regex, text_ptr, text_end, text_ptr, text_end, region, ONIG_OPTION_NONE);
-      onig_region_free(region, 1);
+      // Only the match status is needed, so no region is allocated
+      int status = onig_search(regex, text_ptr, text_end, text_ptr, text_end, nullptr, ONIG_OPTION_NONE);
       return status >= 0;
     }
 
+    /// Whether the pattern matches exactly one ASCII character, whichever it is, such as [\S\s]
+    bool isAnyAsciiCharPattern(const PatternTree& tree) {
+      const PatternNode* node = &tree.node(tree.root());
+      while (node->kind == PatternNodeKind::GROUP && !node->capturing && !node->atomic && node->children.size() == 1) {
+        node = &tree.node(node->children[0]);
+      }
+      return node->kind == PatternNodeKind::CHAR_SET && node->ascii.all();
+    }
+
+    /// Whether the pattern is a class of a shorthand and its complement, such as [\S\s] or [\w\W].
+    /// PatternTree only approximates non-ASCII characters, this is the exact form of "any character"
+    bool isAnyCharClassPattern(const U8String& pattern) {
+      if (pattern.size() != 6 || pattern[0] != '[' || pattern[1] != '\\' || pattern[3] != '\\' || pattern[5] != ']') {
+        return false;
+      }
+      unsigned char first = pattern[2];
+      unsigned char second = pattern[4];
+      return first != second && std::tolower(first) == std::tolower(second)
+        && std::strchr("sSwWdDhH", first) != nullptr;
+    }
+
+    bool containsSearchStartAnchor(const U8String& pattern_text) {
+      for (size_t i = 0; i + 1 < pattern_text.size(); ++i) {
+        if (pattern_text[i] != '\\') {
+          continue;
+        }
+        if (pattern_text[i + 1] == 'G') {
+          return true;
+        }
+        ++i;
+      }
+      return false;
+    }
+
+    /// Whether the pattern refers to capture groups by number or name (backreferences, subexpression calls),
+    /// whose meaning changes once the pattern is merged with others
+    bool containsGroupReference(const U8String& pattern_text) {
+      for (size_t i = 0; i + 1 < pattern_text.size(); ++i) {
+        if (pattern_text[i] != '\\') {
+          continue;
+        }
+        const char next = pattern_text[i + 1];
+        if ((next >= '1' && next <= '9') || next == 'k' || next == 'g') {
+          return true;
+        }
+        ++i;
+      }
+      return false;
+    }
+
     void freeRegex(OnigRegex regex) {
       if (regex != nullptr) {
         onig_free(regex);
@@ -129,11 +184,25 @@ namespace NS_SWEETLINE {
     void resetCompiledTokenRuleRuntime(TokenRule& token_rule) {
       token_rule.group_count = 0;
       token_rule.group_offset_start = 0;
+      token_rule.first_bytes.reset();
+      token_rule.keyword_list = false;
     }
 
     void clearCompiledStateRuntime(StateRule& state_rule) {
       state_rule.regex = nullptr;
       state_rule.group_count = 0;
+      state_rule.search_start_anchored = false;
+      state_rule.first_bytes.reset();
+      state_rule.has_first_byte_filter = false;
+      state_rule.keyword_trie.clear();
+      state_rule.alternative_groups.clear();
+      state_rule.alternative_rules.clear();
+      state_rule.regular_program = nullptr;
+      state_rule.alternative_regexes.clear();
+      state_rule.has_goto_rule = false;
+      state_rule.filler_rule = -1;
+      state_rule.filler_stop_bytes.reset();
+      state_rule.filler_stop_byte = -1;
       state_rule.merged_pattern.clear();
       for (TokenRule& token_rule : state_rule.token_rules) {
         resetCompiledTokenRuleRuntime(token_rule);
@@ -199,19 +268,17 @@ namespace NS_SWEETLINE {
 
   // ===================================== TokenRule ============================================
   int32_t TokenRule::getGroupStyleId(const int32_t group) const {
-    auto it = style_ids.find(group);
-    if (it == style_ids.end()) {
+    if (group < 0 || static_cast<size_t>(group) >= group_style_table.size()) {
       return kDefaultStyleId;
     }
-    return it->second;
+    return group_style_table[group];
   }
 
   int32_t TokenRule::getGroupSubState(const int32_t group) const {
-    auto it = sub_states.find(group);
-    if (it == sub_states.end()) {
+    if (group < 0 || static_cast<size_t>(group) >= group_sub_state_table.size()) {
       return -1;
     }
-    return it->second;
+    return group_sub_state_table[group];
   }
 
   int32_t TokenRule::kDefaultStyleId = 0;
@@ -265,6 +332,22 @@ namespace NS_SWEETLINE {
     return state_rules_map[state_id];
   }
 
+  const StateRule* SyntaxRule::findStateRule(int32_t state_id) const {
+    const List<const StateRule*>& state_rule_table = m_runtime_data_->state_rule_table;
+    if (state_id < 0 || static_cast<size_t>(state_id) >= state_rule_table.size()) {
+      return nullptr;
+    }
+    return state_rule_table[state_id];
+  }
+
+  const InlineStyle* SyntaxRule::findInlineStyle(int32_t style_id) const {
+    const List<const InlineStyle*>& inline_style_table = m_runtime_data_->inline_style_table;
+    if (style_id <= 0 || static_cast<size_t>(style_id) >= inline_style_table.size()) {
+      return nullptr;
+    }
+    return inline_style_table[style_id];
+  }
+
   bool SyntaxRule::matchesFileNamePattern(const U8String& file_name, size_t index) const {
     if (m_runtime_data_ == nullptr || index >= m_runtime_data_->file_name_pattern_regexes.size()) {
       return false;
@@ -272,6 +355,19 @@ namespace NS_SWEETLINE {
     return matchesRegex(m_runtime_data_->file_name_pattern_regexes[index], file_name);
   }
 
+  int32_t SyntaxRule::matchSyncState(const U8String& line_text) const {
+    if (m_runtime_data_ == nullptr) {
+      return -1;
+    }
+    const size_t sync_count = std::min(sync_rules.size(), m_runtime_data_->sync_regexes.size());
+    for (size_t i = 0; i < sync_count; ++i) {
+      if (matchesRegex(m_runtime_data_->sync_regexes[i], line_text)) {
+        return sync_rules[i].state;
+      }
+    }
+    return -1;
+  }
+
   SyntaxRule::SyntaxRule(): m_runtime_data_(makeUniquePtr<SyntaxRuleRuntimeData>()) {
     state_id_map.insert_or_assign(kDefaultStateName, kDefaultStateId);
   }
@@ -280,6 +376,10 @@ namespace NS_SWEETLINE {
     for (auto& [state_id, state_rule] : state_rules_map) {
       freeRegex(state_rule.regex);
       state_rule.regex = nullptr;
+      for (OnigRegex regex : state_rule.alternative_regexes) {
+        freeRegex(regex);
+      }
+      state_rule.alternative_regexes.clear();
     }
     if (m_runtime_data_ == nullptr) {
       return;
@@ -288,6 +388,10 @@ namespace NS_SWEETLINE {
       freeRegex(regex);
     }
     m_runtime_data_->file_name_pattern_regexes.clear();
+    for (OnigRegex regex : m_runtime_data_->sync_regexes) {
+      freeRegex(regex);
+    }
+    m_runtime_data_->sync_regexes.clear();
   }
 
 #ifdef SWEETLINE_DEBUG
@@ -341,8 +445,9 @@ namespace NS_SWEETLINE {
   }
 
   // ===================================== SyntaxRuleCompiler ============================================
-  SyntaxRuleCompiler::SyntaxRuleCompiler(const SharedPtr<StyleMapping>& style_mapping, bool inline_style, HighlightEngine* engine)
-    : m_style_mapping_(style_mapping), m_inline_style_(inline_style), m_engine_(engine) {
+  SyntaxRuleCompiler::SyntaxRuleCompiler(const SharedPtr<StyleMapping>& style_mapping, bool inline_style, HighlightEngine* engine,
+    bool rule_scanner)
+    : m_style_mapping_(style_mapping), m_inline_style_(inline_style), m_engine_(engine), m_rule_scanner_(rule_scanner) {
   }
 
   SharedPtr<SyntaxRule> SyntaxRuleCompiler::compileSyntaxFromJson(const U8String& json) {
@@ -373,6 +478,8 @@ namespace NS_SWEETLINE {
     // Parse structure rules after state compilation.
     parseScopeRules(syntax_rule, root);
     parseBracketRules(syntax_rule, root);
+    parseSyncRules(syntax_rule, root);
+    buildRuleTables(syntax_rule);
 #ifdef SWEETLINE_DEBUG
     //syntax_rule->dump();
 #endif
@@ -982,11 +1089,62 @@ namespace NS_SWEETLINE {
     }
   }
 
-  void SyntaxRuleCompiler::compileStatePattern(StateRule& state_rule) {
+  void SyntaxRuleCompiler::parseSyncRules(const SharedPtr<SyntaxRule>& rule, nlohmann::json& root) {
+    if (!root.contains("sync")) {
+      return;
+    }
+    const nlohmann::json& sync_json = root["sync"];
+    if (!sync_json.is_array()) {
+      throw SyntaxCompileError(SyntaxCompileError::ERR_JSON_PROPERTY_INVALID, "sync");
+    }
+    for (const nlohmann::json& sync_rule_json : sync_json) {
+      if (!sync_rule_json.is_object()) {
+        throw SyntaxCompileError(SyntaxCompileError::ERR_JSON_PROPERTY_INVALID, "sync[]");
+      }
+      if (!sync_rule_json.contains("pattern")) {
+        throw SyntaxCompileError(SyntaxCompileError::ERR_JSON_PROPERTY_MISSED, "sync[].pattern");
+      }
+      if (!sync_rule_json["pattern"].is_string() || sync_rule_json["pattern"].get<U8String>().empty()) {
+        throw SyntaxCompileError(SyntaxCompileError::ERR_JSON_PROPERTY_INVALID, "sync[].pattern");
+      }
+      SyncRule sync_rule;
+      sync_rule.pattern = sync_rule_json["pattern"];
+      replaceVariable(sync_rule.pattern, rule->variables_map);
+      sync_rule.state_str = SyntaxRule::kDefaultStateName;
+      if (sync_rule_json.contains("state")) {
+        if (!sync_rule_json["state"].is_string()) {
+          throw SyntaxCompileError(SyntaxCompileError::ERR_JSON_PROPERTY_INVALID, "sync[].state");
+        }
+        sync_rule.state_str = sync_rule_json["state"];
+      }
+      auto state_it = rule->state_id_map.find(sync_rule.state_str);
+      if (state_it == rule->state_id_map.end() || !rule->containsRule(state_it->second)) {
+        throw SyntaxCompileError(SyntaxCompileError::ERR_STATE_REFERENCE_NOT_FOUND, "sync: " + sync_rule.state_str);
+      }
+      sync_rule.state = state_it->second;
+      rule->m_runtime_data_->sync_regexes.push_back(
+        compileRegexOrThrow(sync_rule.pattern, "sync: " + sync_rule.pattern));
+      rule->sync_rules.push_back(std::move(sync_rule));
+    }
+  }
+
+  void SyntaxRuleCompiler::compileStatePattern(StateRule& state_rule) const {
     freeRegex(state_rule.regex);
     state_rule.regex = nullptr;
+    state_rule.keyword_trie.clear();
+    state_rule.alternative_groups.clear();
+    state_rule.alternative_rules.clear();
+    state_rule.regular_program = nullptr;
+    state_rule.has_goto_rule = false;
+    state_rule.filler_rule = -1;
+    state_rule.filler_stop_bytes.reset();
+    state_rule.filler_stop_byte = -1;
     U8String merged_pattern;
     int32_t total_group_count {0};
+    ByteSet state_first_bytes;
+    bool has_merged_token {false};
+    List<U8String> keywords;
+    List<PatternTree> alternative_trees;
     size_t token_size = state_rule.token_rules.size();
     // Merge all token patterns into one combined regex pattern
     for (size_t i = 0; i < token_size; ++i) {
@@ -998,20 +1156,128 @@ namespace NS_SWEETLINE {
         throw SyntaxCompileError(SyntaxCompileError::ERR_PATTERN_INVALID, err + ": " + token_rule.pattern);
       }
       token_rule.group_count = group_count;
+      PatternTree pattern_tree = PatternTree::parse(token_rule.pattern);
+      token_rule.first_bytes = pattern_tree.matchStartBytes();
+      state_first_bytes |= token_rule.first_bytes;
+      state_rule.has_goto_rule = state_rule.has_goto_rule || token_rule.goto_state >= 0;
+      if (state_rule.filler_rule < 0 && token_rule.group_count == 0 && token_rule.goto_state < 0
+        && token_rule.sub_states.empty() && isAnyAsciiCharPattern(pattern_tree)) {
+        state_rule.filler_rule = static_cast<int32_t>(i);
+        if (!isAnyCharClassPattern(token_rule.pattern)) {
+          // Non-ASCII characters are left to the regex
+          for (size_t byte = 0x80; byte < 0x100; ++byte) {
+            state_rule.filler_stop_bytes.set(byte);
+          }
+        }
+      } else if (state_rule.filler_rule < 0) {
+        state_rule.filler_stop_bytes |= token_rule.first_bytes;
+      }
+      // Keyword lists go to the trie, which keeps their rule index to resolve ties with the merged pattern
+      if (token_rule.sub_states.empty() && pattern_tree.extractKeywordList(keywords)) {
+        token_rule.keyword_list = true;
+        for (const U8String& keyword : keywords) {
+          state_rule.keyword_trie.addWord(keyword, static_cast<int32_t>(i));
+        }
+        continue;
+      }
       token_rule.group_offset_start = 1 + total_group_count;
       total_group_count += 1 + token_rule.group_count;
-      if (i > 0) {
+      state_rule.alternative_groups.push_back(token_rule.group_offset_start);
+      state_rule.alternative_rules.push_back(static_cast<int32_t>(i));
+      if (has_merged_token) {
         merged_pattern += "|";
       }
+      has_merged_token = true;
       merged_pattern += "(";
       merged_pattern += token_rule.pattern;
       merged_pattern += ")";
+      alternative_trees.push_back(std::move(pattern_tree));
     }
     state_rule.group_count = total_group_count;
-    state_rule.regex = compileRegexOrThrow(merged_pattern, merged_pattern);
+    state_rule.search_start_anchored = containsSearchStartAnchor(merged_pattern);
+    if (state_rule.search_start_anchored) {
+      // Moving the search start would change where \G matches
+      state_first_bytes.set();
+    }
+    state_rule.first_bytes = state_first_bytes;
+    state_rule.has_first_byte_filter = !state_first_bytes.all();
+    if (state_rule.search_start_anchored || state_rule.filler_stop_bytes.all()) {
+      // Every position may start another rule, the filler has to be matched one character at a time
+      state_rule.filler_rule = -1;
+      state_rule.filler_stop_bytes.reset();
+    } else if (state_rule.filler_rule >= 0 && state_rule.filler_stop_bytes.count() == 1) {
+      for (int32_t byte = 0; byte < 256; ++byte) {
+        if (state_rule.filler_stop_bytes.test(byte)) {
+          state_rule.filler_stop_byte = byte;
+        }
+      }
+    }
+    // A state without any token keeps its empty regex, only a state made of keyword lists needs none
+    if (has_merged_token || state_rule.keyword_trie.empty()) {
+      state_rule.regex = compileRegexOrThrow(merged_pattern, merged_pattern);
+    }
+    if (has_merged_token && !state_rule.search_start_anchored) {
+      List<const PatternTree*> alternatives;
+      for (const PatternTree& tree : alternative_trees) {
+        alternatives.push_back(&tree);
+      }
+      state_rule.regular_program = RegularProgram::compile(alternatives);
+    }
+    if (m_rule_scanner_ && state_rule.alternative_rules.size() > 1 && !state_rule.search_start_anchored
+      && !containsGroupReference(merged_pattern)) {
+      for (int32_t rule_idx : state_rule.alternative_rules) {
+        const U8String& pattern = state_rule.token_rules[rule_idx].pattern;
+        state_rule.alternative_regexes.push_back(compileRegexOrThrow(pattern, pattern));
+      }
+    }
     state_rule.merged_pattern = std::move(merged_pattern);
   }
 
+  void SyntaxRuleCompiler::buildRuleTables(const SharedPtr<SyntaxRule>& rule) {
+    int32_t max_state_id = -1;
+    for (const auto& [state_id, state_rule] : rule->state_rules_map) {
+      max_state_id = std::max(max_state_id, state_id);
+    }
+    List<const StateRule*>& state_rule_table = rule->m_runtime_data_->state_rule_table;
+    state_rule_table.assign(max_state_id + 1, nullptr);
+    for (auto& [state_id, state_rule] : rule->state_rules_map) {
+      state_rule_table[state_id] = &state_rule;
+      for (TokenRule& token_rule : state_rule.token_rules) {
+        // Keys outside the token's groups are kept, so lookups answer exactly as the maps would
+        int32_t max_group = token_rule.group_count;
+        for (const auto& [group, _] : token_rule.style_ids) {
+          max_group = std::max(max_group, group);
+        }
+        for (const auto& [group, _] : token_rule.sub_states) {
+          max_group = std::max(max_group, group);
+        }
+        token_rule.group_style_table.assign(max_group + 1, TokenRule::kDefaultStyleId);
+        token_rule.group_sub_state_table.assign(max_group + 1, -1);
+        for (const auto& [group, style_id] : token_rule.style_ids) {
+          if (group >= 0) {
+            token_rule.group_style_table[group] = style_id;
+          }
+        }
+        for (const auto& [group, sub_state] : token_rule.sub_states) {
+          if (group >= 0) {
+            token_rule.group_sub_state_table[group] = sub_state;
+          }
+        }
+      }
+    }
+    int32_t max_style_id = 0;
+    for (const auto& [style_id, _] : rule->inline_styles) {
+      max_style_id = std::max(max_style_id, style_id);
+    }
+    List<const InlineStyle*>& inline_style_table = rule->m_runtime_data_->inline_style_table;
+    inline_style_table.assign(max_style_id + 1, nullptr);
+    for (const auto& [style_id, inline_style] : rule->inline_styles) {
+      if (style_id > 0) {
+        inline_style_table[style_id] = &inline_style;
+      }
+    }
+  }
+
   void SyntaxRuleCompiler::processImportSyntaxRequests(const SharedPtr<SyntaxRule>& rule) {
     struct PendingImportState {
       int32_t state_id {SyntaxRule::kDefaultStateId};
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <filesystem>
 #include <cstdio>
+#include <cstring>
 #include <vector>
 #include <utf8/utf8.h>
 #include <codecvt>
@@ -12,6 +14,14 @@
 #include <oniguruma/oniguruma.h>
 #include "sweetline/util.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SWEETLINE_UTF8_SSE2 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SWEETLINE_UTF8_NEON 1
+#endif
+
 #ifdef _WIN32
 std::string windowsGBKToUTF8(const std::string& gbk_str) {
   if (gbk_str.empty()) {
@@ -80,23 +90,272 @@ std::string convertEncoding(const std::string& input,
 
 namespace NS_SWEETLINE {
   // ===================================== Utf8Util ============================================
+  namespace {
+    /// Chunk width of the vectorized scans
+    constexpr size_t kUtf8ChunkSize = 16;
+    /// Bytes with the high bits 10 continue a multi-byte sequence
+    constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+    inline bool isContinuationByte(unsigned char byte) {
+      return (byte & 0xC0) == 0x80;
+    }
+
+    inline uint32_t countSetBits(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+      return static_cast<uint32_t>(__builtin_popcountll(value));
+#else
+      value = value - ((value >> 1) & 0x5555555555555555ULL);
+      value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+      value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+      return static_cast<uint32_t>((value * 0x0101010101010101ULL) >> 56);
+#endif
+    }
+
+    /// Index of the lowest set bit, value must not be 0
+    inline uint32_t lowestSetBit(uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+      return static_cast<uint32_t>(__builtin_ctz(value));
+#else
+      uint32_t index = 0;
+      while ((value & 1) == 0) {
+        value >>= 1;
+        ++index;
+      }
+      return index;
+#endif
+    }
+
+    /// Number of bytes in an 8-byte word that start a character
+    inline uint32_t countLeadBytesInWord(uint64_t word) {
+      // A continuation byte has bit 7 set and bit 6 clear, the shift moves bit 6 onto bit 7 of the same byte
+      return 8 - countSetBits(word & ~(word << 1) & kHighBits);
+    }
+
+#if defined(SWEETLINE_UTF8_SSE2)
+    /// Bit i is set when byte i of the chunk starts a character
+    inline uint32_t leadByteMask(const char* chunk) {
+      const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(chunk));
+      // As signed bytes, continuation bytes 0x80..0xBF are exactly those <= (int8_t)0xBF
+      return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(static_cast<char>(0xBF)))));
+    }
+#elif defined(SWEETLINE_UTF8_NEON)
+    inline uint32_t countLeadBytesInChunk(const char* chunk) {
+      const int8x16_t bytes = vld1q_s8(reinterpret_cast<const int8_t*>(chunk));
+      const uint8x16_t leads = vcgtq_s8(bytes, vdupq_n_s8(static_cast<int8_t>(0xBF)));
+      return vaddvq_u8(vshrq_n_u8(leads, 7));
+    }
+#endif
+
+    /// Number of bytes in the range that are not continuation bytes, which is the character count of valid UTF-8
+    size_t countLeadBytes(const char* begin, const char* end) {
+      size_t count = 0;
+      const char* it = begin;
+#if defined(SWEETLINE_UTF8_SSE2)
+      const __m128i continuation_max = _mm_set1_epi8(static_cast<char>(0xBF));
+      while (static_cast<size_t>(end - it) >= kUtf8ChunkSize) {
+        // Per-byte counters are summed before any of them can wrap around
+        const size_t chunk_count = std::min<size_t>((end - it) / kUtf8ChunkSize, 255);
+        __m128i counters = _mm_setzero_si128();
+        for (size_t i = 0; i < chunk_count; ++i, it += kUtf8ChunkSize) {
+          const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+          counters = _mm_sub_epi8(counters, _mm_cmpgt_epi8(bytes, continuation_max));
+        }
+        const __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+        count += static_cast<size_t>(_mm_cvtsi128_si32(sums)) + static_cast<size_t>(_mm_extract_epi16(sums, 4));
+      }
+#elif defined(SWEETLINE_UTF8_NEON)
+      const int8x16_t continuation_max = vdupq_n_s8(static_cast<int8_t>(0xBF));
+      while (static_cast<size_t>(end - it) >= kUtf8ChunkSize) {
+        const size_t chunk_count = std::min<size_t>((end - it) / kUtf8ChunkSize, 255);
+        uint8x16_t counters = vdupq_n_u8(0);
+        for (size_t i = 0; i < chunk_count; ++i, it += kUtf8ChunkSize) {
+          const int8x16_t bytes = vld1q_s8(reinterpret_cast<const int8_t*>(it));
+          counters = vsubq_u8(counters, vcgtq_s8(bytes, continuation_max));
+        }
+        count += vaddlvq_u8(counters);
+      }
+#endif
+      for (; end - it >= 8; it += 8) {
+        uint64_t word;
+        std::memcpy(&word, it, sizeof(word));
+        count += countLeadBytesInWord(word);
+      }
+      for (; it != end; ++it) {
+        if (!isContinuationByte(static_cast<unsigned char>(*it))) {
+          ++count;
+        }
+      }
+      return count;
+    }
+
+    /// Find the lead byte with the given index in the range, counting from 0, or end if there are not as many
+    const char* findLeadByte(const char* begin, const char* end, size_t index) {
+      const char* it = begin;
+      size_t seen = 0;
+#if defined(SWEETLINE_UTF8_SSE2) || defined(SWEETLINE_UTF8_NEON)
+      while (static_cast<size_t>(end - it) >= kUtf8ChunkSize) {
+#if defined(SWEETLINE_UTF8_SSE2)
+        const uint32_t chunk_leads = countSetBits(leadByteMask(it));
+#else
+        const uint32_t chunk_leads = countLeadBytesInChunk(it);
+#endif
+        if (seen + chunk_leads > index) {
+          break;
+        }
+        seen += chunk_leads;
+        it += kUtf8ChunkSize;
+      }
+#endif
+      for (; end - it >= 8; it += 8) {
+        uint64_t word;
+        std::memcpy(&word, it, sizeof(word));
+        const uint32_t word_leads = countLeadBytesInWord(word);
+        if (seen + word_leads > index) {
+          break;
+        }
+        seen += word_leads;
+      }
+      for (; it != end; ++it) {
+        if (!isContinuationByte(static_cast<unsigned char>(*it))) {
+          if (seen == index) {
+            return it;
+          }
+          ++seen;
+        }
+      }
+      return end;
+    }
+
+    /// Skip the ASCII bytes at the start of the range
+    const unsigned char* skipAscii(const unsigned char* it, const unsigned char* end) {
+#if defined(SWEETLINE_UTF8_SSE2)
+      while (static_cast<size_t>(end - it) >= kUtf8ChunkSize) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+        const uint32_t non_ascii = static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+        if (non_ascii != 0) {
+          return it + lowestSetBit(non_ascii);
+        }
+        it += kUtf8ChunkSize;
+      }
+#elif defined(SWEETLINE_UTF8_NEON)
+      while (static_cast<size_t>(end - it) >= kUtf8ChunkSize) {
+        if (vmaxvq_u8(vld1q_u8(it)) >= 0x80) {
+          break;
+        }
+        it += kUtf8ChunkSize;
+      }
+#endif
+      for (; end - it >= 8; it += 8) {
+        uint64_t word;
+        std::memcpy(&word, it, sizeof(word));
+        if ((word & kHighBits) != 0) {
+          break;
+        }
+      }
+      while (it != end && *it < 0x80) {
+        ++it;
+      }
+      return it;
+    }
+
+    /// Whether the range is well-formed UTF-8 by the rules utfcpp applies: no stray continuation bytes,
+    /// no truncated, overlong or surrogate sequences and nothing above U+10FFFF
+    bool isWellFormedUtf8(const char* begin, const char* end) {
+      const auto* it = reinterpret_cast<const unsigned char*>(begin);
+      const auto* last = reinterpret_cast<const unsigned char*>(end);
+      while (it != last) {
+        if (*it < 0x80) {
+          it = skipAscii(it, last);
+          continue;
+        }
+        // Runs of 3-byte sequences whose second byte may take any continuation value, most of CJK text
+        while (last - it >= 3 && static_cast<unsigned char>(it[0] - 0xE1) <= 0xEF - 0xE1 && it[0] != 0xED
+          && isContinuationByte(it[1]) && isContinuationByte(it[2])) {
+          it += 3;
+        }
+        if (it == last || *it < 0x80) {
+          continue;
+        }
+        const unsigned char lead = *it;
+        const size_t remaining = static_cast<size_t>(last - it);
+        if (lead < 0xC2) {
+          // A continuation byte, or the lead of an overlong 2-byte sequence
+          return false;
+        }
+        if (lead < 0xE0) {
+          if (remaining < 2 || !isContinuationByte(it[1])) {
+            return false;
+          }
+          it += 2;
+        } else if (lead < 0xF0) {
+          // E0 would be overlong below A0, ED would encode surrogates from A0
+          const unsigned char second_min = lead == 0xE0 ? 0xA0 : 0x80;
+          const unsigned char second_max = lead == 0xED ? 0x9F : 0xBF;
+          if (remaining < 3 || it[1] < second_min || it[1] > second_max || !isContinuationByte(it[2])) {
+            return false;
+          }
+          it += 3;
+        } else if (lead < 0xF5) {
+          // F0 would be overlong below 90, F4 would exceed U+10FFFF from 90
+          const unsigned char second_min = lead == 0xF0 ? 0x90 : 0x80;
+          const unsigned char second_max = lead == 0xF4 ? 0x8F : 0xBF;
+          if (remaining < 4 || it[1] < second_min || it[1] > second_max
+            || !isContinuationByte(it[2]) || !isContinuationByte(it[3])) {
+            return false;
+          }
+          it += 4;
+        } else {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+
+  // Well-formed text takes the vectorized paths. Anything else is walked by utfcpp as before,
+  // so results and exceptions on malformed text stay the same.
   size_t Utf8Util::countChars(const U8String& str) {
-    return utf8::distance(str.begin(), str.end());
+    return countChars(str.data(), str.data() + str.size());
+  }
+
+  size_t Utf8Util::countChars(const char* begin, const char* end) {
+    if (isWellFormedUtf8(begin, end)) {
+      return countLeadBytes(begin, end);
+    }
+    return utf8::distance(begin, end);
+  }
+
+  const char* Utf8Util::advanceChars(const char* it, const char* end, size_t char_count) {
+    const char* target = findLeadByte(it, end, char_count);
+    if (isWellFormedUtf8(it, target)) {
+      return target;
+    }
+    for (size_t i = 0; i < char_count && it != end; ++i) {
+      utf8::next(it, end);
+    }
+    return it;
   }
   
   size_t Utf8Util::charPosToBytePos(const U8String& str, size_t char_pos) {
     if (char_pos == 0) return 0;
-
-    auto it = str.begin();
-    for (size_t i = 0; i < char_pos && it != str.end(); ++i) {
-      utf8::next(it, str.end());
-    }
-    return it - str.begin();
+    return advanceChars(str.data(), str.data() + str.size(), char_pos) - str.data();
   }
   
   size_t Utf8Util::bytePosToCharPos(const U8String& str, size_t byte_pos) {
     if (byte_pos == 0) return 0;
 
+    const char* begin = str.data();
+    const char* end = begin + str.size();
+    const char* stop = begin + std::min(byte_pos, str.size());
+    // The character that contains byte_pos is read to its end
+    const char* boundary = stop;
+    while (boundary != end && isContinuationByte(static_cast<unsigned char>(*boundary))) {
+      ++boundary;
+    }
+    if (isWellFormedUtf8(begin, boundary)) {
+      return countLeadBytes(begin, stop);
+    }
+
     size_t char_count = 0;
     auto it = str.begin();
     while (it != str.end() && (it - str.begin()) < static_cast<ptrdiff_t>(byte_pos)) {
@@ -107,25 +366,50 @@ namespace NS_SWEETLINE {
   }
   
   U8String Utf8Util::utf8Substr(const U8String& str, size_t start_char, size_t char_count) {
-    auto start_it = str.begin();
-    auto end_it = str.begin();
-
-    // Move to start character
-    for (size_t i = 0; i < start_char && start_it != str.end(); ++i) {
-      utf8::next(start_it, str.end());
-    }
-
-    // Move to end character
-    end_it = start_it;
-    for (size_t i = 0; i < char_count && end_it != str.end(); ++i) {
-      utf8::next(end_it, str.end());
-    }
-
+    const char* end = str.data() + str.size();
+    const char* start_it = advanceChars(str.data(), end, start_char);
+    const char* end_it = advanceChars(start_it, end, char_count);
     return {start_it, end_it};
   }
   
   bool Utf8Util::isValidUTF8(const U8String& str) {
-    return utf8::is_valid(str.begin(), str.end());
+    return isWellFormedUtf8(str.data(), str.data() + str.size());
+  }
+
+  bool Utf8Util::isAscii(const U8String& str) {
+    return isAscii(str.data(), str.size());
+  }
+
+  bool Utf8Util::isAscii(const char* str, size_t length) {
+    size_t i = 0;
+#if defined(SWEETLINE_UTF8_SSE2)
+    for (; i + 16 <= length; i += 16) {
+      const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+      if (_mm_movemask_epi8(chunk) != 0) {
+        return false;
+      }
+    }
+#elif defined(SWEETLINE_UTF8_NEON)
+    for (; i + 16 <= length; i += 16) {
+      const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(str + i));
+      if (vmaxvq_u8(chunk) >= 0x80) {
+        return false;
+      }
+    }
+#endif
+    for (; i + 8 <= length; i += 8) {
+      uint64_t word;
+      std::memcpy(&word, str + i, sizeof(word));
+      if ((word & 0x8080808080808080ULL) != 0) {
+        return false;
+      }
+    }
+    for (; i < length; ++i) {
+      if ((static_cast<unsigned char>(str[i]) & 0x80) != 0) {
+        return false;
+      }
+    }
+    return true;
   }
 
   // ======================================== StrUtil =================================================
@@ -0,0 +1,110 @@
+#include <cstdlib>
+#include <new>
+#include <catch2/catch_amalgamated.hpp>
+#include "sweetline/highlight.h"
+#include "sweetline/util.h"
+#include "test_helpers.h"
+
+using namespace NS_SWEETLINE;
+using namespace NS_SWEETLINE_TEST;
+
+namespace {
+  /// Heap allocations of the current thread while counting is on
+  thread_local size_t g_allocation_count = 0;
+  thread_local bool g_count_allocations = false;
+
+  void* countedAllocate(std::size_t size) {
+    if (g_count_allocations) {
+      ++g_allocation_count;
+    }
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+      throw std::bad_alloc();
+    }
+    return ptr;
+  }
+
+  /// Count the heap allocations made by a callable on this thread
+  template<typename Func>
+  size_t countAllocations(Func&& func) {
+    g_allocation_count = 0;
+    g_count_allocations = true;
+    func();
+    g_count_allocations = false;
+    return g_allocation_count;
+  }
+}
+
+// Replacing the global allocation functions affects the whole binary, so this file has its own test executable
+void* operator new(std::size_t size) {
+  return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size) {
+  return countedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+TEST_CASE("Line analysis allocates nothing once the analyzer and the result are warm") {
+  // With matched text kept, the spans reuse the strings of the spans they replace
+  for (bool keep_matched_text : {true, false}) {
+    CAPTURE(keep_matched_text);
+    HighlightConfig config;
+    config.keep_matched_text = keep_matched_text;
+    SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+    REQUIRE_NOTHROW(engine->compileSyntaxFromFile(SYNTAX_DIR"/java.json"));
+    REQUIRE_NOTHROW(engine->compileSyntaxFromFile(SYNTAX_DIR"/cpp.json"));
+
+    for (const U8String& file_name : {U8String("example.java"), U8String("example.cpp")}) {
+      CAPTURE(file_name);
+      SharedPtr<TextAnalyzer> analyzer = engine->createAnalyzerByFileName(file_name);
+      REQUIRE(analyzer != nullptr);
+      U8String text = FileUtil::readString(TESTS_DIR"/files/" + file_name);
+      REQUIRE_FALSE(text.empty());
+      SharedPtr<DocumentHighlight> expected = analyzer->analyzeText(text);
+      Document document(file_name, text);
+      REQUIRE(document.getLineCount() == expected->lines.size());
+
+      // One result is reused for every line, its spans are replaced each time
+      LineAnalyzeResult result;
+      for (int pass = 0; pass < 3; ++pass) {
+        CAPTURE(pass);
+        int32_t state = SyntaxRule::kDefaultStateId;
+        size_t line_start_index = 0;
+        size_t allocating_lines = 0;
+        for (size_t line = 0; line < document.getLineCount(); ++line) {
+          const DocumentLine& document_line = document.getLine(line);
+          TextLineInfo info = {line, state, line_start_index};
+          size_t allocations = countAllocations([&] {
+            analyzer->analyzeLine(document_line.text, info, result);
+          });
+          if (allocations > 0) {
+            ++allocating_lines;
+          }
+          CHECK(result.highlight == expected->lines[line]);
+          state = result.end_state;
+          line_start_index += result.char_count + Document::getLineEndingWidth(document_line.ending);
+        }
+        // The first pass builds the scratch buffers, DFA states and span capacity
+        if (pass > 0) {
+          CHECK(allocating_lines == 0);
+        }
+      }
+    }
+  }
+}
@@ -110,3 +110,82 @@ TEST_CASE("C API passes tab size to indent guide analysis") {
   CHECK(sl_free_text_analyzer(analyzer) == SL_OK);
   CHECK(sl_free_engine(engine) == SL_OK);
 }
+
+TEST_CASE("C API analyzes a line inside a larger buffer by explicit length") {
+  sl_engine_handle_t engine = sl_create_engine(false, false, 4);
+  REQUIRE(engine != nullptr);
+  REQUIRE(sl_engine_compile_json(engine, kDocumentSyntax).err_code == SL_OK);
+
+  sl_analyzer_handle_t analyzer = sl_engine_create_text_analyzer(engine, "cApiDocument");
+  REQUIRE(analyzer != nullptr);
+
+  int32_t line_info[3] = {0, 0, 0};
+  int32_t* expected = sl_text_analyze_line(analyzer, "x first", line_info);
+  REQUIRE(expected != nullptr);
+  REQUIRE(expected[2] == 1);
+
+  // The line is followed by more text and no terminator, as in a host's own gap buffer
+  const char buffer[] = "x first first first";
+  int32_t* result = sl_text_analyze_line_with_length(analyzer, buffer, 7, line_info);
+  REQUIRE(result != nullptr);
+  const int32_t size = 5 + expected[1] * expected[2];
+  for (int32_t i = 0; i < size; ++i) {
+    CAPTURE(i);
+    CHECK(result[i] == expected[i]);
+  }
+  CHECK(sl_text_analyze_line_with_length(analyzer, nullptr, 1, line_info) == nullptr);
+  CHECK(sl_text_analyze_line_with_length(analyzer, buffer, -1, line_info) == nullptr);
+
+  sl_free_buffer(result);
+  sl_free_buffer(expected);
+  CHECK(sl_free_text_analyzer(analyzer) == SL_OK);
+  CHECK(sl_free_engine(engine) == SL_OK);
+}
+
+TEST_CASE("C API applies a batch of edits in one incremental analysis") {
+  sl_engine_handle_t engine = sl_create_engine(false, false, 4);
+  REQUIRE(engine != nullptr);
+  REQUIRE(sl_engine_compile_json(engine, kDocumentSyntax).err_code == SL_OK);
+
+  sl_document_handle_t document = sl_create_document("batch.remove", "first\nsecond\nthird");
+  sl_document_handle_t expected_document = sl_create_document("expected.remove", "x first\nfirst\nthird first");
+  sl_analyzer_handle_t analyzer = sl_engine_load_document(engine, document);
+  sl_analyzer_handle_t expected_analyzer = sl_engine_load_document(engine, expected_document);
+  REQUIRE(analyzer != nullptr);
+  REQUIRE(expected_analyzer != nullptr);
+  sl_free_buffer(sl_document_analyze(analyzer));
+
+  // Ranges refer to the text before the batch and may come in any order
+  int32_t changes_ranges[] = {2, 5, 2, 5, 1, 0, 1, 6, 0, 0, 0, 0};
+  const char* new_texts[] = {" first", "first", "x "};
+  int32_t* result = sl_document_analyze_incremental_batch(analyzer, changes_ranges, new_texts, 3);
+  int32_t* expected = sl_document_analyze(expected_analyzer);
+  REQUIRE(result != nullptr);
+  REQUIRE(expected != nullptr);
+  REQUIRE(result[2] == 3);
+  REQUIRE(expected[2] == 3);
+  const int32_t size = 3 + 3 + expected[1] * 3;
+  for (int32_t i = 0; i < size; ++i) {
+    CAPTURE(i);
+    CHECK(result[i] == expected[i]);
+  }
+
+  int32_t overlapping_ranges[] = {0, 0, 0, 3, 0, 2, 0, 2};
+  const char* overlapping_texts[] = {"a", "b"};
+  CHECK(sl_document_analyze_incremental_batch(analyzer, overlapping_ranges, overlapping_texts, 2) == nullptr);
+  int32_t visible_range[] = {1, 1};
+  int32_t* slice = sl_document_analyze_incremental_batch_in_line_range(analyzer, nullptr, nullptr, 0, visible_range);
+  REQUIRE(slice != nullptr);
+  CHECK(slice[2] == 1);
+  CHECK(slice[4] == 1);
+  CHECK(slice[5] == 1);
+
+  sl_free_buffer(slice);
+  sl_free_buffer(result);
+  sl_free_buffer(expected);
+  CHECK(sl_free_document_analyzer(analyzer) == SL_OK);
+  CHECK(sl_free_document_analyzer(expected_analyzer) == SL_OK);
+  CHECK(sl_free_document(document) == SL_OK);
+  CHECK(sl_free_document(expected_document) == SL_OK);
+  CHECK(sl_free_engine(engine) == SL_OK);
+}
@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
 #include <catch2/catch_amalgamated.hpp>
 #include "sweetline/highlight.h"
+#include "sweetline/util.h"
 #include "test_helpers.h"
 
 using namespace NS_SWEETLINE;
@@ -85,3 +89,719 @@ TEST_CASE("Host syntaxes keep every embedded importSyntax state active") {
   CHECK(styleAtColumn(highlight->lines[1], 0) == kKeyword);
   CHECK(styleAtColumn(highlight->lines[4], 0) == kKeyword);
 }
+
+TEST_CASE("keep_matched_text only controls TokenSpan::matched_text") {
+  const U8String text = "let 变量 = \"字符串\" + 42\n";
+
+  SharedPtr<HighlightEngine> keep_engine = makeTestHighlightEngine();
+  compileLetCommentSyntax(keep_engine);
+  SharedPtr<DocumentHighlight> kept = keep_engine->createAnalyzerBySyntaxName("let-comment")->analyzeText(text);
+
+  HighlightConfig config;
+  config.keep_matched_text = false;
+  SharedPtr<HighlightEngine> drop_engine = makeTestHighlightEngine(config);
+  compileLetCommentSyntax(drop_engine);
+  SharedPtr<DocumentHighlight> dropped = drop_engine->createAnalyzerBySyntaxName("let-comment")->analyzeText(text);
+
+  REQUIRE(kept != nullptr);
+  REQUIRE(dropped != nullptr);
+  REQUIRE(kept->lines.size() == dropped->lines.size());
+  CHECK(kept->lines[0] == dropped->lines[0]);
+  REQUIRE(kept->lines[0].spans.size() == 4);
+  CHECK(kept->lines[0].spans[2].matched_text == "\"字符串\"");
+  CHECK(kept->lines[0].spans[3].matched_text == "42");
+  for (const TokenSpan& span : dropped->lines[0].spans) {
+    CHECK(span.matched_text.empty());
+  }
+}
+
+TEST_CASE("Unmatched line tail stays unstyled and \\G rules still retry per character") {
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(R"JSON(
+{
+  "name": "search-anchor",
+  "fileSuffixes": [".anchor"],
+  "states": {
+    "default": [
+      { "pattern": "\\d+", "style": "number", "state": "anchored" }
+    ],
+    "anchored": [
+      { "pattern": "\\G,", "style": "punctuation" },
+      { "pattern": "\\Gx", "style": "keyword", "state": "default" }
+    ]
+  }
+}
+)JSON"));
+  constexpr int32_t kKeyword = 1;
+  constexpr int32_t kNumber = 3;
+  constexpr int32_t kPunctuation = 8;
+
+  SharedPtr<TextAnalyzer> analyzer = engine->createAnalyzerBySyntaxName("search-anchor");
+  REQUIRE(analyzer != nullptr);
+
+  LineAnalyzeResult plain;
+  analyzer->analyzeLine("no digits in this 文本", {0, SyntaxRule::kDefaultStateId, 0}, plain);
+  CHECK(plain.highlight.spans.empty());
+  CHECK(plain.char_count == 20);
+  CHECK(plain.end_state == SyntaxRule::kDefaultStateId);
+
+  // "\G" only matches where a search starts, so the rule must still be retried after "a" and "b"
+  LineAnalyzeResult anchored;
+  analyzer->analyzeLine("12ab,x 3", {0, SyntaxRule::kDefaultStateId, 0}, anchored);
+  CHECK(styleAtColumn(anchored.highlight, 0) == kNumber);
+  CHECK(styleAtColumn(anchored.highlight, 2) == -1);
+  CHECK(styleAtColumn(anchored.highlight, 4) == kPunctuation);
+  CHECK(styleAtColumn(anchored.highlight, 5) == kKeyword);
+  CHECK(styleAtColumn(anchored.highlight, 7) == kNumber);
+  CHECK(anchored.char_count == 8);
+}
+
+TEST_CASE("Searches skipping to a token's first byte keep columns, case folding and lookbehind") {
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(R"JSON(
+{
+  "name": "first-byte",
+  "fileSuffixes": [".firstbyte"],
+  "states": {
+    "default": [
+      { "pattern": "(?i)select", "style": "keyword" },
+      { "pattern": "(?<=@)[a-z]+", "style": "number" },
+      { "pattern": "→", "style": "punctuation" }
+    ]
+  }
+}
+)JSON"));
+  constexpr int32_t kKeyword = 1;
+  constexpr int32_t kNumber = 3;
+  constexpr int32_t kPunctuation = 8;
+
+  SharedPtr<TextAnalyzer> analyzer = engine->createAnalyzerBySyntaxName("first-byte");
+  REQUIRE(analyzer != nullptr);
+
+  LineAnalyzeResult result;
+  analyzer->analyzeLine("中文 SeLeCt @name → 12", {0, SyntaxRule::kDefaultStateId, 0}, result);
+  REQUIRE(result.highlight.spans.size() == 3);
+  CHECK(result.highlight.spans[0].range.start.column == 3);
+  CHECK(result.highlight.spans[0].style_id == kKeyword);
+  // The lookbehind still sees the '@' in front of the position the search skipped to
+  CHECK(result.highlight.spans[1].range.start.column == 11);
+  CHECK(result.highlight.spans[1].style_id == kNumber);
+  CHECK(result.highlight.spans[2].range.start.column == 16);
+  CHECK(result.highlight.spans[2].style_id == kPunctuation);
+  CHECK(result.char_count == 20);
+
+  // Under (?i) the KELVIN SIGN class also matches ASCII "k" and "K"
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(R"JSON(
+{
+  "name": "kelvin",
+  "fileSuffixes": [".kelvin"],
+  "states": {
+    "default": [
+      { "pattern": "(?i)[\\x{212A}]", "style": "keyword" }
+    ]
+  }
+}
+)JSON"));
+  SharedPtr<TextAnalyzer> kelvin_analyzer = engine->createAnalyzerBySyntaxName("kelvin");
+  REQUIRE(kelvin_analyzer != nullptr);
+  result.highlight.spans.clear();
+  kelvin_analyzer->analyzeLine("ok K", {0, SyntaxRule::kDefaultStateId, 0}, result);
+  REQUIRE(result.highlight.spans.size() == 2);
+  CHECK(result.highlight.spans[0].range.start.column == 1);
+  CHECK(result.highlight.spans[0].style_id == kKeyword);
+  CHECK(result.highlight.spans[1].range.start.column == 3);
+}
+
+TEST_CASE("Keyword list rules match like the merged alternation they replace") {
+  // Wrapping a keyword list in (?:...) keeps it in the merged regex, which serves as the reference
+  auto makeSyntax = [](const U8String& name, const U8String& open, const U8String& close) {
+    return U8String(R"JSON({
+  "name": ")JSON") + name + R"JSON(",
+  "fileSuffixes": [".)JSON" + name + R"JSON("],
+  "states": {
+    "default": [
+      { "pattern": ")JSON" + open + R"JSON(\\b(?:in|int|interface)\\b)JSON" + close + R"JSON(", "style": "keyword" },
+      { "pattern": "\\bint[0-9]+\\b", "style": "class" },
+      { "pattern": ")JSON" + open + R"JSON(\\b(int32|true|false)\\b)JSON" + close + R"JSON(", "styles": [1, "number"] },
+      { "pattern": "[a-z]+(?=\\()", "style": "method" },
+      { "pattern": ")JSON" + open + R"JSON(\\bnull\\b)JSON" + close + R"JSON(", "style": "builtin", "state": "after" }
+    ],
+    "after": [
+      { "pattern": ")JSON" + open + R"JSON(\\b(?:end)\\b)JSON" + close + R"JSON(", "style": "keyword", "state": "default" }
+    ]
+  }
+})JSON";
+  };
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(makeSyntax("keyword-trie", "", "")));
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(makeSyntax("keyword-regex", "(?:", ")")));
+  SharedPtr<TextAnalyzer> trie = engine->createAnalyzerBySyntaxName("keyword-trie");
+  SharedPtr<TextAnalyzer> regex = engine->createAnalyzerBySyntaxName("keyword-regex");
+  REQUIRE(trie != nullptr);
+  REQUIRE(regex != nullptr);
+
+  const U8String text =
+    "int in interface interfaces int32 int64 int32x _int\n"
+    "true(false) falsey intéger éint int_ 中int int中\n"
+    "null int end true null\n"
+    "null\tend";
+  SharedPtr<DocumentHighlight> expected = regex->analyzeText(text);
+  SharedPtr<DocumentHighlight> actual = trie->analyzeText(text);
+  REQUIRE(expected->lines.size() == actual->lines.size());
+  for (size_t line = 0; line < expected->lines.size(); ++line) {
+    const List<TokenSpan>& expected_spans = expected->lines[line].spans;
+    const List<TokenSpan>& actual_spans = actual->lines[line].spans;
+    REQUIRE(expected_spans.size() == actual_spans.size());
+    for (size_t i = 0; i < expected_spans.size(); ++i) {
+      CHECK(actual_spans[i].range.start.column == expected_spans[i].range.start.column);
+      CHECK(actual_spans[i].range.end.column == expected_spans[i].range.end.column);
+      CHECK(actual_spans[i].style_id == expected_spans[i].style_id);
+      CHECK(actual_spans[i].state == expected_spans[i].state);
+      CHECK(actual_spans[i].goto_state == expected_spans[i].goto_state);
+    }
+  }
+  // "true" in front of "(" belongs to the earlier keyword rule rather than the method rule
+  CHECK(styleAtColumn(actual->lines[1], 0) == 3);
+  CHECK(styleAtColumn(actual->lines[0], 28) == 5);
+}
+
+TEST_CASE("subStates match a group as if it were the whole string") {
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(R"JSON(
+{
+  "name": "sub-range",
+  "fileSuffixes": [".subrange"],
+  "states": {
+    "default": [
+      { "pattern": "(\\w+)=\\[([^\\]]*)\\]", "styles": [1, "variable"], "subStates": [2, "inner"] }
+    ],
+    "inner": [
+      { "pattern": "(?<!\\[)^head", "style": "keyword" },
+      { "pattern": "\\d+", "style": "number" },
+      { "pattern": "\\w+$", "style": "string" }
+    ]
+  }
+}
+)JSON"));
+  constexpr int32_t kKeyword = 1;
+  constexpr int32_t kString = 2;
+  constexpr int32_t kNumber = 3;
+
+  SharedPtr<TextAnalyzer> analyzer = engine->createAnalyzerBySyntaxName("sub-range");
+  REQUIRE(analyzer != nullptr);
+  LineAnalyzeResult result;
+  analyzer->analyzeLine("é key=[head 12 tail] after", {0, SyntaxRule::kDefaultStateId, 0}, result);
+  // ^ and $ match at the group edges, and the lookbehind does not see the '[' in front of the group
+  CHECK(styleAtColumn(result.highlight, 7) == kKeyword);
+  CHECK(styleAtColumn(result.highlight, 12) == kNumber);
+  CHECK(styleAtColumn(result.highlight, 15) == kString);
+  CHECK(styleAtColumn(result.highlight, 19) == -1);
+}
+
+TEST_CASE("Line cache shares results between analyzers and rebases positions") {
+  const U8String text = "let a\nlet b\nlet a\n/* let a\nlet a\n*/\nlet a\n";
+
+  HighlightConfig plain_config;
+  plain_config.show_index = true;
+  SharedPtr<HighlightEngine> plain_engine = makeTestHighlightEngine(plain_config);
+  compileLetCommentSyntax(plain_engine);
+  SharedPtr<DocumentHighlight> expected = plain_engine->createAnalyzerBySyntaxName("let-comment")->analyzeText(text);
+  CHECK(plain_engine->getLineCacheStats().capacity == 0);
+
+  HighlightConfig cached_config = plain_config;
+  cached_config.line_cache_capacity = 3;
+  SharedPtr<HighlightEngine> cached_engine = makeTestHighlightEngine(cached_config);
+  compileLetCommentSyntax(cached_engine);
+
+  SharedPtr<DocumentHighlight> first = cached_engine->createAnalyzerBySyntaxName("let-comment")->analyzeText(text);
+  REQUIRE(first != nullptr);
+  REQUIRE(expected != nullptr);
+  CHECK(first->lines == expected->lines);
+  // "let a" inside the comment is a different key, and the last "let a" was evicted by then
+  LineCacheStats stats = cached_engine->getLineCacheStats();
+  CHECK(stats.hits == 1);
+  CHECK(stats.misses == 6);
+  CHECK(stats.size == 3);
+  CHECK(stats.capacity == 3);
+
+  SharedPtr<DocumentHighlight> second = cached_engine->createAnalyzerByFileName("main.let")->analyzeText(text);
+  REQUIRE(second != nullptr);
+  CHECK(second->lines == expected->lines);
+  REQUIRE(second->lines[6].spans.size() == 2);
+  CHECK(second->lines[6].spans[1].range.start.line == 6);
+  CHECK(second->lines[6].spans[1].range.start.index == 40);
+  CHECK(cached_engine->getLineCacheStats().hits > stats.hits);
+
+  cached_engine->clearLineCache();
+  stats = cached_engine->getLineCacheStats();
+  CHECK(stats.hits == 0);
+  CHECK(stats.misses == 0);
+  CHECK(stats.size == 0);
+  CHECK(stats.capacity == 3);
+}
+
+TEST_CASE("Regex retry limit truncates a line instead of backtracking forever") {
+  const U8String syntax_json = R"JSON(
+{
+  "name": "backtrack",
+  "fileSuffixes": [".bt"],
+  "states": {
+    "default": [
+      { "pattern": "\\d+", "style": "number" },
+      { "pattern": "(?:a|aa)+(?<=b)", "style": "keyword" }
+    ]
+  }
+}
+)JSON";
+  HighlightConfig config;
+  config.regex_retry_limit = 100000;
+  config.line_time_budget_ms = 60000;
+  config.line_cache_capacity = 8;
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(syntax_json));
+  SharedPtr<TextAnalyzer> analyzer = engine->createAnalyzerBySyntaxName("backtrack");
+  REQUIRE(analyzer != nullptr);
+
+  LineAnalyzeResult result;
+  analyzer->analyzeLine("12 aa 3", {0, 0, 0}, result);
+  CHECK_FALSE(result.truncated);
+  CHECK(result.highlight.spans.size() == 2);
+
+  // Without the limit, every start position would try exponentially many ways to split the run of a's
+  const U8String pathological = "12 " + U8String(64, 'a') + " 34";
+  result.highlight.spans.clear();
+  analyzer->analyzeLine(pathological, {0, 0, 0}, result);
+  CHECK(result.truncated);
+  CHECK(result.char_count == pathological.size());
+  CHECK(result.end_state == SyntaxRule::kDefaultStateId);
+  REQUIRE(result.highlight.spans.size() == 1);
+  CHECK(result.highlight.spans[0].range.end.column == 2);
+  CHECK(engine->getAnalyzeBudgetStats().regex_limit_exceeded == 1);
+  CHECK(engine->getAnalyzeBudgetStats().time_budget_exceeded == 0);
+
+  // Truncated lines are never cached, the next analysis runs into the limit again
+  result.highlight.spans.clear();
+  analyzer->analyzeLine(pathological, {0, 0, 0}, result);
+  CHECK(result.truncated);
+  CHECK(engine->getAnalyzeBudgetStats().regex_limit_exceeded == 2);
+}
+
+TEST_CASE("Document highlight keeps line numbers and indexes in sync across line edits") {
+  HighlightConfig config;
+  config.show_index = true;
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+  compileLetCommentSyntax(engine);
+
+  U8String text;
+  for (int32_t i = 0; i < 40; ++i) {
+    text += "let v" + std::to_string(i) + " = " + std::to_string(i * 7) + "\n";
+  }
+  SharedPtr<Document> document = makeSharedPtr<Document>("file:///main.let", text);
+  SharedPtr<DocumentAnalyzer> analyzer = engine->loadDocument(document);
+  REQUIRE(analyzer != nullptr);
+  REQUIRE(analyzer->analyze() != nullptr);
+
+  SharedPtr<TextAnalyzer> fresh_analyzer = engine->createAnalyzerBySyntaxName("let-comment");
+
+  // Inserted lines before an unchanged tail
+  requireMatchesFreshAnalysis(analyzer->analyzeIncremental(TextRange{{2, 0}, {2, 0}}, "let a = 1\nlet b = 2\n"),
+    *document, fresh_analyzer);
+  // Removed lines before an unchanged tail
+  requireMatchesFreshAnalysis(analyzer->analyzeIncremental(TextRange{{5, 0}, {9, 0}}, ""), *document, fresh_analyzer);
+  // A comment swallowing several lines, then closed again
+  requireMatchesFreshAnalysis(analyzer->analyzeIncremental(TextRange{{10, 0}, {10, 0}}, "/*"),
+    *document, fresh_analyzer);
+  requireMatchesFreshAnalysis(analyzer->analyzeIncremental(TextRange{{14, 0}, {14, 0}}, "*/ 中文\n"),
+    *document, fresh_analyzer);
+
+  SharedPtr<DocumentHighlightSlice> slice = analyzer->analyzeIncrementalInLineRange(
+    TextRange{{0, 0}, {1, 0}}, "", LineRange{20, 5});
+  REQUIRE(slice != nullptr);
+  REQUIRE(slice->lines.size() == 5);
+  for (size_t i = 0; i < slice->lines.size(); ++i) {
+    for (const TokenSpan& span : slice->lines[i].spans) {
+      CHECK(span.range.start.line == slice->start_line + i);
+      CHECK(span.range.start.index == document->charIndexOfLine(slice->start_line + i) + span.range.start.column);
+    }
+  }
+}
+
+TEST_CASE("Batched edits match a fresh analysis of the edited text") {
+  HighlightConfig config;
+  config.show_index = true;
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+  compileLetCommentSyntax(engine);
+
+  U8String text;
+  for (int32_t i = 0; i < 300; ++i) {
+    text += "let v" + std::to_string(i) + " = " + std::to_string(i * 7) + "\n";
+  }
+  SharedPtr<Document> document = makeSharedPtr<Document>("file:///main.let", text);
+  SharedPtr<DocumentAnalyzer> analyzer = engine->loadDocument(document);
+  REQUIRE(analyzer != nullptr);
+  REQUIRE(analyzer->analyze() != nullptr);
+  SharedPtr<TextAnalyzer> fresh_analyzer = engine->createAnalyzerBySyntaxName("let-comment");
+
+  // A slice analysis stops inside a new comment, the lines below it were analyzed outside of it. An edit above
+  // must not let the analysis skip over them
+  REQUIRE(analyzer->analyzeIncrementalInLineRange({{10, 0}, {10, 0}}, "/*", {10, 3}) != nullptr);
+  requireMatchesFreshAnalysis(analyzer->analyzeIncremental({{2, 0}, {2, 0}}, "x"), *document, fresh_analyzer);
+  requireMatchesFreshAnalysis(analyzer->analyzeIncrementalBatch({{{{10, 0}, {10, 2}}, ""}, {{{2, 0}, {2, 1}}, ""}}),
+    *document, fresh_analyzer);
+
+  const List<U8String> new_texts = {"", "x", "/*", "*/", "let q = 5\n", "\n", "1\r\n2", "/* a\nb */ 3", "中文"};
+  std::mt19937 random(25);
+  for (size_t round = 0; round < 80; ++round) {
+    CAPTURE(round);
+    // Pairs of sorted random positions never overlap, equal positions make inserts and touching edits
+    List<TextPosition> positions;
+    const size_t edit_count = 1 + random() % 8;
+    for (size_t i = 0; i < edit_count * 2; ++i) {
+      const size_t line = random() % document->getLineCount();
+      const size_t column = random() % (Utf8Util::countChars(document->getLine(line).text) + 1);
+      positions.push_back({line, column});
+    }
+    std::sort(positions.begin(), positions.end());
+    List<TextEdit> edits;
+    for (size_t i = 0; i < edit_count; ++i) {
+      edits.push_back({{positions[i * 2], positions[i * 2 + 1]}, new_texts[random() % new_texts.size()]});
+    }
+    std::shuffle(edits.begin(), edits.end(), random);
+
+    Document expected_document("file:///expected.let", document->getText());
+    expected_document.applyPatches(edits);
+    if (round % 3 == 0) {
+      // Only a slice is analyzed, the dirty lines and the end of the analyzed lines move with the next edits
+      const LineRange visible {random() % document->getLineCount(), 20};
+      if (round % 2 == 0) {
+        REQUIRE(analyzer->analyzeIncrementalBatchInLineRange(edits, visible) != nullptr);
+      } else {
+        const List<TextEdit> sorted_edits = document->normalizeEdits(edits);
+        for (auto it = sorted_edits.rbegin(); it != sorted_edits.rend(); ++it) {
+          REQUIRE(analyzer->analyzeIncrementalInLineRange(it->range, it->new_text, visible) != nullptr);
+        }
+      }
+      REQUIRE(document->getText() == expected_document.getText());
+      continue;
+    }
+    SharedPtr<DocumentHighlight> highlight = analyzer->analyzeIncrementalBatch(edits);
+    REQUIRE(document->getText() == expected_document.getText());
+    requireMatchesFreshAnalysis(highlight, *document, fresh_analyzer);
+  }
+
+  const U8String before = document->getText();
+  CHECK_THROWS_AS(analyzer->analyzeIncrementalBatch({{{{0, 0}, {0, 3}}, "x"}, {{{0, 2}, {0, 2}}, "y"}}),
+    std::invalid_argument);
+  CHECK(document->getText() == before);
+}
+
+TEST_CASE("Long lines are analyzed in column windows resumed from checkpoints") {
+  U8String long_line = "still comment */";
+  for (int32_t i = 0; i < 2000; ++i) {
+    long_line += " let v" + std::to_string(i) + " = " + std::to_string(i * 7) + "; /* c */";
+  }
+  const U8String text = "let a = 1 /* open\n" + long_line + " /* tail\nlet b = 2 */ 3\n";
+
+  HighlightConfig config;
+  config.show_index = true;
+  SharedPtr<HighlightEngine> full_engine = makeTestHighlightEngine(config);
+  compileLetCommentSyntax(full_engine);
+  config.long_line_threshold = 1024;
+  config.long_line_window = 256;
+  SharedPtr<HighlightEngine> windowed_engine = makeTestHighlightEngine(config);
+  compileLetCommentSyntax(windowed_engine);
+
+  SharedPtr<Document> full_document = makeSharedPtr<Document>("file:///main.let", text);
+  SharedPtr<Document> windowed_document = makeSharedPtr<Document>("file:///main.let", text);
+  SharedPtr<DocumentAnalyzer> full = full_engine->loadDocument(full_document);
+  SharedPtr<DocumentAnalyzer> windowed = windowed_engine->loadDocument(windowed_document);
+  REQUIRE(full != nullptr);
+  REQUIRE(windowed != nullptr);
+
+  auto requireSameWindow = [&](const LineRange& lines, const ColumnRange& columns) {
+    SharedPtr<DocumentHighlightSlice> expected = full->analyzeLineRange(lines, columns);
+    SharedPtr<DocumentHighlightSlice> actual = windowed->analyzeLineRange(lines, columns);
+    REQUIRE(expected != nullptr);
+    REQUIRE(actual != nullptr);
+    CHECK(actual->start_line == expected->start_line);
+    CHECK(actual->total_line_count == expected->total_line_count);
+    REQUIRE(actual->lines.size() == expected->lines.size());
+    for (size_t i = 0; i < expected->lines.size(); ++i) {
+      CAPTURE(lines.start_line + i, columns.start_column);
+      CHECK(actual->lines[i] == expected->lines[i]);
+    }
+    return actual;
+  };
+
+  // The first window of the long line ends far before the line does
+  SharedPtr<DocumentHighlightSlice> first = requireSameWindow({1, 1}, {0, 80});
+  REQUIRE_FALSE(first->lines[0].spans.empty());
+  // The line starts inside the comment opened on line 0
+  CHECK(first->lines[0].spans[0].range.start.column == 14);
+  CHECK(first->lines[0].spans[0].state != SyntaxRule::kDefaultStateId);
+  for (const TokenSpan& span : first->lines[0].spans) {
+    CHECK(span.range.start.column < 80);
+  }
+  // Scrolling right and back resumes from checkpoints
+  requireSameWindow({1, 1}, {30000, 120});
+  requireSameWindow({1, 1}, {500, 120});
+  requireSameWindow({1, 1}, {long_line.size() - 40, 200});
+  // A later line needs the long line's end state
+  requireSameWindow({0, 4}, {0, 40});
+
+  // Edits before the long line change its start state and drop its checkpoints
+  full->analyzeIncremental(TextRange{{0, 10}, {0, 10}}, "*/ ");
+  windowed->analyzeIncremental(TextRange{{0, 10}, {0, 10}}, "*/ ");
+  requireSameWindow({0, 4}, {0, 64});
+  requireSameWindow({1, 1}, {20000, 64});
+
+  // Without a column range the long line has no spans, the other lines are analyzed as usual
+  SharedPtr<DocumentHighlight> expected = full->analyze();
+  SharedPtr<DocumentHighlight> highlight = windowed->analyze();
+  REQUIRE(highlight->lines.size() == expected->lines.size());
+  REQUIRE_FALSE(expected->lines[1].spans.empty());
+  CHECK(highlight->lines[1].spans.empty());
+  for (size_t line : {0, 2, 3}) {
+    CAPTURE(line);
+    CHECK(highlight->lines[line] == expected->lines[line]);
+  }
+  SharedPtr<DocumentHighlightSlice> slice = windowed->analyzeLineRange(LineRange{1, 2});
+  REQUIRE(slice->lines.size() == 2);
+  CHECK(slice->lines[0].spans.empty());
+  CHECK(slice->lines[1] == expected->lines[2]);
+}
+
+TEST_CASE("Comment and string bodies are covered up to the next terminator at once") {
+  const U8String states_json = R"JSON(
+    "default": [
+      { "pattern": "/\\*", "style": "comment", "state": "comment" },
+      { "pattern": "\"", "style": "string", "state": "string" },
+      { "pattern": "'", "style": "string", "state": "quote" },
+      { "pattern": "\\d+", "style": "number" }
+    ],
+    "comment": [
+      { "pattern": "\\*/", "style": "comment", "state": "default" },
+      { "pattern": "\\bTODO\\b", "style": "keyword" },
+      { "pattern": "[\\S\\s]", "style": "comment" },
+      { "pattern": "never", "style": "number" }
+    ],
+    "string": [
+      { "pattern": "\\\\.", "style": "keyword" },
+      { "pattern": "\"", "style": "string", "state": "default" },
+      { "pattern": "[\\s\\S]", "style": "string" }
+    ],
+    "quote": [
+      { "pattern": "'", "style": "string", "state": "default" },
+      { "pattern": "[^é]", "style": "string" }
+    ]
+  )JSON";
+  // A zero-width rule ahead of the body rule may match anywhere, which forces per-character matching
+  U8String reference_states_json = states_json;
+  for (const char* state : {"\"comment\": [", "\"string\": [", "\"quote\": ["}) {
+    size_t pos = reference_states_json.find(state) + std::strlen(state);
+    reference_states_json.insert(pos, R"JSON({ "pattern": "(?=\\x01)", "style": "number" },)JSON");
+  }
+  const U8String text = "1 /* plain TODO text http://x.y/*z */ 2 /* über TODO\n"
+    "still ünïcödé */ \"a \\\" b \\\\\" 'x é y' 3\n"
+    "\"multi\n"
+    "line\" /* TODOs */ 'é'\n";
+
+  HighlightConfig config;
+  config.show_index = true;
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(
+    "{\"name\": \"filler\", \"fileSuffixes\": [\".fl\"], \"states\": {" + states_json + "}}"));
+  SharedPtr<HighlightEngine> reference_engine = makeTestHighlightEngine(config);
+  REQUIRE_NOTHROW(reference_engine->compileSyntaxFromJson(
+    "{\"name\": \"filler\", \"fileSuffixes\": [\".fl\"], \"states\": {" + reference_states_json + "}}"));
+
+  SharedPtr<DocumentAnalyzer> analyzer = engine->loadDocument(makeSharedPtr<Document>("file:///a.fl", text));
+  SharedPtr<DocumentAnalyzer> reference = reference_engine->loadDocument(
+    makeSharedPtr<Document>("file:///a.fl", text));
+  REQUIRE(analyzer != nullptr);
+  REQUIRE(reference != nullptr);
+  SharedPtr<DocumentHighlight> highlight = analyzer->analyze();
+  SharedPtr<DocumentHighlight> expected = reference->analyze();
+  REQUIRE(highlight->lines.size() == expected->lines.size());
+  for (size_t i = 0; i < expected->lines.size(); ++i) {
+    CAPTURE(i);
+    CHECK(highlight->lines[i] == expected->lines[i]);
+  }
+
+  // "/* plain " merges into one span that stops right before TODO
+  const LineHighlight& first_line = highlight->lines[0];
+  REQUIRE(first_line.spans.size() >= 3);
+  CHECK(first_line.spans[1].range.start.column == 2);
+  CHECK(first_line.spans[1].range.end.column == 11);
+  CHECK(first_line.spans[1].matched_text == "/*");
+  CHECK(first_line.spans[2].range.start.column == 11);
+  CHECK(first_line.spans[2].range.end.column == 15);
+}
+
+TEST_CASE("Jumping deep into a document only fast-forwards end states above the visible range") {
+  U8String text;
+  for (int32_t i = 0; i < 400; ++i) {
+    if (i % 7 == 3) {
+      text += "let x = \"a\" /* open\n";
+    } else if (i % 7 == 5) {
+      text += "still */ let y = 2\n";
+    } else {
+      text += "let z = " + std::to_string(i) + "\n";
+    }
+  }
+
+  HighlightConfig config;
+  config.show_index = true;
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+  compileLetCommentSyntax(engine);
+  SharedPtr<DocumentAnalyzer> full = engine->loadDocument(makeSharedPtr<Document>("file:///a.let", text));
+  SharedPtr<DocumentAnalyzer> jumping = engine->loadDocument(makeSharedPtr<Document>("file:///b.let", text));
+  REQUIRE(full != nullptr);
+  REQUIRE(jumping != nullptr);
+  SharedPtr<DocumentHighlight> expected = full->analyze();
+
+  requireSameLines(jumping->analyzeLineRange({380, 10}), expected, 380, 10);
+  // The lines above were only fast-forwarded, their spans are analyzed once they are requested
+  requireSameLines(jumping->getHighlightSlice({100, 10}), expected, 100, 10);
+  requireSameLines(jumping->analyzeLineRange({200, 10}), expected, 200, 10);
+  requireSameLines(jumping->getHighlightSlice({375, 30}), expected, 375, 15);
+
+  // An edit above both ranges fast-forwards again, full analysis fills in every line
+  full->analyzeIncremental(TextRange{{2, 0}, {2, 0}}, "/* ");
+  expected = full->analyzeIncremental(TextRange{{4, 0}, {4, 0}}, "*/ ");
+  jumping->analyzeIncrementalInLineRange(TextRange{{2, 0}, {2, 0}}, "/* ", {390, 10});
+  requireSameLines(jumping->analyzeIncrementalInLineRange(TextRange{{4, 0}, {4, 0}}, "*/ ", {300, 10}),
+    expected, 300, 10);
+  SharedPtr<DocumentHighlight> highlight = jumping->analyzeIncremental(TextRange{{0, 0}, {0, 0}}, "");
+  REQUIRE(highlight->lines.size() == expected->lines.size());
+  for (size_t i = 0; i < expected->lines.size(); ++i) {
+    CAPTURE(i);
+    CHECK(highlight->lines[i] == expected->lines[i]);
+  }
+}
+
+TEST_CASE("Sync points start viewport analysis far past the analyzed lines") {
+  const U8String syntax_json = R"JSON(
+{
+  "name": "sync-points",
+  "fileSuffixes": [".sp"],
+  "states": {
+    "default": [
+      { "pattern": "\\b(def)\\s+(\\w+)", "styles": [1, "keyword", 2, "method"] },
+      { "pattern": "/\\*", "style": "comment", "state": "comment" },
+      { "pattern": "\\d+", "style": "number" }
+    ],
+    "comment": [
+      { "pattern": "\\*/", "style": "comment", "state": "default" },
+      { "pattern": "[\\S\\s]", "style": "comment" }
+    ]
+  },
+  "sync": [
+    { "pattern": "^def\\b" },
+    { "pattern": "^ \\*", "state": "comment" }
+  ]
+}
+)JSON";
+  U8String text;
+  for (int32_t i = 0; i < 300; ++i) {
+    if (i % 10 == 0) {
+      text += "def f" + std::to_string(i) + "\n";
+    } else if (i % 10 == 4) {
+      text += "/*\n * doc\n */\n";
+    } else {
+      text += "  x = 1\n";
+    }
+  }
+
+  HighlightConfig config;
+  config.show_index = true;
+  SharedPtr<HighlightEngine> exact_engine = makeTestHighlightEngine(config);
+  REQUIRE_NOTHROW(exact_engine->compileSyntaxFromJson(syntax_json));
+  config.sync_distance = 20;
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(syntax_json));
+  SharedPtr<DocumentAnalyzer> exact = exact_engine->loadDocument(makeSharedPtr<Document>("file:///a.sp", text));
+  SharedPtr<DocumentAnalyzer> analyzer = engine->loadDocument(makeSharedPtr<Document>("file:///b.sp", text));
+  REQUIRE(exact != nullptr);
+  REQUIRE(analyzer != nullptr);
+  SharedPtr<DocumentHighlight> expected = exact->analyze();
+
+  // A sync point agreeing with the document gives the exact spans, without analyzing the lines above
+  SharedPtr<DocumentHighlightSlice> slice = analyzer->analyzeLineRange({250, 12});
+  CHECK(slice->provisional);
+  requireSameLines(slice, expected, 250, 12);
+  CHECK(analyzer->getHighlightSlice({0, 10})->lines.empty());
+  // Scrolling a little keeps extending the same provisional lines
+  slice = analyzer->analyzeLineRange({255, 12});
+  CHECK(slice->provisional);
+  requireSameLines(slice, expected, 255, 12);
+  // Close to the analyzed lines, the exact analysis is used
+  slice = analyzer->analyzeLineRange({15, 5});
+  CHECK_FALSE(slice->provisional);
+  requireSameLines(slice, expected, 15, 5);
+
+  // A line that only looks like the inside of a comment misleads the sync point, until the exact analysis catches up
+  const TextRange insertion {{279, 0}, {279, 0}};
+  expected = exact->analyzeIncremental(insertion, " * x\n");
+  slice = analyzer->analyzeIncrementalInLineRange(insertion, " * x\n", {280, 5});
+  REQUIRE(slice->provisional);
+  REQUIRE(slice->lines.size() == 5);
+  CHECK_FALSE(slice->lines[0] == expected->lines[280]);
+  analyzer->analyze();
+  slice = analyzer->analyzeLineRange({280, 5});
+  CHECK_FALSE(slice->provisional);
+  requireSameLines(slice, expected, 280, 5);
+
+  // Lines searched for a sync point without a hit are skipped next time, until an edit above them
+  U8String plain_text = "def f\n";
+  for (int32_t i = 0; i < 300; ++i) {
+    plain_text += "  x = 1\n";
+  }
+  SharedPtr<DocumentAnalyzer> plain = engine->loadDocument(makeSharedPtr<Document>("file:///c.sp", plain_text));
+  REQUIRE(plain != nullptr);
+  plain->analyzeLineRange({0, 1});
+  slice = plain->analyzeLineRange({250, 5});
+  CHECK_FALSE(slice->provisional);
+  const List<TextEdit> edits = {{{{1, 0}, {1, 0}}, "1"}, {{{240, 0}, {240, 7}}, "def g"}};
+  slice = plain->analyzeIncrementalBatchInLineRange(edits, {250, 5});
+  REQUIRE(slice != nullptr);
+  CHECK(slice->provisional);
+
+  const U8String bad_state = R"JSON({"name": "sync-bad", "fileSuffixes": [".sb"],
+    "states": {"default": [{"pattern": "x", "style": "keyword"}]}, "sync": [{"pattern": "^x", "state": "missing"}]})JSON";
+  CHECK_THROWS_AS(engine->compileSyntaxFromJson(bad_state), SyntaxCompileError);
+}
+
+TEST_CASE("Batch Edit Benchmark") {
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
+  REQUIRE_NOTHROW(engine->compileSyntaxFromFile(SYNTAX_DIR"/java.json"));
+  const U8String file_text = FileUtil::readString(TESTS_DIR"/files/example.java");
+  U8String text;
+  for (size_t i = 0; i < 20; ++i) {
+    text += file_text + "\n";
+  }
+  SharedPtr<Document> document = makeSharedPtr<Document>("file:///Batch.java", text);
+  SharedPtr<DocumentAnalyzer> analyzer = engine->loadDocument(document);
+  REQUIRE(analyzer->analyze() != nullptr);
+
+  // A multi-cursor edit: the same text typed at the start of 50 lines spread over the document, then removed
+  const size_t step = document->getLineCount() / 50;
+  List<TextEdit> insertions;
+  List<TextEdit> removals;
+  for (size_t line = 0; line + step <= document->getLineCount(); line += step) {
+    insertions.push_back({{{line, 0}, {line, 0}}, "x"});
+    removals.push_back({{{line, 0}, {line, 1}}, ""});
+  }
+  BENCHMARK("One incremental analysis per edit") {
+    for (const List<TextEdit>* edits : {&insertions, &removals}) {
+      for (auto it = edits->rbegin(); it != edits->rend(); ++it) {
+        analyzer->analyzeIncremental(it->range, it->new_text);
+      }
+    }
+    return document->getLineCount();
+  };
+  BENCHMARK("One batched incremental analysis") {
+    analyzer->analyzeIncrementalBatch(insertions);
+    return analyzer->analyzeIncrementalBatch(removals);
+  };
+}
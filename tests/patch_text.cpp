@@ -1,3 +1,4 @@
+#include <random>
 #include <catch2/catch_amalgamated.hpp>
 #include "sweetline/foundation.h"
 
@@ -137,10 +138,122 @@ TEST_CASE("Multi-line patch preserves merged line endings") {
   REQUIRE(replace_document.getText() == "aX\nYd\nef");
 }
 
+TEST_CASE("Patches across line blocks match a plain line list") {
+  // Enough lines for several blocks, edits insert and erase whole blocks of lines
+  List<U8String> expected;
+  U8String initial_text;
+  for (size_t i = 0; i < 5000; ++i) {
+    expected.push_back("line " + std::to_string(i));
+    initial_text += expected.back();
+    if (i + 1 < 5000) {
+      initial_text += "\n";
+    }
+  }
+  Document document("test.txt", initial_text);
+
+  std::mt19937 random(7);
+  for (size_t round = 0; round < 300; ++round) {
+    CAPTURE(round);
+    const size_t start_line = random() % expected.size();
+    const size_t max_span = round % 10 == 0 ? 2500 : 3;
+    const size_t end_line = std::min(expected.size() - 1, start_line + random() % (max_span + 1));
+    const size_t start_column = random() % (expected[start_line].size() + 1);
+    const size_t end_column = start_line == end_line
+      ? start_column + random() % (expected[end_line].size() - start_column + 1)
+      : random() % (expected[end_line].size() + 1);
+    const size_t new_line_count = round % 10 == 5 ? 1500 : random() % 4;
+    List<U8String> new_parts;
+    U8String new_text;
+    for (size_t i = 0; i <= new_line_count; ++i) {
+      new_parts.push_back(i == 0 && random() % 2 == 0 ? "" : "new " + std::to_string(round) + "." + std::to_string(i));
+      new_text += (i == 0 ? "" : "\n") + new_parts.back();
+    }
+
+    document.patch({{start_line, start_column}, {end_line, end_column}}, new_text);
+    const U8String prefix = expected[start_line].substr(0, start_column);
+    const U8String suffix = expected[end_line].substr(end_column);
+    new_parts.front() = prefix + new_parts.front();
+    new_parts.back() += suffix;
+    expected.erase(expected.begin() + static_cast<ptrdiff_t>(start_line),
+      expected.begin() + static_cast<ptrdiff_t>(end_line + 1));
+    expected.insert(expected.begin() + static_cast<ptrdiff_t>(start_line), new_parts.begin(), new_parts.end());
+
+    REQUIRE(document.getLineCount() == expected.size());
+    List<size_t> line_starts(expected.size() + 1, 0);
+    for (size_t line = 0; line < expected.size(); ++line) {
+      line_starts[line + 1] = line_starts[line] + expected[line].size() + (line + 1 < expected.size() ? 1 : 0);
+    }
+    REQUIRE(document.totalChars() == line_starts.back());
+    for (size_t i = 0; i < 8; ++i) {
+      const size_t line = random() % expected.size();
+      CAPTURE(line);
+      REQUIRE(document.getLine(line).text == expected[line]);
+      REQUIRE(document.getLine(line).ending == (line + 1 < expected.size() ? LineEnding::LF : LineEnding::NONE));
+      REQUIRE(document.charIndexOfLine(line) == line_starts[line]);
+      REQUIRE(document.getLineCharCount(line) == line_starts[line + 1] - line_starts[line]);
+      if (line_starts[line + 1] > line_starts[line]) {
+        const size_t char_index = line_starts[line] + random() % (line_starts[line + 1] - line_starts[line]);
+        REQUIRE(document.charIndexToPosition(char_index)
+          == TextPosition{line, char_index - line_starts[line], char_index});
+      }
+    }
+  }
+
+  U8String expected_text;
+  size_t char_index = 0;
+  for (size_t line = 0; line < expected.size(); ++line) {
+    REQUIRE(document.charIndexOfLine(line) == char_index);
+    char_index += expected[line].size() + (line + 1 < expected.size() ? 1 : 0);
+    expected_text += expected[line] + (line + 1 < expected.size() ? "\n" : "");
+  }
+  REQUIRE(document.totalChars() == char_index);
+  REQUIRE(document.getText() == expected_text);
+}
+
+TEST_CASE("Batched patches use positions of the text before the batch") {
+  Document document("test.txt", "ab\ncd\nef");
+  // Out of order, two inserts at one position keep their order, an edit shares a line with another
+  PatchResult result = document.applyPatches({
+    {{{2, 1}, {2, 2}}, "F\nG"},
+    {{{0, 1}, {0, 1}}, "1"},
+    {{{0, 1}, {0, 1}}, "2"},
+    {{{0, 2}, {1, 1}}, ""},
+    {{{5, 0}, {5, 0}}, "!"}
+  });
+  CHECK(result.line_delta == 0);
+  CHECK(result.char_delta == 3);
+  CHECK(document.getText() == "a12bd\neF\nG!");
+
+  CHECK_THROWS_AS(document.applyPatches({{{{0, 1}, {0, 3}}, "x"}, {{{0, 2}, {0, 2}}, "y"}}), std::invalid_argument);
+  CHECK_THROWS_AS(document.applyPatches({{{{1, 1}, {0, 3}}, "x"}}), std::invalid_argument);
+  CHECK(document.getText() == "a12bd\neF\nG!");
+}
+
 TEST_CASE("Patch Benchmark") {
   BENCHMARK("Patch Performance") {
     Document document("test.txt", text);
     TextRange range = {{1, 0}, {1, 1}};
     document.patch(range, "您");
   };
+
+  // Pasting many lines into a large document, then removing them again
+  U8String large_text;
+  for (size_t i = 0; i < 200000; ++i) {
+    large_text += "    int value" + std::to_string(i) + " = compute(" + std::to_string(i) + ");\n";
+  }
+  U8String pasted_text;
+  for (size_t i = 0; i < 10000; ++i) {
+    pasted_text += "    pasted(" + std::to_string(i) + ");\n";
+  }
+  Document large_document("large.txt", large_text);
+  BENCHMARK("Type one character near the top of 200k lines") {
+    large_document.insert({10, 4}, "x");
+    large_document.remove({{10, 4}, {10, 5}});
+    return large_document.charIndexOfLine(150000);
+  };
+  BENCHMARK("Paste 10k lines into 200k lines") {
+    large_document.patch({{1000, 0}, {1000, 0}}, pasted_text);
+    large_document.remove({{1000, 0}, {11000, 0}});
+    return large_document.getLineCount();
+  };
 }
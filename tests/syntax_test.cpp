@@ -1,3 +1,4 @@
+#include <random>
 #include <unordered_set>
 #include <vector>
 #include <catch2/catch_amalgamated.hpp>
@@ -12,11 +13,8 @@ namespace {
   U8String syntaxPath(const U8String& file_name) {
     return U8String(SYNTAX_DIR) + "/" + file_name;
   }
-}
 
-TEST_CASE("Compile built-in syntaxes from syntaxes directory") {
-  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
-  const List<U8String> files = {
+  const List<U8String> kBuiltinSyntaxFiles = {
     "abnf.json", "asm-aarch64.json", "asm-att.json", "asm-intel.json", "batch.json", "brainfuck.json", "c.json",
     "cangjie.json", "cpp.json", "csharp.json", "csv.json", "dart.json", "dts.json", "glsl.json", "go.json", "groovy.json",
     "hlsl.json", "iapp.json", "jasm.json", "java.json", "javascript.json", "jsx.json", "json-sweetline.json", "kotlin.json",
@@ -33,7 +31,57 @@ TEST_CASE("Compile built-in syntaxes from syntaxes directory") {
     "java-inlineStyle.json", "tiecode-inlineStyle.json", "yaml(non zero width).json"
   };
 
-  for (const U8String& file_name : files) {
+  /// Highlight every sample file with config and with plain Oniguruma searches of the merged pattern, and require
+  /// the same spans from both
+  void requireSampleFilesMatchPlainSearch(const HighlightConfig& config) {
+    HighlightConfig plain_config;
+    plain_config.use_builtin_dfa = false;
+    plain_config.use_rule_scanner = false;
+    SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+    SharedPtr<HighlightEngine> plain_engine = makeTestHighlightEngine(plain_config);
+    for (const U8String& file_name : kBuiltinSyntaxFiles) {
+      // Variants reuse the name of their base syntax, which one a file routes to is not deterministic
+      if (file_name.find("inlineStyle") != U8String::npos || file_name.find("non zero width") != U8String::npos) {
+        continue;
+      }
+      CAPTURE(file_name);
+      REQUIRE_NOTHROW(engine->compileSyntaxFromFile(syntaxPath(file_name)));
+      REQUIRE_NOTHROW(plain_engine->compileSyntaxFromFile(syntaxPath(file_name)));
+    }
+    REQUIRE_NOTHROW(engine->compileSyntaxFromFile(syntaxPath("markdown.json")));
+    REQUIRE_NOTHROW(plain_engine->compileSyntaxFromFile(syntaxPath("markdown.json")));
+
+    size_t compared_files = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(TESTS_DIR"/files")) {
+      if (!entry.is_regular_file()) {
+        continue;
+      }
+      U8String file_name = entry.path().filename().u8string();
+      CAPTURE(file_name);
+      SharedPtr<TextAnalyzer> analyzer = engine->createAnalyzerByFileName(file_name);
+      SharedPtr<TextAnalyzer> plain_analyzer = plain_engine->createAnalyzerByFileName(file_name);
+      REQUIRE((analyzer == nullptr) == (plain_analyzer == nullptr));
+      if (analyzer == nullptr) {
+        continue;
+      }
+      U8String text = FileUtil::readString(entry.path().u8string());
+      SharedPtr<DocumentHighlight> expected = plain_analyzer->analyzeText(text);
+      SharedPtr<DocumentHighlight> actual = analyzer->analyzeText(text);
+      REQUIRE(expected->lines.size() == actual->lines.size());
+      for (size_t line = 0; line < expected->lines.size(); ++line) {
+        CAPTURE(line);
+        CHECK(actual->lines[line] == expected->lines[line]);
+      }
+      ++compared_files;
+    }
+    CHECK(compared_files > 50);
+  }
+}
+
+TEST_CASE("Compile built-in syntaxes from syntaxes directory") {
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
+
+  for (const U8String& file_name : kBuiltinSyntaxFiles) {
     CAPTURE(file_name);
     SharedPtr<SyntaxRule> rule;
     REQUIRE_NOTHROW(rule = engine->compileSyntaxFromFile(syntaxPath(file_name)));
@@ -891,3 +939,219 @@ TEST_CASE("Inline-style syntax produces inline style spans") {
   }
   REQUIRE(has_inline_style);
 }
+
+TEST_CASE("Compiled rule tables index every state and inline style by ID") {
+  HighlightConfig config;
+  config.inline_style = true;
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine(config);
+  for (const U8String& file_name : {U8String("java-inlineStyle.json"), U8String("tiecode-inlineStyle.json")}) {
+    CAPTURE(file_name);
+    SharedPtr<SyntaxRule> rule;
+    REQUIRE_NOTHROW(rule = engine->compileSyntaxFromFile(syntaxPath(file_name)));
+    REQUIRE(rule != nullptr);
+    REQUIRE_FALSE(rule->inline_styles.empty());
+
+    int32_t max_state_id = 0;
+    for (const auto& [_, state_id] : rule->state_id_map) {
+      max_state_id = std::max(max_state_id, state_id);
+    }
+    CHECK(rule->findStateRule(-1) == nullptr);
+    CHECK(rule->findStateRule(max_state_id + 1) == nullptr);
+    for (int32_t state_id = 0; state_id <= max_state_id; ++state_id) {
+      CAPTURE(state_id);
+      CHECK((rule->findStateRule(state_id) != nullptr) == rule->containsRule(state_id));
+    }
+    for (const auto& [state_name, state_id] : rule->state_id_map) {
+      CAPTURE(state_name);
+      CHECK((rule->findStateRule(state_id) != nullptr) == rule->containsRule(state_id));
+    }
+
+    int32_t max_style_id = 0;
+    for (const auto& [style_id, _] : rule->inline_styles) {
+      max_style_id = std::max(max_style_id, style_id);
+    }
+    CHECK(rule->findInlineStyle(0) == nullptr);
+    CHECK(rule->findInlineStyle(max_style_id + 1) == nullptr);
+    for (const auto& [style_id, inline_style] : rule->inline_styles) {
+      CAPTURE(style_id);
+      CHECK(rule->findInlineStyle(style_id) == &inline_style);
+    }
+  }
+}
+
+TEST_CASE("Built-in DFA highlights sample files exactly like Oniguruma") {
+  HighlightConfig dfa_config;
+  dfa_config.use_builtin_dfa = true;
+  requireSampleFilesMatchPlainSearch(dfa_config);
+}
+
+TEST_CASE("Built-in DFA finds the leftmost match start like Oniguruma") {
+  // Alternatives whose matches overlap, so the leftmost start is neither the first nor the shortest match
+  const U8String syntax = R"JSON({
+  "name": "overlapping",
+  "fileSuffixes": [".overlap"],
+  "states": {
+    "default": [
+      { "pattern": "abcd", "style": "keyword" },
+      { "pattern": "c", "style": "string" },
+      { "pattern": "a+b", "style": "number" },
+      { "pattern": "\\bxy?z\\b", "style": "builtin" },
+      { "pattern": "^y", "style": "comment" },
+      { "pattern": "d$", "style": "macro" },
+      { "pattern": "b.*x", "style": "property" }
+    ]
+  }
+})JSON";
+  HighlightConfig dfa_config;
+  dfa_config.use_builtin_dfa = true;
+  HighlightConfig onig_config;
+  onig_config.use_builtin_dfa = false;
+  SharedPtr<HighlightEngine> dfa_engine = makeTestHighlightEngine(dfa_config);
+  SharedPtr<HighlightEngine> onig_engine = makeTestHighlightEngine(onig_config);
+  REQUIRE_NOTHROW(dfa_engine->compileSyntaxFromJson(syntax));
+  REQUIRE_NOTHROW(onig_engine->compileSyntaxFromJson(syntax));
+  SharedPtr<TextAnalyzer> dfa_analyzer = dfa_engine->createAnalyzerByFileName("a.overlap");
+  SharedPtr<TextAnalyzer> onig_analyzer = onig_engine->createAnalyzerByFileName("a.overlap");
+  REQUIRE(dfa_analyzer != nullptr);
+  REQUIRE(onig_analyzer != nullptr);
+
+  const char alphabet[] = "abcdxyz _";
+  std::mt19937 random(12);
+  for (int round = 0; round < 500; ++round) {
+    U8String line;
+    const size_t length = random() % 24;
+    for (size_t i = 0; i < length; ++i) {
+      line.push_back(alphabet[random() % (sizeof(alphabet) - 1)]);
+    }
+    CAPTURE(line);
+    SharedPtr<DocumentHighlight> expected = onig_analyzer->analyzeText(line);
+    SharedPtr<DocumentHighlight> actual = dfa_analyzer->analyzeText(line);
+    REQUIRE(expected->lines.size() == actual->lines.size());
+    for (size_t i = 0; i < expected->lines.size(); ++i) {
+      CHECK(actual->lines[i] == expected->lines[i]);
+    }
+  }
+}
+
+TEST_CASE("Rule scanner highlights sample files exactly like the merged pattern") {
+  // The DFA would take most single-line ASCII searches away from both paths
+  HighlightConfig scanner_config;
+  scanner_config.use_builtin_dfa = false;
+  scanner_config.use_rule_scanner = true;
+  requireSampleFilesMatchPlainSearch(scanner_config);
+}
+
+TEST_CASE("Highlight Benchmark") {
+  // Grammars with the most token rules per state, where finding the matched rule costs the most
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
+  for (const char* file_name : {"typescript.json", "kotlin.json", "java.json", "cpp.json"}) {
+    REQUIRE_NOTHROW(engine->compileSyntaxFromFile(syntaxPath(file_name)));
+  }
+
+  const auto benchmarkFile = [&engine](const U8String& name, const U8String& file_name) {
+    SharedPtr<TextAnalyzer> analyzer = engine->createAnalyzerByFileName(file_name);
+    REQUIRE(analyzer != nullptr);
+    U8String text = FileUtil::readString(TESTS_DIR"/files/" + file_name);
+    BENCHMARK(U8String("Highlight ") + name) {
+      return analyzer->analyzeText(text);
+    };
+  };
+  benchmarkFile("typescript", "example.ts");
+  benchmarkFile("kotlin", "example.kt");
+  benchmarkFile("java", "example.java");
+  benchmarkFile("cpp", "example.cpp");
+}
+
+TEST_CASE("Rule Scanner Benchmark") {
+  HighlightConfig merged_config;
+  merged_config.use_builtin_dfa = false;
+  HighlightConfig scanner_config = merged_config;
+  scanner_config.use_rule_scanner = true;
+  SharedPtr<HighlightEngine> merged_engine = makeTestHighlightEngine(merged_config);
+  SharedPtr<HighlightEngine> scanner_engine = makeTestHighlightEngine(scanner_config);
+  // Many rules with literal-led patterns that rarely match, over long lines of plain text
+  const U8String sparse_syntax = R"JSON({
+  "name": "sparseMarkers",
+  "fileSuffixes": [".sparse"],
+  "states": {
+    "default": [
+      { "pattern": "TODO(?=:)", "style": "keyword" },
+      { "pattern": "FIXME(?=:)", "style": "keyword" },
+      { "pattern": "HACK(?=:)", "style": "keyword" },
+      { "pattern": "NOTE(?=:)", "style": "keyword" },
+      { "pattern": "https?://[^\\s)]+", "style": "url" },
+      { "pattern": "@[A-Za-z_]\\w*(?=\\()", "style": "annotation" },
+      { "pattern": "\\$\\{[^}]*\\}", "style": "variable" },
+      { "pattern": "#[0-9a-fA-F]{6}(?![0-9a-fA-F])", "style": "number" },
+      { "pattern": "\\b0x[0-9a-fA-F]+\\b", "style": "number" },
+      { "pattern": "\\b\\d+\\.\\d+(?:e[+-]?\\d+)?\\b", "style": "number" },
+      { "pattern": "`[^`]*`", "style": "string" },
+      { "pattern": "\\*\\*[^*]+\\*\\*", "style": "keyword" },
+      { "pattern": "\\[\\[[^\\]]+\\]\\]", "style": "property" },
+      { "pattern": "\\bv\\d+\\.\\d+\\.\\d+\\b", "style": "builtin" },
+      { "pattern": "(?<=\\s)--[a-z][a-z-]*", "style": "property" },
+      { "pattern": "\\b[A-Z]{2,}_[A-Z_]+\\b", "style": "macro" }
+    ]
+  }
+})JSON";
+  REQUIRE_NOTHROW(merged_engine->compileSyntaxFromJson(sparse_syntax));
+  REQUIRE_NOTHROW(scanner_engine->compileSyntaxFromJson(sparse_syntax));
+  for (const char* file_name : {"java.json", "cpp.json"}) {
+    REQUIRE_NOTHROW(merged_engine->compileSyntaxFromFile(syntaxPath(file_name)));
+    REQUIRE_NOTHROW(scanner_engine->compileSyntaxFromFile(syntaxPath(file_name)));
+  }
+
+  const auto benchmarkText = [&](const U8String& name, const U8String& file_name, const U8String& text) {
+    SharedPtr<TextAnalyzer> merged_analyzer = merged_engine->createAnalyzerByFileName(file_name);
+    SharedPtr<TextAnalyzer> scanner_analyzer = scanner_engine->createAnalyzerByFileName(file_name);
+    REQUIRE(merged_analyzer != nullptr);
+    REQUIRE(scanner_analyzer != nullptr);
+    BENCHMARK(U8String("Merged pattern ") + name) {
+      return merged_analyzer->analyzeText(text);
+    };
+    BENCHMARK(U8String("Rule scanner ") + name) {
+      return scanner_analyzer->analyzeText(text);
+    };
+  };
+  U8String sparse_text;
+  for (int line = 0; line < 50; ++line) {
+    for (int i = 0; i < 4; ++i) {
+      sparse_text += "the quick brown fox jumps over the lazy dog while reading a long paragraph of plain text ";
+    }
+    if (line % 7 == 0) {
+      sparse_text += "TODO: check https://example.com/path later ";
+    }
+    sparse_text += "\n";
+  }
+  benchmarkText("sparse markers", "notes.sparse", sparse_text);
+  // Dense code, where most rules match again right after the cursor
+  benchmarkText("java", "example.java", FileUtil::readString(TESTS_DIR"/files/example.java"));
+  benchmarkText("cpp", "example.cpp", FileUtil::readString(TESTS_DIR"/files/example.cpp"));
+}
+
+TEST_CASE("Long Line DFA Benchmark") {
+  // Every position starts an a+b that only fails at the end of the run, a search reads each byte a bounded
+  // number of times, so the time grows linearly with the line length
+  const U8String syntax = R"JSON({
+  "name": "longRun",
+  "fileSuffixes": [".run"],
+  "states": {
+    "default": [
+      { "pattern": "a+b", "style": "keyword" },
+      { "pattern": "\\d+", "style": "number" }
+    ]
+  }
+})JSON";
+  SharedPtr<HighlightEngine> engine = makeTestHighlightEngine();
+  REQUIRE_NOTHROW(engine->compileSyntaxFromJson(syntax));
+  SharedPtr<TextAnalyzer> analyzer = engine->createAnalyzerByFileName("a.run");
+  REQUIRE(analyzer != nullptr);
+  for (size_t length : {10000, 20000, 40000}) {
+    const U8String line = U8String(length, 'a') + " 1";
+    SharedPtr<DocumentHighlight> highlight = analyzer->analyzeText(line);
+    REQUIRE(highlight->spanCount() == 1);
+    BENCHMARK("DFA over a " + std::to_string(length / 1000) + "k-char run") {
+      return analyzer->analyzeText(line);
+    };
+  }
+}
@@ -28,6 +28,58 @@ namespace NS_SWEETLINE_TEST {
     return engine;
   }
 
+  /// Compile the "let-comment" syntax (.let files): let bindings, strings and numbers, plus block comments that
+  /// carry their state across lines
+  inline void compileLetCommentSyntax(const SharedPtr<HighlightEngine>& engine) {
+    REQUIRE_NOTHROW(engine->compileSyntaxFromJson(R"JSON(
+{
+  "name": "let-comment",
+  "fileSuffixes": [".let"],
+  "states": {
+    "default": [
+      { "pattern": "\\b(let)\\s+(\\w+)", "styles": [1, "keyword", 2, "variable"] },
+      { "pattern": "/\\*", "style": "comment", "state": "comment" },
+      { "pattern": "\"[^\"]*\"", "style": "string" },
+      { "pattern": "\\d+", "style": "number" }
+    ],
+    "comment": [
+      { "pattern": "\\*/", "style": "comment", "state": "default" }
+    ]
+  }
+}
+)JSON"));
+  }
+
+  /// Check an incremental result against a fresh analysis of the document text, positions included
+  inline void requireMatchesFreshAnalysis(const SharedPtr<DocumentHighlight>& highlight, const Document& document,
+    const SharedPtr<TextAnalyzer>& fresh_analyzer) {
+    REQUIRE(highlight != nullptr);
+    SharedPtr<DocumentHighlight> expected = fresh_analyzer->analyzeText(document.getText());
+    REQUIRE(highlight->lines.size() == document.getLineCount());
+    REQUIRE(highlight->lines.size() == expected->lines.size());
+    for (size_t line = 0; line < highlight->lines.size(); ++line) {
+      CAPTURE(line);
+      for (const TokenSpan& span : highlight->lines[line].spans) {
+        CHECK(span.range.start.line == line);
+        CHECK(span.range.end.line == line);
+        CHECK(span.range.start.index == document.charIndexOfLine(line) + span.range.start.column);
+      }
+      REQUIRE(highlight->lines[line] == expected->lines[line]);
+    }
+  }
+
+  /// Check that a slice starts at start_line and holds the same line_count lines as a full analysis
+  inline void requireSameLines(const SharedPtr<DocumentHighlightSlice>& slice,
+    const SharedPtr<DocumentHighlight>& expected, size_t start_line, size_t line_count) {
+    REQUIRE(slice != nullptr);
+    CHECK(slice->start_line == start_line);
+    REQUIRE(slice->lines.size() == line_count);
+    for (size_t i = 0; i < line_count; ++i) {
+      CAPTURE(start_line + i);
+      CHECK(slice->lines[i] == expected->lines[start_line + i]);
+    }
+  }
+
   inline int32_t styleAtColumn(const LineHighlight& line, size_t column) {
     for (const TokenSpan& span : line.spans) {
       if (column >= span.range.start.column && column < span.range.end.column) {
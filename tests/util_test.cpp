@@ -0,0 +1,205 @@
+#include <random>
+#include <typeinfo>
+#include <catch2/catch_amalgamated.hpp>
+#include <utf8/utf8.h>
+#include "sweetline/util.h"
+
+using namespace NS_SWEETLINE;
+
+namespace {
+  /// utfcpp walks one code point at a time, Utf8Util must give the same answers and throw the same exceptions
+  namespace reference {
+    size_t countChars(const U8String& str) {
+      return utf8::distance(str.begin(), str.end());
+    }
+
+    size_t charPosToBytePos(const U8String& str, size_t char_pos) {
+      auto it = str.begin();
+      for (size_t i = 0; i < char_pos && it != str.end(); ++i) {
+        utf8::next(it, str.end());
+      }
+      return it - str.begin();
+    }
+
+    size_t bytePosToCharPos(const U8String& str, size_t byte_pos) {
+      size_t char_count = 0;
+      auto it = str.begin();
+      while (it != str.end() && (it - str.begin()) < static_cast<ptrdiff_t>(byte_pos)) {
+        utf8::next(it, str.end());
+        char_count++;
+      }
+      return char_count;
+    }
+
+    U8String utf8Substr(const U8String& str, size_t start_char, size_t char_count) {
+      auto start_it = str.begin();
+      for (size_t i = 0; i < start_char && start_it != str.end(); ++i) {
+        utf8::next(start_it, str.end());
+      }
+      auto end_it = start_it;
+      for (size_t i = 0; i < char_count && end_it != str.end(); ++i) {
+        utf8::next(end_it, str.end());
+      }
+      return {start_it, end_it};
+    }
+  }
+
+  U8String describe(size_t value) {
+    return std::to_string(value);
+  }
+
+  U8String describe(const U8String& value) {
+    return "\"" + value + "\"";
+  }
+
+  /// Result of the callable, or the type of the exception it threw
+  template<typename Func>
+  U8String outcome(Func&& func) {
+    try {
+      return describe(func());
+    } catch (const std::exception& e) {
+      return U8String("throws ") + typeid(e).name();
+    }
+  }
+
+  const List<U8String> kValidPieces = {
+    "a", "Z", " ", "\t", "0", "\xC2\x80", "\xC3\xA9", "\xDF\xBF", "\xE0\xA0\x80", "\xE4\xB8\xAD", "\xED\x9F\xBF",
+    "\xEE\x80\x80", "\xEF\xBF\xBF", "\xF0\x90\x80\x80", "\xF0\x9F\x98\x80", "\xF4\x8F\xBF\xBF"
+  };
+
+  const List<U8String> kMalformedPieces = {
+    "\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xC3", "\xE4\xB8", "\xE0\x9F\xBF", "\xED\xA0\x80", "\xF0\x8F\xBF\xBF",
+    "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xF8", "\xFF", "\xC3\xA9\x80", "\xE4\x41\xAD"
+  };
+
+  /// Random text crossing several vector chunks, with ASCII runs between the multi-byte pieces
+  U8String randomText(std::mt19937& random, bool malformed) {
+    U8String text;
+    const size_t piece_count = random() % 48;
+    for (size_t i = 0; i < piece_count; ++i) {
+      if (random() % 3 == 0) {
+        text.append(random() % 24, 'x');
+      } else {
+        text += kValidPieces[random() % kValidPieces.size()];
+      }
+    }
+    if (malformed) {
+      text.insert(random() % (text.size() + 1), kMalformedPieces[random() % kMalformedPieces.size()]);
+    }
+    return text;
+  }
+
+  void checkMatchesReference(const U8String& text) {
+    CAPTURE(text);
+    CHECK(Utf8Util::isValidUTF8(text) == utf8::is_valid(text.begin(), text.end()));
+    CHECK(outcome([&] { return Utf8Util::countChars(text); })
+      == outcome([&] { return reference::countChars(text); }));
+    for (size_t pos = 0; pos <= text.size() + 2; ++pos) {
+      CAPTURE(pos);
+      CHECK(outcome([&] { return Utf8Util::charPosToBytePos(text, pos); })
+        == outcome([&] { return reference::charPosToBytePos(text, pos); }));
+      CHECK(outcome([&] { return Utf8Util::bytePosToCharPos(text, pos); })
+        == outcome([&] { return reference::bytePosToCharPos(text, pos); }));
+      CHECK(outcome([&] { return Utf8Util::utf8Substr(text, pos / 2, pos); })
+        == outcome([&] { return reference::utf8Substr(text, pos / 2, pos); }));
+    }
+  }
+}
+
+TEST_CASE("Utf8Util counts and maps offsets of well-formed text") {
+  const U8String text = "int 中文 = \"é\"; // 😀";
+  CHECK(Utf8Util::isValidUTF8(text));
+  CHECK(Utf8Util::countChars(text) == 18);
+  CHECK(Utf8Util::charPosToBytePos(text, 4) == 4);
+  CHECK(Utf8Util::charPosToBytePos(text, 5) == 7);
+  CHECK(Utf8Util::charPosToBytePos(text, 100) == text.size());
+  CHECK(Utf8Util::bytePosToCharPos(text, 7) == 5);
+  // A position inside a character counts that character
+  CHECK(Utf8Util::bytePosToCharPos(text, 8) == 6);
+  CHECK(Utf8Util::bytePosToCharPos(text, 100) == 18);
+  CHECK(Utf8Util::utf8Substr(text, 4, 2) == "中文");
+  CHECK(Utf8Util::utf8Substr(text, 17, 5) == "😀");
+
+  // Long runs go through the vector loops, including the per-byte counter flush every 255 chunks
+  U8String long_text;
+  for (size_t i = 0; i < 2000; ++i) {
+    long_text += i % 7 == 0 ? "中" : "ab";
+  }
+  const size_t wide_count = (2000 + 6) / 7;
+  const size_t char_count = wide_count + (2000 - wide_count) * 2;
+  CHECK(Utf8Util::countChars(long_text) == char_count);
+  CHECK(Utf8Util::charPosToBytePos(long_text, char_count) == long_text.size());
+  CHECK(Utf8Util::bytePosToCharPos(long_text, long_text.size()) == char_count);
+  checkMatchesReference(long_text);
+}
+
+TEST_CASE("Utf8Util::isAscii finds a non-ASCII byte anywhere in the text") {
+  CHECK(Utf8Util::isAscii(""));
+  CHECK(Utf8Util::isAscii(nullptr, 0));
+  // Lengths around the 16-byte vector chunks and the 8-byte words, so every loop sees the byte
+  for (size_t length : {1, 7, 8, 9, 15, 16, 17, 31, 33, 100}) {
+    CAPTURE(length);
+    const U8String ascii(length, 'a');
+    CHECK(Utf8Util::isAscii(ascii));
+    for (size_t pos : {size_t(0), length / 2, length - 1}) {
+      CAPTURE(pos);
+      U8String text = ascii;
+      text[pos] = '\x80';
+      CHECK_FALSE(Utf8Util::isAscii(text));
+      text[pos] = '\xFF';
+      CHECK_FALSE(Utf8Util::isAscii(text));
+    }
+  }
+  const U8String text = "ascii head \xE4\xB8\xAD";
+  CHECK(Utf8Util::isAscii(text.data(), 11));
+  CHECK_FALSE(Utf8Util::isAscii(text.data(), 12));
+}
+
+TEST_CASE("Utf8Util matches utfcpp on random well-formed and malformed text") {
+  std::mt19937 random(20240611);
+  for (size_t round = 0; round < 400; ++round) {
+    checkMatchesReference(randomText(random, round % 2 == 1));
+  }
+  for (const U8String& piece : kMalformedPieces) {
+    checkMatchesReference(piece);
+    checkMatchesReference("abc" + piece);
+    checkMatchesReference(U8String(20, 'a') + piece + "\xE4\xB8\xAD");
+  }
+}
+
+TEST_CASE("Utf8Util Benchmark") {
+  const auto repeat = [](const U8String& line, size_t count) {
+    U8String text;
+    for (size_t i = 0; i < count; ++i) {
+      text += line;
+    }
+    return text;
+  };
+  const U8String ascii = repeat("    public static void main(String[] args) { return; }\n", 200);
+  const U8String mixed = repeat("    // 计算结果 result = compute(\"é\", value);\n", 200);
+  const U8String cjk = repeat("天地玄黄宇宙洪荒日月盈昃辰宿列张寒来暑往秋收冬藏", 200);
+
+  for (const auto& entry : {std::make_pair("ascii", &ascii), std::make_pair("mixed", &mixed),
+                            std::make_pair("cjk", &cjk)}) {
+    const U8String& text = *entry.second;
+    const size_t middle = Utf8Util::countChars(text) / 2;
+    BENCHMARK(U8String("utfcpp countChars ") + entry.first) {
+      return reference::countChars(text);
+    };
+    BENCHMARK(U8String("Utf8Util countChars ") + entry.first) {
+      return Utf8Util::countChars(text);
+    };
+    BENCHMARK(U8String("utfcpp charPosToBytePos ") + entry.first) {
+      return reference::charPosToBytePos(text, middle);
+    };
+    BENCHMARK(U8String("Utf8Util charPosToBytePos ") + entry.first) {
+      return Utf8Util::charPosToBytePos(text, middle);
+    };
+    BENCHMARK(U8String("utfcpp isValidUTF8 ") + entry.first) {
+      return utf8::is_valid(text.begin(), text.end());
+    };
+    BENCHMARK(U8String("Utf8Util isValidUTF8 ") + entry.first) {
+      return Utf8Util::isValidUTF8(text);
+    };
+  }
+}